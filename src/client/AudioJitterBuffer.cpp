@@ -0,0 +1,213 @@
+#include "AudioJitterBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+TWILIGHT_DEFINE_LOGGER(AudioJitterBuffer);
+
+AudioJitterBuffer::AudioJitterBuffer(std::shared_ptr<NetworkClock> clock_)
+    : clock(std::move(clock_)),
+      decoder(nullptr),
+      swrCtx(nullptr),
+      hasLastSeq(false),
+      lastSeq(0),
+      lastPacketFrames(960),
+      smoothedDepth(0),
+      pcm(MAX_FRAMES_PER_PACKET * CHANNELS),
+      resampled((MAX_FRAMES_PER_PACKET + 256) * CHANNELS),
+      writtenFrames(0),
+      nextCaptureTime(-1),
+      prebuffering(true),
+      readFrames(0),
+      hasAnchor(false),
+      anchor{},
+      smoothedLatency(-1),
+      targetFrames(SAMPLE_RATE * 40 / 1000),
+      outputLatency(0),
+      statLatency(-1),
+      flagOverrun(false),
+      statDepth(0),
+      statSpeed(1.0f),
+      statUnderruns(0),
+      statOverruns(0),
+      statConcealed(0),
+      statDiscarded(0) {
+    int stat;
+
+    decoder = opus_decoder_create(SAMPLE_RATE, CHANNELS, &stat);
+    log.assert_quit(stat == OPUS_OK, "Failed to create opus decoder");
+
+    // Same format on both sides; only used for drift compensation
+    swrCtx = swr_alloc_set_opts(nullptr, AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_FLT, SAMPLE_RATE, AV_CH_LAYOUT_STEREO,
+                                AV_SAMPLE_FMT_FLT, SAMPLE_RATE, 0, nullptr);
+    log.assert_quit(swrCtx != nullptr, "Failed to allocate swr context");
+    av_opt_set_int(swrCtx, "flags", SWR_FLAG_RESAMPLE, 0);
+    stat = swr_init(swrCtx);
+    log.assert_quit(0 <= stat, "Failed to initialize swr context");
+}
+
+AudioJitterBuffer::~AudioJitterBuffer() {
+    swr_free(&swrCtx);
+    if (decoder != nullptr)
+        opus_decoder_destroy(decoder);
+}
+
+void AudioJitterBuffer::setTargetLatency(std::chrono::milliseconds latency) {
+    size_t frames = std::clamp<long long>(latency.count(), 5, 200) * SAMPLE_RATE / 1000;
+    targetFrames.store(frames, std::memory_order_relaxed);
+}
+
+void AudioJitterBuffer::setOutputLatency(std::chrono::microseconds latency) {
+    outputLatency.store(latency.count(), std::memory_order_relaxed);
+}
+
+void AudioJitterBuffer::pushPacket(uint32_t seq, std::chrono::microseconds timeCaptured, const uint8_t* data,
+                                   size_t len) {
+    int frames = opus_packet_get_nb_samples(data, len, SAMPLE_RATE);
+    if (frames <= 0) {
+        static LogRateLimit invalidLimit;
+        log.warn(invalidLimit, "Received invalid opus packet");
+        return;
+    }
+
+    uint32_t lost = 0;
+    if (hasLastSeq) {
+        int32_t diff = static_cast<int32_t>(seq - lastSeq);
+        if (diff <= 0) {
+            statDiscarded.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        lost = diff - 1;
+    }
+
+    // Too many missing to conceal; just continue from here
+    if (MAX_CONCEALED_PACKETS < lost)
+        lost = 0;
+
+    // Concealed audio takes place of lost packets, right before this one
+    if (0 < timeCaptured.count())
+        nextCaptureTime = timeCaptured.count() - (long long)lost * lastPacketFrames * 1'000'000 / SAMPLE_RATE;
+
+    if (0 < lost) {
+        for (uint32_t i = 1; i < lost; i++)
+            decode_(nullptr, 0, lastPacketFrames, false);
+        decode_(data, len, lastPacketFrames, true);
+        statConcealed.fetch_add(lost, std::memory_order_relaxed);
+    }
+
+    hasLastSeq = true;
+    lastSeq = seq;
+    lastPacketFrames = frames;
+    decode_(data, len, frames, false);
+}
+
+void AudioJitterBuffer::decode_(const uint8_t* data, size_t len, int frames, bool fec) {
+    frames = std::min<int>(frames, MAX_FRAMES_PER_PACKET);
+    int stat = opus_decode_float(decoder, data, len, pcm.data(), frames, fec ? 1 : 0);
+    if (stat < 0) {
+        static LogRateLimit decodeLimit;
+        log.warn(decodeLimit, "Failed to decode opus packet: {}", opus_strerror(stat));
+        return;
+    }
+    write_(pcm.data(), stat);
+}
+
+void AudioJitterBuffer::write_(const float* input, int frames) {
+    const size_t target = targetFrames.load(std::memory_order_relaxed);
+    const size_t depth = (decltype(ring)::SIZE - ring.available()) / CHANNELS;
+
+    // Depth jumps by a packet each push; average over roughly a second to get the drift trend
+    smoothedDepth += (depth - smoothedDepth) * 0.02f;
+
+    // Aim to remove the error in about a second, but never change speed audibly
+    float error = smoothedDepth - target;
+    float speed = 1.0f + std::clamp(error / SAMPLE_RATE, -MAX_SPEED_ADJUST, MAX_SPEED_ADJUST);
+    int delta = static_cast<int>(std::lround(frames * (1.0f - speed)));
+    swr_set_compensation(swrCtx, delta, frames);
+    statSpeed.store(speed, std::memory_order_relaxed);
+
+    const uint8_t* inPtr = reinterpret_cast<const uint8_t*>(input);
+    uint8_t* outPtr = reinterpret_cast<uint8_t*>(resampled.data());
+    int maxOutput = static_cast<int>(resampled.size() / CHANNELS);
+    int stat = swr_convert(swrCtx, &outPtr, maxOutput, &inPtr, frames);
+    log.assert_quit(0 <= stat, "Failed to call swr_convert");
+
+    size_t amount = stat * CHANNELS;
+    size_t written = ring.write(resampled.data(), amount);
+    if (written < amount) {
+        statOverruns.fetch_add(1, std::memory_order_relaxed);
+        flagOverrun.store(true, std::memory_order_relaxed);
+    }
+    writtenFrames += written / CHANNELS;
+
+    if (0 <= nextCaptureTime) {
+        // Samples still inside the resampler are not in the ring yet
+        nextCaptureTime += (long long)frames * 1'000'000 / SAMPLE_RATE;
+        anchors.write(TimeAnchor{writtenFrames, nextCaptureTime - swr_get_delay(swrCtx, 1'000'000)});
+    }
+}
+
+void AudioJitterBuffer::read(float* out, size_t frames) {
+    const size_t target = targetFrames.load(std::memory_order_relaxed);
+    const size_t requested = frames * CHANNELS;
+
+    // Only consumer can drop; skip stale samples so that latency does not build up
+    if (flagOverrun.exchange(false, std::memory_order_relaxed)) {
+        size_t buffered = ring.size();
+        if (buffered > target * CHANNELS)
+            readFrames += ring.drop(buffered - target * CHANNELS) / CHANNELS;
+    }
+
+    size_t readAmount = 0;
+    if (prebuffering) {
+        if (ring.size() >= target * CHANNELS)
+            prebuffering = false;
+    }
+    if (!prebuffering) {
+        readAmount = ring.read(out, requested);
+        if (readAmount < requested) {
+            // Refill up to target before playing again, instead of stuttering every callback
+            prebuffering = true;
+            statUnderruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (readAmount < requested)
+        memset(out + readAmount, 0, (requested - readAmount) * sizeof(float));
+
+    // Positions map linearly to time, so the newest anchor is good enough for any sample
+    while (anchors.read(&anchor))
+        hasAnchor = true;
+
+    if (hasAnchor && 0 < readAmount) {
+        long long frames = static_cast<long long>(anchor.pos - readFrames);
+        long long timeCaptured = anchor.time - frames * 1'000'000 / SAMPLE_RATE;
+        long long delay = clock->time().count() + outputLatency.load(std::memory_order_relaxed) - timeCaptured;
+
+        smoothedLatency = smoothedLatency < 0 ? delay : smoothedLatency + (delay - smoothedLatency) / 8;
+        statLatency.store(smoothedLatency, std::memory_order_relaxed);
+    }
+
+    readFrames += readAmount / CHANNELS;
+    statDepth.store(ring.size() / CHANNELS, std::memory_order_relaxed);
+}
+
+AudioJitterBuffer::Stat AudioJitterBuffer::getStat() const {
+    Stat ret;
+    ret.depth = statDepth.load(std::memory_order_relaxed) * 1000.0f / SAMPLE_RATE;
+    ret.targetDepth = targetFrames.load(std::memory_order_relaxed) * 1000.0f / SAMPLE_RATE;
+    ret.speed = statSpeed.load(std::memory_order_relaxed);
+    ret.underruns = statUnderruns.load(std::memory_order_relaxed);
+    ret.overruns = statOverruns.load(std::memory_order_relaxed);
+    ret.concealed = statConcealed.load(std::memory_order_relaxed);
+    ret.discarded = statDiscarded.load(std::memory_order_relaxed);
+
+    long long latencyNow = statLatency.load(std::memory_order_relaxed);
+    ret.latency = latencyNow < 0 ? -1.0f : latencyNow / 1000.0f;
+    return ret;
+}
+
+std::chrono::microseconds AudioJitterBuffer::latency() const {
+    return std::chrono::microseconds(statLatency.load(std::memory_order_relaxed));
+}
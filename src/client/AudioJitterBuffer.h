@@ -0,0 +1,118 @@
+#ifndef TWILIGHT_CLIENT_AUDIOJITTERBUFFER_H
+#define TWILIGHT_CLIENT_AUDIOJITTERBUFFER_H
+
+#include "common/SpscRingBuffer.h"
+#include "common/ffmpeg-headers.h"
+#include "common/log.h"
+
+#include "client/NetworkClock.h"
+
+#include <opus.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Decodes opus packets and buffers them for a playback device, keeping buffered amount near a target.
+// Server and client audio clocks drift apart, so output is resampled by a tiny ratio to track that.
+// Missing packets are concealed using in-band FEC of the next packet, or PLC if that is also missing.
+// Capture timestamps are carried along with samples, so that delay of audio being played is known at any time.
+//
+// pushPacket() must be called from one producer thread, read() from one consumer (e.g. audio callback).
+class AudioJitterBuffer {
+public:
+    static constexpr int SAMPLE_RATE = 48000;
+    static constexpr int CHANNELS = 2;
+
+    // Playback speed never deviates from 1.0 more than this
+    static constexpr float MAX_SPEED_ADJUST = 0.005f;
+
+    struct Stat {
+        float depth;          //< Buffered audio in ms
+        float targetDepth;    //< Target of depth in ms
+        float speed;          //< Playback speed adjustment (1.0 if none)
+        uint64_t underruns;   //< Times the device had to play silence
+        uint64_t overruns;    //< Times decoded audio didn't fit into buffer
+        uint64_t concealed;   //< Lost packets recovered by FEC or PLC
+        uint64_t discarded;   //< Late or duplicated packets
+        float latency;        //< Capture-to-speaker delay in ms (negative if unknown)
+    };
+
+    explicit AudioJitterBuffer(std::shared_ptr<NetworkClock> clock);
+    AudioJitterBuffer(const AudioJitterBuffer& copy) = delete;
+    AudioJitterBuffer(AudioJitterBuffer&& move) = delete;
+    ~AudioJitterBuffer();
+
+    // Safe to call from any thread
+    void setTargetLatency(std::chrono::milliseconds latency);
+
+    // Safe to call from any thread. How long the device takes to play samples after read().
+    void setOutputLatency(std::chrono::microseconds latency);
+
+    // Producer side. Sequence number increases by one for each packet.
+    // timeCaptured is in server clock (as NetworkClock::time()), or zero if unknown.
+    void pushPacket(uint32_t seq, std::chrono::microseconds timeCaptured, const uint8_t* data, size_t len);
+
+    // Consumer side. Always fills `frames` interleaved stereo frames (with silence if needed).
+    void read(float* out, size_t frames);
+
+    // Safe to call from any thread. Counters are cumulative.
+    Stat getStat() const;
+
+    // Safe to call from any thread. Capture-to-speaker delay of audio played right now (negative if unknown).
+    std::chrono::microseconds latency() const;
+
+private:
+    static constexpr size_t MAX_FRAMES_PER_PACKET = 5760;
+    static constexpr uint32_t MAX_CONCEALED_PACKETS = 5;
+
+    static NamedLogger log;
+
+    // Capture time of the ring position `pos`, counted in frames since start
+    struct TimeAnchor {
+        uint64_t pos;
+        long long time;
+    };
+
+    void decode_(const uint8_t* data, size_t len, int frames, bool fec);
+    void write_(const float* pcm, int frames);
+
+    std::shared_ptr<NetworkClock> clock;
+    OpusDecoder* decoder;
+    SwrContext* swrCtx;
+
+    // Producer only
+    bool hasLastSeq;
+    uint32_t lastSeq;
+    int lastPacketFrames;
+    float smoothedDepth;
+    std::vector<float> pcm;
+    std::vector<float> resampled;
+    uint64_t writtenFrames;
+    long long nextCaptureTime;  // Of the next sample to be decoded. Negative if unknown.
+
+    // Consumer only
+    bool prebuffering;
+    uint64_t readFrames;
+    bool hasAnchor;
+    TimeAnchor anchor;
+    long long smoothedLatency;
+
+    std::atomic<size_t> targetFrames;
+    std::atomic<long long> outputLatency;
+    std::atomic<long long> statLatency;
+    std::atomic<bool> flagOverrun;
+    std::atomic<size_t> statDepth;
+    std::atomic<float> statSpeed;
+    std::atomic<uint64_t> statUnderruns;
+    std::atomic<uint64_t> statOverruns;
+    std::atomic<uint64_t> statConcealed;
+    std::atomic<uint64_t> statDiscarded;
+
+    SpscRingBuffer<float, SAMPLE_RATE * CHANNELS / 2> ring;
+    SpscRingBuffer<TimeAnchor, 256> anchors;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "ClockEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+static constexpr long long STEP_THRESHOLD = 300'000;    // 300 ms
+static constexpr long long MIN_DRIFT_SPAN = 2'000'000;  // 2 s
+static constexpr double MAX_DRIFT = 500e-6;
+
+// Drift is pulled towards zero as if this was its standard deviation, so that a short span can't swing it far
+static constexpr double DRIFT_PRIOR = 50e-6;
+
+// Offset error of a sample that saw no queueing at all, from asymmetric routes and timer resolution
+static constexpr double SAMPLE_NOISE = 200;
+
+// How fast error grows away from the samples; Crystals are usually within 50 ppm, so twice that before fitting
+static constexpr double DRIFT_UNCERTAINTY = 100e-6;
+static constexpr double FITTED_DRIFT_UNCERTAINTY = 5e-6;
+
+ClockEstimator::ClockEstimator() {
+    reset();
+}
+
+ClockEstimator::~ClockEstimator() {}
+
+void ClockEstimator::reset() {
+    count = 0;
+    nextIdx = 0;
+    bucketCount = 0;
+    bucketIdx = 0;
+    bucketBegin = 0;
+    refLocal = 0;
+    refOffset = 0;
+    drift = 0;
+    driftFitted = false;
+    driftUncertainty = DRIFT_UNCERTAINTY;
+    residual = 0;
+    latestLocal = 0;
+    minRtt = 0;
+    medianRtt = 0;
+    rttJitter = 0;
+}
+
+void ClockEstimator::addSample(long long localSent, long long remote, long long localReceived) {
+    long long rtt = localReceived - localSent;
+    if (rtt < 0)
+        return;
+
+    long long local = localSent + rtt / 2;
+    long long offset = remote - local;
+
+    // Way outside of what any delay explains; Remote clock jumped and history is useless
+    if (hasEstimate() && STEP_THRESHOLD + rtt / 2 + errorAt(local) < std::abs(offset - offsetAt(local)))
+        reset();
+
+    const Sample sample{local, offset, rtt};
+    samples[nextIdx] = sample;
+    nextIdx = (nextIdx + 1) % WINDOW_SIZE;
+    count = std::min(count + 1, WINDOW_SIZE);
+    addToBucket_(sample);
+
+    fit_();
+}
+
+long long ClockEstimator::offsetAt(long long local) const {
+    return std::llround(refOffset + drift * (local - refLocal));
+}
+
+long long ClockEstimator::errorAt(long long local) const {
+    // Only the RTT bounds the offset until there are enough samples to tell the spread
+    double ret = converged() ? residual : minRtt / 2.0;
+    ret += std::abs(local - latestLocal) * driftUncertainty;
+    return std::llround(ret);
+}
+
+// Weight of a sample in fits. Queueing shows up as RTT above the best one, and may have moved the offset by up to
+// half of that.
+static double weightOf(long long rtt, long long bestRtt) {
+    double noise = SAMPLE_NOISE + (rtt - bestRtt) / 2.0;
+    return 1 / (noise * noise);
+}
+
+void ClockEstimator::addToBucket_(const Sample& sample) {
+    if (bucketCount == 0 || DRIFT_BUCKET_SPAN <= sample.local - bucketBegin) {
+        bucketIdx = bucketCount == 0 ? 0 : (bucketIdx + 1) % DRIFT_BUCKETS;
+        bucketCount = std::min(bucketCount + 1, DRIFT_BUCKETS);
+        bucketBegin = sample.local;
+        buckets[bucketIdx] = sample;
+    } else if (sample.rtt < buckets[bucketIdx].rtt) {
+        buckets[bucketIdx] = sample;
+    }
+}
+
+void ClockEstimator::fitDrift_() {
+    long long bestRtt = buckets[0].rtt;
+    long long minLocal = buckets[0].local;
+    long long maxLocal = buckets[0].local;
+    for (size_t i = 1; i < bucketCount; i++) {
+        bestRtt = std::min(bestRtt, buckets[i].rtt);
+        minLocal = std::min(minLocal, buckets[i].local);
+        maxLocal = std::max(maxLocal, buckets[i].local);
+    }
+
+    driftFitted = 3 <= bucketCount && MIN_DRIFT_SPAN <= maxLocal - minLocal;
+    if (!driftFitted) {
+        drift = 0;
+        driftUncertainty = DRIFT_UNCERTAINTY;
+        return;
+    }
+
+    // Weighted least squares line, centered at the first sample to keep precision
+    const long long base = buckets[0].local;
+    double sumW = 0, meanX = 0, meanY = 0;
+    for (size_t i = 0; i < bucketCount; i++) {
+        double w = weightOf(buckets[i].rtt, bestRtt);
+        sumW += w;
+        meanX += w * (buckets[i].local - base);
+        meanY += w * buckets[i].offset;
+    }
+    meanX /= sumW;
+    meanY /= sumW;
+
+    double sxx = 0, sxy = 0;
+    for (size_t i = 0; i < bucketCount; i++) {
+        double w = weightOf(buckets[i].rtt, bestRtt);
+        double dx = buckets[i].local - base - meanX;
+        sxx += w * dx * dx;
+        sxy += w * dx * (buckets[i].offset - meanY);
+    }
+
+    // Prior of zero drift; Matters only until the samples span long enough to tell the slope apart from noise
+    const double precision = sxx + 1 / (DRIFT_PRIOR * DRIFT_PRIOR);
+    drift = std::clamp(sxy / precision, -MAX_DRIFT, MAX_DRIFT);
+    driftUncertainty = std::max(FITTED_DRIFT_UNCERTAINTY, 1 / std::sqrt(precision));
+}
+
+void ClockEstimator::fit_() {
+    std::array<Sample, WINDOW_SIZE> sorted;
+    std::copy(samples.begin(), samples.begin() + count, sorted.begin());
+    std::sort(sorted.begin(), sorted.begin() + count, [](const Sample& a, const Sample& b) { return a.rtt < b.rtt; });
+
+    minRtt = sorted[0].rtt;
+    medianRtt = sorted[count / 2].rtt;
+
+    long long deviation = 0;
+    latestLocal = sorted[0].local;
+    for (size_t i = 0; i < count; i++) {
+        deviation += std::abs(sorted[i].rtt - medianRtt);
+        latestLocal = std::max(latestLocal, sorted[i].local);
+    }
+    rttJitter = deviation / static_cast<long long>(count);
+
+    fitDrift_();
+
+    // Better half by RTT; The rest were delayed by queueing
+    const size_t n = std::max(std::min<size_t>(count, 3), count / 2);
+
+    if (driftFitted) {
+        // Weighted mean of the offset at the latest sample, taking drift out of older ones
+        refLocal = latestLocal;
+        double sumW = 0, sumOffset = 0;
+        for (size_t i = 0; i < n; i++) {
+            double w = weightOf(sorted[i].rtt, minRtt);
+            sumW += w;
+            sumOffset += w * (sorted[i].offset - drift * (sorted[i].local - refLocal));
+        }
+        refOffset = sumOffset / sumW;
+    } else {
+        refLocal = sorted[0].local;
+        refOffset = static_cast<double>(sorted[0].offset);
+    }
+
+    double sumSq = 0;
+    for (size_t i = 0; i < n; i++) {
+        double err = sorted[i].offset - (refOffset + drift * (sorted[i].local - refLocal));
+        sumSq += err * err;
+    }
+    residual = std::sqrt(sumSq / n);
+}
@@ -0,0 +1,87 @@
+#ifndef TWILIGHT_CLIENT_CLOCKESTIMATOR_H
+#define TWILIGHT_CLIENT_CLOCKESTIMATOR_H
+
+#include <array>
+#include <cstddef>
+
+// NTP style estimator of the offset between local clock and a remote one, using ping round trips.
+// A round trip bounds the offset within its RTT, and queueing only ever adds delay (often to one direction only),
+// so samples with the smallest RTT are the most accurate.
+// Drift between both clocks is fitted by a line through the best sample of each few seconds over the last minutes,
+// weighted by how much queueing each one may have seen, and pulled towards zero while the span is short.
+// Offset then comes from the better half of a sliding window of recent samples.
+//
+// Never reads a clock by itself; All times are in microseconds and given by the caller, so that it can be driven
+// by a simulated clock. Not thread safe.
+class ClockEstimator {
+public:
+    static constexpr size_t WINDOW_SIZE = 32;
+    static constexpr size_t MIN_SAMPLES = 5;     //< Samples required before estimate is considered converged
+    static constexpr size_t DRIFT_BUCKETS = 64;  //< Best sample of each bucket is kept to fit the drift
+    static constexpr long long DRIFT_BUCKET_SPAN = 5'000'000;
+
+    ClockEstimator();
+    ~ClockEstimator();
+
+    void reset();
+
+    // [in] localSent: Local time when the ping was sent
+    // [in] remote: Remote time when the ping was answered
+    // [in] localReceived: Local time when the answer arrived
+    void addSample(long long localSent, long long remote, long long localReceived);
+
+    bool hasEstimate() const { return 0 < count; }
+    bool converged() const { return MIN_SAMPLES <= count; }
+
+    // Remote time minus local time, at local time `local`
+    long long offsetAt(long long local) const;
+
+    // Expected error of offsetAt(local). Grows as `local` gets farther from the samples.
+    long long errorAt(long long local) const;
+
+    // Rate of remote clock relative to local clock minus one (e.g. 1e-5 if remote runs faster by 10 ppm)
+    double getDrift() const { return drift; }
+
+    // Standard deviation of getDrift(), as far as the samples tell
+    double getDriftUncertainty() const { return driftUncertainty; }
+
+    long long getMinRtt() const { return minRtt; }
+    long long getMedianRtt() const { return medianRtt; }
+
+    // Mean absolute deviation of RTT from its median
+    long long getRttJitter() const { return rttJitter; }
+
+private:
+    struct Sample {
+        long long local;   // Midpoint of the round trip
+        long long offset;  // Remote minus local, assuming symmetric delay
+        long long rtt;
+    };
+
+    void addToBucket_(const Sample& sample);
+    void fitDrift_();
+    void fit_();
+
+    std::array<Sample, WINDOW_SIZE> samples;
+    size_t count;
+    size_t nextIdx;
+
+    std::array<Sample, DRIFT_BUCKETS> buckets;
+    size_t bucketCount;
+    size_t bucketIdx;  // Bucket being filled
+    long long bucketBegin;
+
+    long long refLocal;
+    double refOffset;
+    double drift;
+    bool driftFitted;
+    double driftUncertainty;
+    double residual;
+    long long latestLocal;
+
+    long long minRtt;
+    long long medianRtt;
+    long long rttJitter;
+};
+
+#endif
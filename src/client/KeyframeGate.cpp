@@ -0,0 +1,96 @@
+#include "KeyframeGate.h"
+
+TWILIGHT_DEFINE_LOGGER(KeyframeGate);
+
+// Server merges requests until it sends the IDR frame, so this only covers a request that got nowhere
+static constexpr long long REQUEST_RETRY = 1'000'000;  // 1s
+
+static long long steadyClockNow() {
+    auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+}
+
+KeyframeGate::KeyframeGate(std::function<void()> requestKeyframe_)
+    : KeyframeGate(std::move(requestKeyframe_), &steadyClockNow) {}
+
+KeyframeGate::KeyframeGate(std::function<void()> requestKeyframe_, SteadyClockFn steadyNow_)
+    : requestKeyframe(std::move(requestKeyframe_)),
+      steadyNow(steadyNow_),
+      started(false),
+      waiting(false),
+      lostTime(0),
+      lastRequest(0),
+      losses(0),
+      dropped(0),
+      requests(0),
+      recoveryTime(300) {}
+
+bool KeyframeGate::admit(bool isIDR) {
+    const long long now = steadyNow();
+    bool request = false;
+
+    /* lock */ {
+        std::lock_guard lock(stateLock);
+
+        if (isIDR) {
+            if (waiting) {
+                recoveryTime.pushValue((now - lostTime) / 1000.0f);
+                waiting = false;
+            }
+            started = true;
+            return true;
+        }
+
+        if (started && !waiting)
+            return true;
+
+        if (!waiting) {
+            // Joined in the middle of a GOP
+            startWaiting_(now);
+            request = true;
+        } else if (REQUEST_RETRY <= now - lastRequest) {
+            lastRequest = now;
+            requests++;
+            request = true;
+        }
+        dropped++;
+    }
+
+    if (request)
+        requestKeyframe();
+    return false;
+}
+
+void KeyframeGate::markLost() {
+    const long long now = steadyNow();
+
+    /* lock */ {
+        std::lock_guard lock(stateLock);
+        if (waiting)
+            return;
+        startWaiting_(now);
+    }
+
+    static LogRateLimit lossLimit;
+    log.debug(lossLimit, "Lost a video frame; Requesting keyframe");
+    requestKeyframe();
+}
+
+KeyframeGate::Stat KeyframeGate::getStat() {
+    std::lock_guard lock(stateLock);
+
+    Stat ret;
+    ret.losses = losses;
+    ret.dropped = dropped;
+    ret.requests = requests;
+    ret.recovery = recoveryTime.calcStat();
+    return ret;
+}
+
+void KeyframeGate::startWaiting_(long long now) {
+    waiting = true;
+    lostTime = now;
+    lastRequest = now;
+    losses++;
+    requests++;
+}
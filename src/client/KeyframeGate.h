@@ -0,0 +1,63 @@
+#ifndef TWILIGHT_CLIENT_KEYFRAMEGATE_H
+#define TWILIGHT_CLIENT_KEYFRAMEGATE_H
+
+#include "common/StatisticMixer.h"
+#include "common/log.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+// Holds back video frames the decoder can't use, because a frame they depend on never reached it,
+// until the next IDR frame. Asks the server for that IDR frame instead of waiting for the periodic one.
+class KeyframeGate {
+public:
+    struct Stat {
+        uint64_t losses;                //< Times frames were lost and decoding had to wait for an IDR frame
+        uint64_t dropped;               //< Frames held back while waiting
+        uint64_t requests;              //< Keyframe requests sent, including retries
+        StatisticMixer::Stat recovery;  //< Time from the loss to receiving the IDR frame, in ms
+    };
+
+    // Returns a steady local time in microseconds
+    using SteadyClockFn = long long (*)();
+
+    // `requestKeyframe` is called from the thread calling admit() or markLost()
+    explicit KeyframeGate(std::function<void()> requestKeyframe);
+    // Reads local time from `steadyNow` instead of std::chrono::steady_clock, so that tests can simulate it
+    KeyframeGate(std::function<void()> requestKeyframe, SteadyClockFn steadyNow);
+    KeyframeGate(const KeyframeGate& copy) = delete;
+    KeyframeGate(KeyframeGate&& move) = delete;
+
+    // Returns false if the frame must not be given to the decoder.
+    // Frames before the first IDR frame count as lost, as the stream was joined in the middle.
+    bool admit(bool isIDR);
+
+    // A frame was lost before reaching admit()
+    void markLost();
+
+    // Safe to call from any thread
+    Stat getStat();
+
+private:
+    static NamedLogger log;
+
+    void startWaiting_(long long now);
+
+    std::function<void()> requestKeyframe;
+    SteadyClockFn steadyNow;
+
+    std::mutex stateLock;
+    bool started;
+    bool waiting;
+    long long lostTime;
+    long long lastRequest;
+
+    uint64_t losses;
+    uint64_t dropped;
+    uint64_t requests;
+    StatisticMixer recoveryTime;
+};
+
+#endif
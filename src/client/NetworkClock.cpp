@@ -1,128 +1,204 @@
 #include "NetworkClock.h"
 
+#include <algorithm>
 #include <type_traits>
 
 TWILIGHT_DEFINE_LOGGER(NetworkClock);
 
 using namespace std::chrono_literals;
 
-static constexpr uint64_t PANIC_THRESHOLD = 300'000;  // 300 ms
-static constexpr uint64_t MINIMUM_THRESHOLD = 100;    // 0.1 ms
+static constexpr long long PANIC_THRESHOLD = 300'000;  // 300 ms
 
-NetworkClock::NetworkClock()
-    : networkLatency(0),
-      networkJitter(0),
-      pingTimingIdx(0),
-      epoch(std::chrono::steady_clock::now().time_since_epoch().count()),
-      lastPing(std::chrono::steady_clock::now()),
+// Smaller corrections are spread over time at this rate, so that time() never goes backwards.
+// Far above any drift between clocks, and too small to notice in frame or audio timing.
+static constexpr double SLEW_RATE = 0.005;
+
+// Ping whenever expected error grows over this, but not more often than MIN_PING_INTERVAL
+static constexpr long long TARGET_ERROR = 500;  // 0.5 ms
+static constexpr std::chrono::milliseconds WARMUP_PING_INTERVAL = 20ms;
+static constexpr std::chrono::milliseconds MIN_PING_INTERVAL = 100ms;
+static constexpr std::chrono::milliseconds MAX_PING_INTERVAL = 10s;
+static constexpr std::chrono::milliseconds POLL_INTERVAL = 15ms;
+
+// Drift is fitted to the best sample of each few seconds, so keep sampling those until drift is known well
+static constexpr std::chrono::milliseconds DRIFT_PING_INTERVAL = 500ms;
+static constexpr double TARGET_DRIFT_UNCERTAINTY = 10e-6;
+
+static long long steadyClockNow() {
+    auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+}
+
+NetworkClock::NetworkClock() : NetworkClock(&steadyClockNow) {}
+
+NetworkClock::NetworkClock(SteadyClockFn steadyNow_)
+    : stateSeq(0),
+      stateEpoch(steadyNow_()),
+      stateSlewBegin(stateEpoch.load()),
+      stateSlew(0),
+      stateDrift(0),
+      statLatency(0),
+      statJitter(0),
+      statError(-1),
+      steadyNow(steadyNow_),
+      lastPing(stateEpoch.load()),
       random(std::random_device()()) {}
 
 NetworkClock::~NetworkClock() {}
 
 std::chrono::microseconds NetworkClock::time() const {
-    auto t = std::chrono::steady_clock::now().time_since_epoch();
-    auto currEpoch = std::chrono::steady_clock::duration(epoch.load(std::memory_order_relaxed));
-    return std::chrono::duration_cast<std::chrono::microseconds>(t - currEpoch);
+    return std::chrono::microseconds(timeAt_(loadState_(), steadyNow()));
 }
 
 int NetworkClock::latency() const {
-    return networkLatency;
+    return statLatency.load(std::memory_order_relaxed);
 }
 
 int NetworkClock::jitter() const {
-    return networkJitter;
+    return statJitter.load(std::memory_order_relaxed);
+}
+
+int NetworkClock::error() const {
+    return statError.load(std::memory_order_relaxed);
 }
 
 void NetworkClock::adjust(uint32_t pingId, uint64_t clock) {
-    std::chrono::steady_clock::time_point currClock = std::chrono::steady_clock::now();
+    const long long now = steadyNow();
 
     monotonicHint(std::chrono::microseconds(clock));
 
     std::lock_guard lk(lock);
 
-    auto currEpoch = std::chrono::steady_clock::duration(epoch.load(std::memory_order_relaxed));
     auto itr = pingReqMap.find(pingId);
     if (itr == pingReqMap.end())
         return;
 
-    std::chrono::steady_clock::time_point prevClock = itr->second;
+    const long long sent = itr->second;
     pingReqMap.erase(itr);
 
-    long long ping = std::chrono::duration_cast<std::chrono::microseconds>(currClock - prevClock).count();
-
-    if (networkLatency == 0)
-        networkLatency = ping;
-    else
-        networkLatency += (ping - networkLatency) / 2;
+    const bool hadEstimate = estimator.hasEstimate();
+    estimator.addSample(sent, clock, now);
 
     // Zero means no estimation
-    networkLatency = std::max(1, networkLatency);
-
-    std::chrono::microseconds remoteClock = std::chrono::microseconds(clock - ping / 2);
-    std::chrono::microseconds localClock =
-        std::chrono::duration_cast<std::chrono::microseconds>(currClock.time_since_epoch() - currEpoch) -
-        std::chrono::microseconds(ping / 2);
-
-    std::chrono::microseconds diff = remoteClock - localClock;
-    long long absDiff = std::abs(diff.count());
-    log.debug("Ping diff by {} us", diff.count());
-
-    auto adjustment = std::chrono::duration_cast<std::chrono::steady_clock::duration>(diff).count();
-    if (PANIC_THRESHOLD <= absDiff) {
-        epoch.fetch_sub(adjustment, std::memory_order_relaxed);
-        pingTimingIdx = 0;
-    } else if (MINIMUM_THRESHOLD <= absDiff)
-        epoch.fetch_sub(adjustment / 2, std::memory_order_relaxed);
+    statLatency.store(std::max<long long>(1, estimator.getMedianRtt()), std::memory_order_relaxed);
+    statJitter.store(estimator.getRttJitter(), std::memory_order_relaxed);
+    statError.store(estimator.errorAt(now), std::memory_order_relaxed);
+
+    ClockState state = loadState_();
+    long long diff = now + estimator.offsetAt(now) - timeAt_(state, now);
+
+    log.debug("Clock diff by {} us (error {} us, drift {:.2f} ppm, RTT {} us)", diff, estimator.errorAt(now),
+              estimator.getDrift() * 1e6, estimator.getMinRtt());
+
+    rebase_(&state, now);
+    if (!hadEstimate || PANIC_THRESHOLD <= std::abs(diff)) {
+        // First estimate, either of this connection or since the remote clock jumped
+        if (hadEstimate)
+            log.warn("Stepping clock by {} ms", diff / 1000);
+        state.epoch -= diff;
+        state.slew = 0;
+    } else {
+        // Replaces what is left of the previous correction, as diff is measured from time() as it is now
+        state.slew = diff;
+    }
+    // Keeps time() following the server clock until the next ping, instead of lagging until slew catches up
+    state.drift = estimator.getDrift();
+    storeState_(state);
 }
 
 void NetworkClock::monotonicHint(std::chrono::microseconds clockLeast) {
-    std::chrono::microseconds currTime = time();
-    if (clockLeast <= currTime)
+    if (clockLeast <= time())
         return;
 
     std::lock_guard lk(lock);
 
-    std::chrono::microseconds diff = clockLeast - time();
-    auto adjustment = std::chrono::duration_cast<std::chrono::steady_clock::duration>(diff).count();
+    long long now = steadyNow();
+    ClockState state = loadState_();
+    long long diff = clockLeast.count() - timeAt_(state, now);
+    if (diff <= 0)
+        return;
 
-    epoch.fetch_sub(adjustment, std::memory_order_relaxed);
+    // Surely behind; Step forward, and drop the correction left as it was wrong
+    rebase_(&state, now);
+    state.epoch -= diff;
+    state.slew = 0;
+    storeState_(state);
 }
 
-bool NetworkClock::generatePing(uint32_t* pingId, std::chrono::milliseconds* sleepAmount) {
-    static constexpr std::chrono::milliseconds TIMING_TABLE[] = {1ms,   10ms,  10ms, 100ms, 300ms,
-                                                                 300ms, 300ms, 5s,   5s,    25s};
-    static constexpr size_t TIMING_LEN = sizeof(TIMING_TABLE) / sizeof(decltype(TIMING_TABLE[0]));
+long long NetworkClock::timeAt_(const ClockState& state, long long steady) {
+    long long elapsed = std::max(0LL, steady - state.slewBegin);
+    long long maxSlew = static_cast<long long>(elapsed * SLEW_RATE);
+    long long drift = static_cast<long long>(elapsed * state.drift);
+    return steady - state.epoch + drift + std::clamp(state.slew, -maxSlew, maxSlew);
+}
+
+void NetworkClock::rebase_(ClockState* state, long long steady) {
+    long long elapsed = std::max(0LL, steady - state->slewBegin);
+    long long curr = timeAt_(*state, steady);
+    state->slew -= curr - (steady - state->epoch) - static_cast<long long>(elapsed * state->drift);
+    state->epoch = steady - curr;
+    state->slewBegin = steady;
+}
+
+NetworkClock::ClockState NetworkClock::loadState_() const {
+    while (true) {
+        uint32_t seq = stateSeq.load(std::memory_order_acquire);
+        if (seq % 2 != 0)
+            continue;
+
+        ClockState ret;
+        ret.epoch = stateEpoch.load(std::memory_order_relaxed);
+        ret.slewBegin = stateSlewBegin.load(std::memory_order_relaxed);
+        ret.slew = stateSlew.load(std::memory_order_relaxed);
+        ret.drift = stateDrift.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (stateSeq.load(std::memory_order_relaxed) == seq)
+            return ret;
+    }
+}
+
+void NetworkClock::storeState_(const ClockState& state) {
+    uint32_t seq = stateSeq.load(std::memory_order_relaxed);
+    stateSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    stateEpoch.store(state.epoch, std::memory_order_relaxed);
+    stateSlewBegin.store(state.slewBegin, std::memory_order_relaxed);
+    stateSlew.store(state.slew, std::memory_order_relaxed);
+    stateDrift.store(state.drift, std::memory_order_relaxed);
+
+    stateSeq.store(seq + 2, std::memory_order_release);
+}
 
+bool NetworkClock::generatePing(uint32_t* pingId, std::chrono::milliseconds* sleepAmount) {
     std::lock_guard lk(lock);
 
-    if (pingTimingIdx < 0)
-        pingTimingIdx = 0;
+    const long long now = steadyNow();
+    const std::chrono::microseconds elapsed(now - lastPing);
 
-    if (networkLatency == 0 && pingReqMap.empty()) {
-        *sleepAmount = std::min(60ms, TIMING_TABLE[pingTimingIdx]);
-        *pingId = sendPing_();
-        return true;
-    }
+    bool due;
+    if (!estimator.converged())
+        due = WARMUP_PING_INTERVAL <= elapsed;
+    else if (MAX_PING_INTERVAL <= elapsed)
+        due = true;
+    else
+        due = (MIN_PING_INTERVAL <= elapsed && TARGET_ERROR < estimator.errorAt(now)) ||
+              (DRIFT_PING_INTERVAL <= elapsed && TARGET_DRIFT_UNCERTAINTY < estimator.getDriftUncertainty());
 
-    if (TIMING_TABLE[pingTimingIdx] <= std::chrono::steady_clock::now() - lastPing) {
-        if (pingTimingIdx < TIMING_LEN - 1)
-            pingTimingIdx++;
-        *sleepAmount = std::min(60ms, TIMING_TABLE[pingTimingIdx]);
+    *sleepAmount = estimator.converged() ? POLL_INTERVAL : WARMUP_PING_INTERVAL;
+    if (due)
         *pingId = sendPing_();
-        return true;
-    }
-
-    *sleepAmount = 15ms;
-    return false;
+    return due;
 }
 
 uint32_t NetworkClock::sendPing_() {
-    std::chrono::steady_clock::time_point currTime = std::chrono::steady_clock::now();
-    lastPing = currTime;
+    const long long now = steadyNow();
+    lastPing = now;
 
     std::vector<uint32_t> toRemove;
     for (auto& itr : pingReqMap) {
-        if (30s < currTime - itr.second)
+        if (30s < std::chrono::microseconds(now - itr.second))
             toRemove.push_back(itr.first);
     }
 
@@ -130,7 +206,6 @@ uint32_t NetworkClock::sendPing_() {
         pingReqMap.erase(key);
 
     uint32_t id = random();
-    auto& ref = pingReqMap[id];
-    ref = std::chrono::steady_clock::now();
+    pingReqMap[id] = now;
     return id;
 }
@@ -1,23 +1,38 @@
 #ifndef TWILIGHT_CLIENT_NETWORKCLOCK_H
 #define TWILIGHT_CLIENT_NETWORKCLOCK_H
 
-#include "common/StatisticMixer.h"
 #include "common/log.h"
 
+#include "client/ClockEstimator.h"
+
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <map>
 #include <mutex>
 #include <random>
 
+// Local estimate of the server clock.
+// Offset and drift are estimated from ping round trips, and pings are sent as often as needed to keep the expected
+// error below a target.
 class NetworkClock {
 public:
+    // Returns a steady local time in microseconds
+    using SteadyClockFn = long long (*)();
+
     NetworkClock();
+    // Reads local time from `steadyNow` instead of std::chrono::steady_clock, so that tests can simulate it
+    explicit NetworkClock(SteadyClockFn steadyNow);
     ~NetworkClock();
 
     std::chrono::microseconds time() const;
+
+    // Round trip time in us (median of recent pings)
     int latency() const;
+    // Mean deviation of round trip time in us
     int jitter() const;
+    // Expected error of time() in us (negative if not estimated yet)
+    int error() const;
 
     void adjust(uint32_t pingId, uint64_t clock);
 
@@ -33,15 +48,41 @@ public:
 private:
     static NamedLogger log;
 
-    std::atomic<std::chrono::steady_clock::time_point::rep> epoch;
+    // time() is steady_clock minus epoch, plus drift and the part of slew applied since slewBegin.
+    // All in microseconds.
+    struct ClockState {
+        long long epoch;
+        long long slewBegin;
+        long long slew;  //< Correction left to apply at slewBegin
+        double drift;    //< Rate of server clock relative to steady_clock minus one
+    };
+
+    static long long timeAt_(const ClockState& state, long long steady);
+    // Folds drift and slew applied until `steady` into epoch, without changing time at that point
+    static void rebase_(ClockState* state, long long steady);
+
+    ClockState loadState_() const;
+    // Must hold lock
+    void storeState_(const ClockState& state);
+
+    // Seqlock, as time() is called from realtime audio callbacks; Readers retry instead of blocking
+    std::atomic<uint32_t> stateSeq;
+    std::atomic<long long> stateEpoch;
+    std::atomic<long long> stateSlewBegin;
+    std::atomic<long long> stateSlew;
+    std::atomic<double> stateDrift;
+
+    std::atomic<int> statLatency;
+    std::atomic<int> statJitter;
+    std::atomic<int> statError;
+
+    SteadyClockFn steadyNow;
 
     std::mutex lock;
-    int networkLatency;
-    int networkJitter;
-    size_t pingTimingIdx;
-    std::chrono::steady_clock::time_point lastPing;
+    ClockEstimator estimator;
+    long long lastPing;
 
-    std::map<uint32_t, std::chrono::steady_clock::time_point> pingReqMap;
+    std::map<uint32_t, long long> pingReqMap;
     std::default_random_engine random;
 
     uint32_t sendPing_();
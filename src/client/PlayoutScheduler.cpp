@@ -0,0 +1,142 @@
+#include "PlayoutScheduler.h"
+
+#include <algorithm>
+
+TWILIGHT_DEFINE_LOGGER(PlayoutScheduler);
+
+using namespace std::chrono_literals;
+
+// Upper bound of adaptive delay in SMOOTH mode
+static constexpr long long MAX_TARGET_DELAY = 250'000;  // 250 ms
+
+PlayoutScheduler::PlayoutScheduler(std::shared_ptr<NetworkClock> clock_)
+    : clock(std::move(clock_)),
+      mode(Mode::LOWEST_LATENCY),
+      targetDelay(0),
+      audioDelay(-1),
+      lastTimeRef(-1),
+      frameInterval(0),
+      queueDepth(0),
+      presentedFrames(0),
+      droppedFrames(0),
+      addedDelayAvg(0),
+      videoDelayAvg(0) {}
+
+PlayoutScheduler::~PlayoutScheduler() {}
+
+void PlayoutScheduler::setMode(Mode newMode) {
+    std::lock_guard lk(lock);
+    mode = newMode;
+}
+
+PlayoutScheduler::Mode PlayoutScheduler::getMode() const {
+    std::lock_guard lk(lock);
+    return mode;
+}
+
+void PlayoutScheduler::setTargetDelay(std::chrono::microseconds delay) {
+    std::lock_guard lk(lock);
+    targetDelay = std::max(0us, delay);
+}
+
+void PlayoutScheduler::setAudioDelay(std::chrono::microseconds delay) {
+    std::lock_guard lk(lock);
+    audioDelay = delay;
+}
+
+PlayoutScheduler::Stat PlayoutScheduler::getStat() const {
+    std::lock_guard lk(lock);
+
+    Stat ret;
+    ret.queueDepth = queueDepth;
+    ret.presentedFrames = presentedFrames;
+    ret.droppedFrames = droppedFrames;
+    ret.addedDelay = std::chrono::microseconds(addedDelayAvg);
+    ret.targetDelay = mode == Mode::SMOOTH ? std::chrono::microseconds(calcTarget_()) : 0us;
+    ret.videoDelay = std::chrono::microseconds(videoDelayAvg);
+    ret.hasAudio = 0 <= audioDelay.count();
+    ret.avOffset = ret.hasAudio ? audioDelay - ret.videoDelay : 0us;
+    return ret;
+}
+
+void PlayoutScheduler::resetStat() {
+    std::lock_guard lk(lock);
+    presentedFrames = 0;
+    droppedFrames = 0;
+    addedDelayAvg = 0;
+}
+
+PlayoutScheduler::Decision PlayoutScheduler::schedule_(std::chrono::microseconds timeRef,
+                                                       std::chrono::microseconds timeDecoded, size_t queued,
+                                                       std::chrono::microseconds* waitAmount) {
+    std::lock_guard lk(lock);
+
+    queueDepth = queued;
+
+    // Can't schedule a frame without timestamp
+    if (timeRef.count() < 0) {
+        presentedFrames++;
+        return Decision::PRESENT;
+    }
+
+    if (0 <= lastTimeRef.count() && lastTimeRef < timeRef) {
+        long long interval = (timeRef - lastTimeRef).count();
+        if (frameInterval == 0)
+            frameInterval = interval;
+        else
+            frameInterval += (interval - frameInterval) / 8;
+    }
+    lastTimeRef = timeRef;
+
+    if (0 <= timeDecoded.count())
+        arrivalDelay.push((timeDecoded - timeRef).count());
+
+    long long delay = (clock->time() - timeRef).count();
+
+    if (mode == Mode::LOWEST_LATENCY) {
+        // A newer frame is already decoded. Fast-forward to it.
+        if (0 < queued) {
+            droppedFrames++;
+            return Decision::DROP;
+        }
+
+        pushAddedDelay_(0);
+        pushVideoDelay_(delay);
+        presentedFrames++;
+        return Decision::PRESENT;
+    }
+
+    long long target = calcTarget_();
+
+    if (delay < target) {
+        *waitAmount = std::chrono::microseconds(target - delay);
+        pushAddedDelay_(target - delay);
+        pushVideoDelay_(target);
+        presentedFrames++;
+        return Decision::WAIT;
+    }
+
+    // Fell behind by more than a frame. Skip this one if a newer frame can take its place.
+    if (0 < queued && target + frameInterval < delay) {
+        droppedFrames++;
+        return Decision::DROP;
+    }
+
+    pushAddedDelay_(0);
+    pushVideoDelay_(delay);
+    presentedFrames++;
+    return Decision::PRESENT;
+}
+
+void PlayoutScheduler::pushAddedDelay_(long long delay) {
+    addedDelayAvg += (delay - addedDelayAvg) / 16;
+}
+
+void PlayoutScheduler::pushVideoDelay_(long long delay) {
+    videoDelayAvg += (delay - videoDelayAvg) / 16;
+}
+
+long long PlayoutScheduler::calcTarget_() const {
+    long long target = std::max<long long>({targetDelay.count(), arrivalDelay.max, audioDelay.count()});
+    return std::min(MAX_TARGET_DELAY, target);
+}
@@ -0,0 +1,89 @@
+#ifndef TWILIGHT_CLIENT_PLAYOUTSCHEDULER_H
+#define TWILIGHT_CLIENT_PLAYOUTSCHEDULER_H
+
+#include "common/DesktopFrame.h"
+#include "common/log.h"
+#include "common/util.h"
+
+#include "client/NetworkClock.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Decides when a decoded frame should be presented
+class PlayoutScheduler {
+public:
+    enum class Mode {
+        LOWEST_LATENCY,  //< Present immediately, skip to the newest decoded frame
+        SMOOTH           //< Hold frames to keep a constant delay from capture
+    };
+
+    enum class Decision { PRESENT, WAIT, DROP };
+
+    struct Stat {
+        size_t queueDepth;                      //< Decoded frames waiting behind the last scheduled one
+        uint64_t presentedFrames;               //< Total frames presented
+        uint64_t droppedFrames;                 //< Total frames dropped by the scheduler
+        std::chrono::microseconds addedDelay;   //< Average delay added by holding frames
+        std::chrono::microseconds targetDelay;  //< Capture-to-present delay currently aimed for
+        std::chrono::microseconds videoDelay;   //< Average capture-to-present delay of presented frames
+        std::chrono::microseconds avOffset;     //< Audio delay minus video delay (positive if audio is late)
+        bool hasAudio;                          //< Whether avOffset is valid
+    };
+
+    explicit PlayoutScheduler(std::shared_ptr<NetworkClock> clock);
+    PlayoutScheduler(const PlayoutScheduler& copy) = delete;
+    PlayoutScheduler(PlayoutScheduler&& move) = delete;
+    ~PlayoutScheduler();
+
+    void setMode(Mode newMode);
+    Mode getMode() const;
+
+    // Minimum capture-to-present delay in SMOOTH mode. Grows as needed to absorb jitter.
+    void setTargetDelay(std::chrono::microseconds delay);
+
+    // Capture-to-speaker delay of audio being played, or negative if there is no audio.
+    // Audio is the master clock; SMOOTH mode holds frames at least this long so that both stay in sync.
+    void setAudioDelay(std::chrono::microseconds delay);
+
+    // [in] queued: Number of decoded frames available after this one
+    // [out] waitAmount: How long to wait before presenting (only valid when WAIT is returned)
+    template <typename T>
+    Decision schedule(const DesktopFrame<T>& frame, size_t queued, std::chrono::microseconds* waitAmount) {
+        std::chrono::microseconds timeRef = 0 < frame.timeCaptured.count() ? frame.timeCaptured : frame.timeEncoded;
+        return schedule_(timeRef, frame.timeDecoded, queued, waitAmount);
+    }
+
+    Stat getStat() const;
+    void resetStat();
+
+private:
+    Decision schedule_(std::chrono::microseconds timeRef, std::chrono::microseconds timeDecoded, size_t queued,
+                       std::chrono::microseconds* waitAmount);
+    void pushAddedDelay_(long long delay);
+    void pushVideoDelay_(long long delay);
+    long long calcTarget_() const;
+
+    static NamedLogger log;
+
+    std::shared_ptr<NetworkClock> clock;
+
+    mutable std::mutex lock;
+    Mode mode;
+    std::chrono::microseconds targetDelay;
+    std::chrono::microseconds audioDelay;
+    std::chrono::microseconds lastTimeRef;
+    long long frameInterval;
+
+    MinMaxTrackingRingBuffer<long long, 120> arrivalDelay;
+
+    size_t queueDepth;
+    uint64_t presentedFrames;
+    uint64_t droppedFrames;
+    long long addedDelayAvg;
+    long long videoDelayAvg;
+};
+
+#endif
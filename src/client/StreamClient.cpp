@@ -3,6 +3,8 @@
 #include "common/util.h"
 #include "common/version.h"
 
+#include "common/net/PacketArena.h"
+
 #include <auth.pb.h>
 #include <packet.pb.h>
 
@@ -11,10 +13,18 @@
 TWILIGHT_DEFINE_LOGGER(StreamClient);
 
 constexpr uint16_t SERVICE_PORT = 6495;
-constexpr int32_t PROTOCOL_VERSION = 2;
 
 StreamClient::StreamClient(std::shared_ptr<NetworkClock> clock_)
-    : clock(std::move(clock_)), captureWidth(-1), captureHeight(-1), videoWidth(-1), videoHeight(-1) {
+    : clock(std::move(clock_)),
+      captureWidth(-1),
+      captureHeight(-1),
+      videoWidth(-1),
+      videoHeight(-1),
+      fpsNum(-1),
+      fpsDen(-1),
+      noPeriodicKeyframes(false),
+      requestedChroma444(false),
+      chroma444(false) {
     conn.setOnDisconnected([this](std::string_view msg) { onStateChange(State::DISCONNECTED, msg); });
 
     std::unique_ptr<Keypair> keypair = std::make_unique<Keypair>();
@@ -65,6 +75,7 @@ void StreamClient::disconnect() {
 
     captureWidth = captureHeight = -1;
     videoWidth = videoHeight = -1;
+    fpsNum = fpsDen = -1;
 }
 
 void StreamClient::getCaptureResolution(int *width, int *height) {
@@ -79,6 +90,12 @@ void StreamClient::getVideoResolution(int* width, int* height) {
     *height = videoHeight;
 }
 
+void StreamClient::getFramerate(int *num, int *den) {
+    log.assert_quit(0 < fpsNum && 0 < fpsDen, "Framerate not set!");
+    *num = fpsNum;
+    *den = fpsDen;
+}
+
 bool StreamClient::send(const msg::Packet &pkt, const ByteBuffer &extraData) {
     assert(pkt.extra_data_len() == extraData.size());
 
@@ -89,12 +106,20 @@ bool StreamClient::send(const msg::Packet &pkt, const uint8_t *extraData) {
     return conn.send(pkt, extraData);
 }
 
+bool StreamClient::requestKeyframe() {
+    msg::Packet pkt;
+    pkt.set_extra_data_len(0);
+    pkt.mutable_keyframe_request();
+    return send(pkt, nullptr);
+}
+
 void StreamClient::runRecv_() {
     bool stat;
-    msg::Packet pkt;
+    PacketArena arena;
     ByteBuffer extraData;
 
     while (true) {
+        msg::Packet &pkt = arena.next();
         stat = conn.recv(&pkt, &extraData);
         if (!stat)
             break;
@@ -226,6 +251,9 @@ bool StreamClient::doIntro_(const HostListEntry &host, bool forceAuth) {
         req->set_height(nativeHeight);
         req->set_fps_num(nativeFpsNum);
         req->set_fps_den(nativeFpsDen);
+        *req->mutable_audio() = requestedAudio;
+        req->set_no_periodic_keyframes(noPeriodicKeyframes);
+        req->set_chroma444(requestedChroma444);
 
         if (!conn.send(pkt, nullptr))
             return false;
@@ -253,6 +281,10 @@ bool StreamClient::doIntro_(const HostListEntry &host, bool forceAuth) {
     captureHeight = configureStreamResponse.capture_height();
     videoWidth = configureStreamResponse.video_width();
     videoHeight = configureStreamResponse.video_height();
+    fpsNum = nativeFpsNum;
+    fpsDen = nativeFpsDen;
+    audioConfig = configureStreamResponse.audio();
+    chroma444 = configureStreamResponse.chroma444();
 
     pkt.mutable_start_stream_request();
     if (!conn.send(pkt, nullptr))
@@ -42,6 +42,22 @@ public:
 
     void getCaptureResolution(int *width, int *height);
     void getVideoResolution(int *width, int *height);
+    void getFramerate(int *num, int *den);
+
+    // Must be called before connect(). Server reports what it actually uses in getAudioConfig().
+    void setAudioConfig(const msg::AudioConfig &config) { requestedAudio = config; }
+    const msg::AudioConfig &getAudioConfig() const { return audioConfig; }
+
+    // Must be called before connect(). Keyframes are then only sent by requestKeyframe().
+    void setNoPeriodicKeyframes(bool enabled) { noPeriodicKeyframes = enabled; }
+
+    // Must be called before connect(). Server reports whether it actually uses it in getChroma444().
+    // Video is then VP9 instead of VP8, in 4:4:4 or 4:2:0.
+    void setChroma444(bool enabled) { requestedChroma444 = enabled; }
+    bool getChroma444() const { return chroma444; }
+
+    // Asks server for an IDR frame, after losing a frame the rest depend on
+    bool requestKeyframe();
 
     bool send(const msg::Packet &pkt, const ByteBuffer &extraData);
     bool send(const msg::Packet &pkt, const uint8_t *extraData);
@@ -57,6 +73,12 @@ private:
     std::shared_ptr<NetworkClock> clock;
     int captureWidth, captureHeight;
     int videoWidth, videoHeight;
+    int fpsNum, fpsDen;
+    msg::AudioConfig requestedAudio;
+    msg::AudioConfig audioConfig;
+    bool noPeriodicKeyframes;
+    bool requestedChroma444;
+    bool chroma444;
 
     NetworkSocket conn;
     CertStore cert;
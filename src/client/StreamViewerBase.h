@@ -1,9 +1,13 @@
 #ifndef TWILIGHT_CLIENT_STREAMVIEWERBASE_H
 #define TWILIGHT_CLIENT_STREAMVIEWERBASE_H
 
+#include "client/PlayoutScheduler.h"
+
 #include <QtWidgets/qwidget.h>
 #include <packet.pb.h>
 
+#include <chrono>
+
 class StreamViewerBase : public QWidget {
     Q_OBJECT;
 
@@ -12,9 +16,12 @@ public:
     ~StreamViewerBase() override {}
 
     virtual void setDrawCursor(bool newval) = 0;
+    virtual void setPlayoutMode(PlayoutScheduler::Mode mode, std::chrono::microseconds targetDelay) = 0;
+    virtual void setAudioDelay(std::chrono::microseconds delay) = 0;
 
     virtual void processDesktopFrame(const msg::Packet &pkt, uint8_t *extraData) = 0;
     virtual void processCursorShape(const msg::Packet &pkt, uint8_t *extraData) = 0;
+    virtual void processCursorPosition(const msg::Packet &pkt) = 0;
 };
 
 #endif
\ No newline at end of file
@@ -1,11 +1,9 @@
 #include "StreamWindow.h"
 
-#include "common/RingBuffer.h"
-
+#include "client/AudioJitterBuffer.h"
 #include "client/platform/windows/StreamViewerD3D.h"
 
 #include <cubeb/cubeb.h>
-#include <opus.h>
 
 #include <QtGui/qevent.h>
 #include <QtWidgets/qmessagebox.h>
@@ -34,6 +32,14 @@ StreamWindow::StreamWindow(HostListEntry host, bool playAudio)
         while (!flagPinBoxClosed.load(std::memory_order_relaxed))
             pinBoxClosedCV.wait(lock);
     });
+
+    // Interactive use; smallest CELT frame that still keeps packet rate sane
+    msg::AudioConfig audioConfig;
+    audioConfig.set_application(msg::AudioConfig_Application_RESTRICTED_LOWDELAY);
+    audioConfig.set_frame_duration(10'000);
+    audioConfig.set_dtx(true);
+    sc.setAudioConfig(audioConfig);
+
     sc.connect(host);
 
     boxLayout.addWidget(viewer);
@@ -94,6 +100,9 @@ void StreamWindow::processNewPacket_(const msg::Packet &pkt, uint8_t *extraData)
     case msg::Packet::kCursorShape:
         viewer->processCursorShape(pkt, extraData);
         break;
+    case msg::Packet::kCursorPosition:
+        viewer->processCursorPosition(pkt);
+        break;
     case msg::Packet::kPingResponse: {
         auto &res = pkt.ping_response();
         clock->adjust(res.id(), res.time());
@@ -102,11 +111,13 @@ void StreamWindow::processNewPacket_(const msg::Packet &pkt, uint8_t *extraData)
     case msg::Packet::kAudioFrame: {
         if (!flagPlayAudio.load(std::memory_order_relaxed))
             break;
-        ByteBuffer buf(pkt.extra_data_len());
-        buf.write(0, extraData, pkt.extra_data_len());
+        AudioPacket now;
+        now.sequence = pkt.audio_frame().sequence();
+        now.timeCaptured = std::chrono::microseconds(pkt.audio_frame().time_captured());
+        now.data.write(0, extraData, pkt.extra_data_len());
 
         std::lock_guard lock(audioDataLock);
-        audioData.push_back(std::move(buf));
+        audioData.push_back(std::move(now));
         audioDataCV.notify_one();
         break;
     }
@@ -115,40 +126,13 @@ void StreamWindow::processNewPacket_(const msg::Packet &pkt, uint8_t *extraData)
     }
 }
 
-struct CubebUserData {
-    static NamedLogger log;
-
-    std::mutex dataLock;
-    RingBuffer<float, 5760 * 4> data;
-    std::atomic<bool> flagBufferUnderrun;
-};
-
-TWILIGHT_DEFINE_LOGGER(CubebUserData);
-
 static long data_cb(cubeb_stream *stm, void *user, const void *input_buffer, void *output_buffer, long nframes) {
-    CubebUserData *self = reinterpret_cast<CubebUserData *>(user);
-
-    float *p = reinterpret_cast<float *>(output_buffer);
-
-    int requestedLength = nframes * 2;
-    int readAmount;
-    /* lock */ {
-        std::lock_guard lock(self->dataLock);
-        readAmount = std::min<int>(requestedLength, self->data.size());
-        self->data.read(reinterpret_cast<float *>(output_buffer), readAmount);
-    }
-
-    if (readAmount < requestedLength) {
-        memset(p + readAmount, 0, (requestedLength - readAmount) * sizeof(float));
-        self->flagBufferUnderrun.store(true, std::memory_order_relaxed);
-    }
-
+    AudioJitterBuffer *self = reinterpret_cast<AudioJitterBuffer *>(user);
+    self->read(reinterpret_cast<float *>(output_buffer), nframes);
     return nframes;
 }
 
-static void state_cb(cubeb_stream *stm, void *user, cubeb_state state) {
-    CubebUserData *self = reinterpret_cast<CubebUserData *>(user);
-}
+static void state_cb(cubeb_stream *stm, void *user, cubeb_state state) {}
 
 void StreamWindow::runAudio_() {
     HRESULT hr;
@@ -157,12 +141,7 @@ void StreamWindow::runAudio_() {
     hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
     log.assert_quit(SUCCEEDED(hr), "Failed to initialize COM in multithreaded mode");
 
-    OpusDecoder *opusDecoder = opus_decoder_create(48000, 2, &stat);
-    log.assert_quit(stat == OPUS_OK, "Failed to create opus decoder");
-
-    std::vector<float> pcm(5760 * 2);
-
-    std::unique_ptr<CubebUserData> self = std::make_unique<CubebUserData>();
+    std::unique_ptr<AudioJitterBuffer> self = std::make_unique<AudioJitterBuffer>(clock);
 
     cubeb *cubebCtx = nullptr;
     stat = cubeb_init(&cubebCtx, "Twilight Remote Desktop Client", nullptr);
@@ -170,8 +149,8 @@ void StreamWindow::runAudio_() {
 
     cubeb_stream_params outParam = {};
     outParam.format = CUBEB_SAMPLE_FLOAT32NE;
-    outParam.rate = 48000;
-    outParam.channels = 2;
+    outParam.rate = AudioJitterBuffer::SAMPLE_RATE;
+    outParam.channels = AudioJitterBuffer::CHANNELS;
     outParam.layout = CUBEB_LAYOUT_STEREO;
     outParam.prefs = CUBEB_STREAM_PREF_NONE;
 
@@ -179,6 +158,9 @@ void StreamWindow::runAudio_() {
     stat = cubeb_get_min_latency(cubebCtx, &outParam, &latencyFrames);
     log.assert_quit(stat == CUBEB_OK, "Failed to get minimum latency of cubeb");
 
+    // Absorb network jitter on top of what the device itself needs
+    self->setTargetLatency(std::chrono::milliseconds(30 + latencyFrames * 2000 / AudioJitterBuffer::SAMPLE_RATE));
+
     cubeb_stream *stm;
     stat = cubeb_stream_init(cubebCtx, &stm, "Remote desktop speaker", nullptr, nullptr, nullptr, &outParam,
                              latencyFrames, data_cb, state_cb, reinterpret_cast<void *>(self.get()));
@@ -187,8 +169,14 @@ void StreamWindow::runAudio_() {
     stat = cubeb_stream_start(stm);
     log.assert_quit(stat == CUBEB_OK, "Failed to start cubeb stream");
 
+    // Not every backend knows; then assume it plays right away
+    uint32_t outputLatency;
+    if (cubeb_stream_get_latency(stm, &outputLatency) == CUBEB_OK)
+        self->setOutputLatency(std::chrono::microseconds(outputLatency * 1'000'000LL / AudioJitterBuffer::SAMPLE_RATE));
+
+    auto lastStatReport = std::chrono::steady_clock::now();
     while (flagPlayAudio.load(std::memory_order_relaxed)) {
-        ByteBuffer nowData;
+        AudioPacket nowData;
 
         /* lock */ {
             std::unique_lock lock(audioDataLock);
@@ -203,14 +191,18 @@ void StreamWindow::runAudio_() {
             audioData.pop_front();
         }
 
-        stat = opus_decode_float(opusDecoder, nowData.data(), nowData.size(), pcm.data(), 5760, 0);
-        log.assert_quit(0 <= stat, "Failed to decode opus stream");
-        int decodedFrames = stat;
-
-        std::lock_guard lock(self->dataLock);
-        if (self->data.available() < decodedFrames * 2)
-            self->data.drop(decodedFrames * 2 - self->data.available());
-        self->data.write(pcm.data(), decodedFrames * 2);
+        self->pushPacket(nowData.sequence, nowData.timeCaptured, nowData.data.data(), nowData.data.size());
+        viewer->setAudioDelay(self->latency());
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastStatReport >= std::chrono::seconds(5)) {
+            lastStatReport = now;
+            auto audioStat = self->getStat();
+            log.info("Audio: buffer {:.1f}/{:.1f} ms  speed {:.4f}  underrun {}  overrun {}  concealed {}",
+                     audioStat.depth, audioStat.targetDepth, audioStat.speed, audioStat.underruns,
+                     audioStat.overruns, audioStat.concealed);
+            log.info("Audio: latency {:.1f} ms", audioStat.latency);
+        }
     }
 
     stat = cubeb_stream_stop(stm);
@@ -220,13 +212,11 @@ void StreamWindow::runAudio_() {
     cubeb_destroy(cubebCtx);
     cubebCtx = nullptr;
 
-    if (opusDecoder != nullptr) {
-        opus_decoder_destroy(opusDecoder);
-        opusDecoder = nullptr;
-    }
-
     CoUninitialize();
 
+    // Don't hold video back for audio that isn't playing anymore
+    viewer->setAudioDelay(std::chrono::microseconds(-1));
+
     /* lock */ {
         std::lock_guard lock(audioDataLock);
         audioData.clear();
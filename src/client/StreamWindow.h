@@ -15,6 +15,7 @@
 #include <QtWidgets/qboxlayout.h>
 #include <QtWidgets/qwidget.h>
 
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <memory>
@@ -39,6 +40,12 @@ private slots:
     void displayPin_(int pin);
 
 private:
+    struct AudioPacket {
+        uint32_t sequence;
+        std::chrono::microseconds timeCaptured;
+        ByteBuffer data;
+    };
+
     static NamedLogger log;
 
     std::shared_ptr<NetworkClock> clock;
@@ -56,7 +63,7 @@ private:
     std::thread audioThread;
     std::mutex audioDataLock;
     std::condition_variable audioDataCV;
-    std::deque<ByteBuffer> audioData;
+    std::deque<AudioPacket> audioData;
 
     void processStateChange_(StreamClient::State newState, std::string_view msg);
     void processNewPacket_(const msg::Packet &pkt, uint8_t *extraData);
@@ -0,0 +1,291 @@
+#include "HeadlessViewer.h"
+
+#include "client/platform/software/DecoderFFmpeg.h"
+
+#include <vector>
+
+TWILIGHT_DEFINE_LOGGER(HeadlessViewer);
+
+HeadlessViewer::HeadlessViewer(int id, OutputMode outputMode, std::string outputPath, bool decodeAudio)
+    : id(id),
+      outputMode(outputMode),
+      outputPath(std::move(outputPath)),
+      outputFile(nullptr),
+      clock(std::make_shared<NetworkClock>()),
+      sc(clock),
+      decoder(std::make_unique<DecoderFFmpeg>()),
+      keyframeGate([this]() { sc.requestKeyframe(); }),
+      dropRate(0),
+      dropRandom(id),
+      flagConnected(false),
+      flagDisconnected(false),
+      flagDecoderStarted(false),
+      flagRunAudio(false),
+      decodeAudio(decodeAudio),
+      audioJitter(clock),
+      videoFrames(0),
+      audioFrames(0),
+      totalTime(300),
+      encodingTime(300),
+      networkTime(300),
+      decodingTime(300),
+      tracer("client", 2 + id) {
+    // Every viewer would write to the same path
+    if (id == 0)
+        tracer.startTrace();
+
+    if (outputMode == OutputMode::RAW_YUV || outputMode == OutputMode::Y4M) {
+        outputFile = fopen(this->outputPath.c_str(), "wb");
+        log.assert_quit(outputFile != nullptr, "Failed to open {} for writing", this->outputPath);
+    }
+
+    sc.setOnNextPacket([this](const msg::Packet &pkt, uint8_t *extraData) { processNewPacket_(pkt, extraData); });
+    sc.setOnStateChange(
+        [this](StreamClient::State newState, std::string_view msg) { processStateChange_(newState, msg); });
+    sc.setOnDisplayPin([this](int pin) {
+        fmt::print("[{}] Enter following pin in the server: {:04} {:04}\n", this->id, pin / 10000, pin % 10000);
+        fflush(stdout);
+    });
+}
+
+HeadlessViewer::~HeadlessViewer() {
+    if (outputFile != nullptr)
+        fclose(outputFile);
+}
+
+void HeadlessViewer::connect(HostListEntry host) {
+    if (decodeAudio) {
+        flagRunAudio.store(true, std::memory_order_relaxed);
+        audioThread = std::thread(&HeadlessViewer::runAudio_, this);
+    }
+
+    sc.connect(std::move(host));
+}
+
+void HeadlessViewer::disconnect() {
+    sc.disconnect();
+
+    if (flagDecoderStarted.exchange(false)) {
+        decoder->stop();
+        videoThread.join();
+    }
+
+    if (flagRunAudio.exchange(false)) {
+        audioDataCV.notify_all();
+        audioThread.join();
+    }
+
+    if (outputFile != nullptr)
+        fflush(outputFile);
+}
+
+HeadlessViewer::Stat HeadlessViewer::calcStat() {
+    std::lock_guard lock(statLock);
+
+    Stat ret;
+    ret.videoFrames = videoFrames;
+    ret.audioFrames = audioFrames.load(std::memory_order_relaxed);
+    ret.total = totalTime.calcStat();
+    ret.encoding = encodingTime.calcStat();
+    ret.network = networkTime.calcStat();
+    ret.decoding = decodingTime.calcStat();
+    ret.audio = audioJitter.getStat();
+    ret.keyframe = keyframeGate.getStat();
+    ret.rtt = clock->latency() / 1000.0f;
+    ret.clockError = clock->error() < 0 ? -1.0f : clock->error() / 1000.0f;
+    return ret;
+}
+
+void HeadlessViewer::processStateChange_(StreamClient::State newState, std::string_view msg) {
+    switch (newState) {
+    case StreamClient::State::CONNECTED:
+        log.info("[{}] Connected", id);
+        flagConnected.store(true, std::memory_order_relaxed);
+        break;
+    case StreamClient::State::DISCONNECTED:
+        log.info("[{}] Disconnected; {}", id, msg);
+        flagConnected.store(false, std::memory_order_relaxed);
+        flagDisconnected.store(true, std::memory_order_relaxed);
+        break;
+    default:
+        break;
+    }
+}
+
+void HeadlessViewer::processNewPacket_(const msg::Packet &pkt, uint8_t *extraData) {
+    switch (pkt.msg_case()) {
+    case msg::Packet::kDesktopFrame:
+        processDesktopFrame_(pkt, extraData);
+        break;
+    case msg::Packet::kCursorShape:
+    case msg::Packet::kCursorPosition:
+        // Cursor is drawn by the display, which we don't have
+        break;
+    case msg::Packet::kPingResponse: {
+        auto &res = pkt.ping_response();
+        clock->adjust(res.id(), res.time());
+        break;
+    }
+    case msg::Packet::kAudioFrame: {
+        if (!flagRunAudio.load(std::memory_order_relaxed))
+            break;
+        AudioPacket now;
+        now.sequence = pkt.audio_frame().sequence();
+        now.timeCaptured = std::chrono::microseconds(pkt.audio_frame().time_captured());
+        now.data.write(0, extraData, pkt.extra_data_len());
+
+        std::lock_guard lock(audioDataLock);
+        audioData.push_back(std::move(now));
+        audioDataCV.notify_one();
+        break;
+    }
+    default:
+        log.warn("Unknown packet type: {}", pkt.msg_case());
+    }
+}
+
+void HeadlessViewer::processDesktopFrame_(const msg::Packet &pkt, uint8_t *extraData) {
+    if (!flagDecoderStarted.load(std::memory_order_relaxed))
+        startDecoder_();
+
+    auto &res = pkt.desktop_frame();
+    clock->monotonicHint(res.time_encoded());
+
+    if (0 < dropRate && std::uniform_real_distribution<float>()(dropRandom) < dropRate) {
+        keyframeGate.markLost();
+        return;
+    }
+    if (!keyframeGate.admit(res.is_idr()))
+        return;
+
+    DesktopFrame<ByteBuffer> now;
+    now.desktop.write(0, extraData, pkt.extra_data_len());
+
+    now.frameId = res.frame_id();
+    now.timeCaptured = std::chrono::microseconds(res.time_captured());
+    now.timeEncoded = std::chrono::microseconds(res.time_encoded());
+    now.timeReceived = clock->time();
+    if (res.time_scaled() != 0)
+        now.timeScaled = std::chrono::microseconds(res.time_scaled());
+    if (res.time_send_queued() != 0)
+        now.timeSendQueued = std::chrono::microseconds(res.time_send_queued());
+    now.isIDR = res.is_idr();
+
+    decoder->pushData(std::move(now));
+}
+
+void HeadlessViewer::startDecoder_() {
+    int videoWidth, videoHeight;
+    sc.getVideoResolution(&videoWidth, &videoHeight);
+
+    // Server may have turned down 4:4:4
+    decoder->init(sc.getChroma444() ? CodecType::VP9 : CodecType::VP8, clock);
+    decoder->setVideoResolution(videoWidth, videoHeight);
+    decoder->start();
+
+    flagDecoderStarted.store(true, std::memory_order_relaxed);
+    videoThread = std::thread(&HeadlessViewer::runVideo_, this);
+}
+
+void HeadlessViewer::runVideo_() {
+    while (true) {
+        DesktopFrame<TextureSoftware> frame;
+        if (!decoder->readSoftware(&frame))
+            break;
+
+        writeFrame_(frame);
+        tracer.addFrame(frame);
+
+        std::lock_guard lock(statLock);
+        videoFrames++;
+        if (frame.timeCaptured.count() > 0) {
+            encodingTime.pushValue((frame.timeEncoded - frame.timeCaptured).count() / 1000.0f);
+            totalTime.pushValue((frame.timeDecoded - frame.timeCaptured).count() / 1000.0f);
+        }
+        networkTime.pushValue((frame.timeReceived - frame.timeEncoded).count() / 1000.0f);
+        decodingTime.pushValue((frame.timeDecoded - frame.timeReceived).count() / 1000.0f);
+    }
+}
+
+void HeadlessViewer::runAudio_() {
+    using namespace std::chrono_literals;
+
+    // Nothing is played, but read at the pace of a real device so that buffer statistics are meaningful
+    constexpr int PERIOD_FRAMES = AudioJitterBuffer::SAMPLE_RATE / 100;
+    std::vector<float> pcm(PERIOD_FRAMES * AudioJitterBuffer::CHANNELS);
+    auto nextPeriod = std::chrono::steady_clock::now();
+
+    while (flagRunAudio.load(std::memory_order_relaxed)) {
+        std::deque<AudioPacket> packets;
+
+        /* lock */ {
+            std::unique_lock lock(audioDataLock);
+            audioDataCV.wait_until(lock, nextPeriod, [this]() {
+                return !audioData.empty() || !flagRunAudio.load(std::memory_order_relaxed);
+            });
+            packets.swap(audioData);
+        }
+
+        for (AudioPacket &now : packets) {
+            audioJitter.pushPacket(now.sequence, now.timeCaptured, now.data.data(), now.data.size());
+            audioFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        while (nextPeriod <= now) {
+            audioJitter.read(pcm.data(), PERIOD_FRAMES);
+            nextPeriod += 10ms;
+        }
+    }
+}
+
+void HeadlessViewer::writeFrame_(const DesktopFrame<TextureSoftware> &frame) {
+    if (outputMode == OutputMode::DISCARD)
+        return;
+
+    const TextureSoftware &tex = frame.desktop;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(tex.format);
+    log.assert_quit(desc != nullptr, "Unknown pixel format {}", tex.format);
+
+    if (outputMode == OutputMode::Y4M) {
+        if (videoFrames == 0) {
+            const char *chroma;
+            switch (tex.format) {
+            case AV_PIX_FMT_YUV420P:
+                chroma = "420jpeg";
+                break;
+            case AV_PIX_FMT_YUV444P:
+                chroma = "444";
+                break;
+            default:
+                log.error_quit("Pixel format {} can't be written as Y4M", desc->name);
+            }
+
+            int fpsNum, fpsDen;
+            sc.getFramerate(&fpsNum, &fpsDen);
+            fmt::print(outputFile, "YUV4MPEG2 W{} H{} F{}:{} Ip A1:1 C{}\n", tex.width, tex.height, fpsNum, fpsDen,
+                       chroma);
+        }
+        fputs("FRAME\n", outputFile);
+    }
+
+    uint32_t checksum = 1;
+    int planes = av_pix_fmt_count_planes(tex.format);
+    for (int i = 0; i < planes; i++) {
+        bool isChroma = i == 1 || i == 2;
+        int rowBytes = av_image_get_linesize(tex.format, tex.width, i);
+        int rows = isChroma ? AV_CEIL_RSHIFT(tex.height, desc->log2_chroma_h) : tex.height;
+
+        const uint8_t *row = tex.data[i];
+        for (int y = 0; y < rows; y++) {
+            if (outputMode == OutputMode::CHECKSUM)
+                checksum = av_adler32_update(checksum, row, rowBytes);
+            else
+                fwrite(row, 1, rowBytes, outputFile);
+            row += tex.linesize[i];
+        }
+    }
+
+    if (outputMode == OutputMode::CHECKSUM)
+        fmt::print("[{}] frame {} adler32 {:08x}\n", id, videoFrames, checksum);
+}
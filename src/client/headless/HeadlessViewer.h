@@ -0,0 +1,137 @@
+#ifndef TWILIGHT_CLIENT_HEADLESS_HEADLESSVIEWER_H
+#define TWILIGHT_CLIENT_HEADLESS_HEADLESSVIEWER_H
+
+#include "common/ByteBuffer.h"
+#include "common/LatencyTracer.h"
+#include "common/StatisticMixer.h"
+#include "common/log.h"
+
+#include "client/AudioJitterBuffer.h"
+#include "client/HostList.h"
+#include "client/KeyframeGate.h"
+#include "client/NetworkClock.h"
+#include "client/StreamClient.h"
+
+#include "client/platform/software/IDecoderSoftware.h"
+
+#include <packet.pb.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+// Stream viewer without any display. Used to benchmark and load-test a server.
+class HeadlessViewer {
+public:
+    enum class OutputMode {
+        DISCARD,   //< Decode and drop frames
+        CHECKSUM,  //< Print a checksum for each frame
+        RAW_YUV,   //< Write planes back to back
+        Y4M        //< Write YUV4MPEG2 stream
+    };
+
+    struct Stat {
+        uint64_t videoFrames;
+        uint64_t audioFrames;
+        StatisticMixer::Stat total;     //< Capture to decoded (glass-to-glass minus display)
+        StatisticMixer::Stat encoding;  //< Capture to encoded
+        StatisticMixer::Stat network;   //< Encoded to received
+        StatisticMixer::Stat decoding;  //< Received to decoded
+        AudioJitterBuffer::Stat audio;
+        KeyframeGate::Stat keyframe;
+        float rtt;         //< Ping round trip in ms
+        float clockError;  //< Expected error of server clock estimate in ms (negative if unknown)
+    };
+
+    HeadlessViewer(int id, OutputMode outputMode, std::string outputPath, bool decodeAudio);
+    HeadlessViewer(const HeadlessViewer& copy) = delete;
+    HeadlessViewer(HeadlessViewer&& move) = delete;
+    ~HeadlessViewer();
+
+    // Must be called before connect()
+    void setAudioConfig(const msg::AudioConfig& config) { sc.setAudioConfig(config); }
+    const msg::AudioConfig& getAudioConfig() const { return sc.getAudioConfig(); }
+
+    // Must be called before connect()
+    void setNoPeriodicKeyframes(bool enabled) { sc.setNoPeriodicKeyframes(enabled); }
+
+    // Must be called before connect()
+    void setChroma444(bool enabled) { sc.setChroma444(enabled); }
+
+    // Must be called before connect(). Drops given percent of video frames on arrival, to measure recovery.
+    void setDropRate(float percent) { dropRate = percent / 100; }
+
+    void connect(HostListEntry host);
+    void disconnect();
+
+    bool isConnected() const { return flagConnected.load(std::memory_order_relaxed); }
+    bool isDisconnected() const { return flagDisconnected.load(std::memory_order_relaxed); }
+
+    Stat calcStat();
+    const LatencyTracer& getTracer() const { return tracer; }
+
+private:
+    struct AudioPacket {
+        uint32_t sequence;
+        std::chrono::microseconds timeCaptured;
+        ByteBuffer data;
+    };
+
+    void processStateChange_(StreamClient::State newState, std::string_view msg);
+    void processNewPacket_(const msg::Packet& pkt, uint8_t* extraData);
+    void processDesktopFrame_(const msg::Packet& pkt, uint8_t* extraData);
+
+    void startDecoder_();
+    void runVideo_();
+    void runAudio_();
+
+    void writeFrame_(const DesktopFrame<TextureSoftware>& frame);
+
+    static NamedLogger log;
+
+    int id;
+    OutputMode outputMode;
+    std::string outputPath;
+    FILE* outputFile;
+
+    std::shared_ptr<NetworkClock> clock;
+    StreamClient sc;
+    std::unique_ptr<IDecoderSoftware> decoder;
+    KeyframeGate keyframeGate;
+
+    float dropRate;
+    std::minstd_rand dropRandom;  // Only used by the network thread
+
+    std::atomic<bool> flagConnected;
+    std::atomic<bool> flagDisconnected;
+    std::atomic<bool> flagDecoderStarted;
+    std::atomic<bool> flagRunAudio;
+    bool decodeAudio;
+
+    std::thread videoThread;
+    std::thread audioThread;
+
+    std::mutex audioDataLock;
+    std::condition_variable audioDataCV;
+    std::deque<AudioPacket> audioData;
+    AudioJitterBuffer audioJitter;
+
+    LatencyTracer tracer;
+
+    std::mutex statLock;
+    uint64_t videoFrames;
+    std::atomic<uint64_t> audioFrames;
+    StatisticMixer totalTime;
+    StatisticMixer encodingTime;
+    StatisticMixer networkTime;
+    StatisticMixer decodingTime;
+};
+
+#endif
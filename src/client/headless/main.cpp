@@ -0,0 +1,245 @@
+#include "common/log.h"
+
+#include "client/HostList.h"
+
+#include "client/headless/HeadlessViewer.h"
+
+#include <packet.pb.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+static std::atomic<bool> flagInterrupted(false);
+
+static void handleInterrupt(int) {
+    flagInterrupted.store(true, std::memory_order_relaxed);
+}
+
+static void printUsage(const char *argv0) {
+    fmt::print("Usage: {} <host> [options]\n", argv0);
+    fmt::print("  -o, --output <mode>   discard, checksum, yuv or y4m (default: discard)\n");
+    fmt::print("  -f, --file <path>     Output file for yuv and y4m (suffixed by viewer index if -n > 1)\n");
+    fmt::print("  -n, --viewers <num>   Number of simultaneous viewers (default: 1)\n");
+    fmt::print("  -t, --duration <sec>  Disconnect after given seconds (default: until interrupted)\n");
+    fmt::print("  -a, --audio           Decode audio too\n");
+    fmt::print("  --audio-frame <ms>    Opus frame duration: 2.5, 5, 10, 20, 40 or 60\n");
+    fmt::print("  --audio-bitrate <bps> Opus bitrate\n");
+    fmt::print("  --audio-lowdelay      Use restricted low delay mode (disables FEC)\n");
+    fmt::print("  --audio-fec <loss%>   Enable in-band FEC tuned for given packet loss\n");
+    fmt::print("  --audio-dtx           Enable discontinuous transmission\n");
+    fmt::print("  --no-periodic-keyframes\n");
+    fmt::print("                        Ask for keyframes only when needed, instead of periodic ones\n");
+    fmt::print("  --444                 Ask for 4:4:4 chroma (VP9), which the server may refuse or drop\n");
+    fmt::print("  --drop <loss%>        Drop video frames on arrival to measure recovery time\n");
+}
+
+static HostListEntry findOrAddHost(HostList &hostList, const std::string &addr) {
+    for (auto &now : hostList.hosts) {
+        for (auto &nowAddr : now->addr) {
+            if (nowAddr == addr)
+                return now;
+        }
+    }
+
+    auto entry = std::make_shared<HostList::Entry>();
+    entry->nickname = addr;
+    entry->addr.push_back(addr);
+    hostList.hosts.push_back(entry);
+    return entry;
+}
+
+static void printStat(int id, HeadlessViewer &viewer) {
+    auto stat = viewer.calcStat();
+
+    fmt::print("[{}] video {} frames, audio {} frames\n", id, stat.videoFrames, stat.audioFrames);
+    if (stat.total.valid() && stat.network.valid() && stat.decoding.valid()) {
+        fmt::print("[{}]     Total (w/o display): {:.2f} ms (min {:.2f} p99 {:.2f} max {:.2f})  Encoding: {:.2f} ms\n",
+                   id, stat.total.avg, stat.total.min, stat.total.p99, stat.total.max, stat.encoding.avg);
+        fmt::print("[{}]     Network: {:.2f} ms  Decoding: {:.2f} ms\n", id, stat.network.avg, stat.decoding.avg);
+    }
+
+    if (stat.keyframe.losses != 0) {
+        fmt::print("[{}]     Loss: {} times, {} frames held back, {} keyframe requests\n", id, stat.keyframe.losses,
+                   stat.keyframe.dropped, stat.keyframe.requests);
+        if (stat.keyframe.recovery.valid())
+            fmt::print("[{}]     Recovery: {:.1f} ms (p99 {:.1f} max {:.1f})\n", id, stat.keyframe.recovery.avg,
+                       stat.keyframe.recovery.p99, stat.keyframe.recovery.max);
+    }
+
+    if (0 <= stat.clockError)
+        fmt::print("[{}]     RTT: {:.2f} ms  Clock error: {:.2f} ms\n", id, stat.rtt, stat.clockError);
+
+    if (stat.audioFrames != 0) {
+        fmt::print("[{}]     Audio buffer: {:.1f}/{:.1f} ms  speed {:.4f}  underrun {}  concealed {}\n", id,
+                   stat.audio.depth, stat.audio.targetDepth, stat.audio.speed, stat.audio.underruns,
+                   stat.audio.concealed);
+
+        // Nothing is displayed here, so video is considered presented as soon as it's decoded
+        if (0 <= stat.audio.latency && stat.total.valid())
+            fmt::print("[{}]     Audio latency: {:.1f} ms  A/V offset: {:.1f} ms\n", id, stat.audio.latency,
+                       stat.audio.latency - stat.total.avg);
+    }
+
+    const LatencyTracer &tracer = viewer.getTracer();
+    for (int i = 0; i < (int)LatencyTracer::Stage::COUNT; i++) {
+        auto stage = (LatencyTracer::Stage)i;
+        auto stageStat = tracer.calcStat(stage);
+        if (stageStat.samples != 0)
+            fmt::print("[{}]     {:>12}: p50 {:.2f} ms  p99 {:.2f} ms\n", id, LatencyTracer::stageName(stage),
+                       stageStat.p50, stageStat.p99);
+    }
+}
+
+int main(int argc, char **argv) {
+    setupLogger();
+
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    std::string addr;
+    HeadlessViewer::OutputMode outputMode = HeadlessViewer::OutputMode::DISCARD;
+    std::string outputPath;
+    int viewerCount = 1;
+    int duration = -1;
+    bool decodeAudio = false;
+    bool noPeriodicKeyframes = false;
+    bool chroma444 = false;
+    float dropRate = 0;
+    msg::AudioConfig audioConfig;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if ((arg == "-o" || arg == "--output") && hasValue) {
+            std::string_view mode = argv[++i];
+            if (mode == "discard")
+                outputMode = HeadlessViewer::OutputMode::DISCARD;
+            else if (mode == "checksum")
+                outputMode = HeadlessViewer::OutputMode::CHECKSUM;
+            else if (mode == "yuv")
+                outputMode = HeadlessViewer::OutputMode::RAW_YUV;
+            else if (mode == "y4m")
+                outputMode = HeadlessViewer::OutputMode::Y4M;
+            else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if ((arg == "-f" || arg == "--file") && hasValue) {
+            outputPath = argv[++i];
+        } else if ((arg == "-n" || arg == "--viewers") && hasValue) {
+            viewerCount = std::max(1, atoi(argv[++i]));
+        } else if ((arg == "-t" || arg == "--duration") && hasValue) {
+            duration = atoi(argv[++i]);
+        } else if (arg == "-a" || arg == "--audio") {
+            decodeAudio = true;
+        } else if (arg == "--audio-frame" && hasValue) {
+            audioConfig.set_frame_duration(static_cast<int>(atof(argv[++i]) * 1000));
+        } else if (arg == "--audio-bitrate" && hasValue) {
+            audioConfig.set_bitrate(atoi(argv[++i]));
+        } else if (arg == "--audio-lowdelay") {
+            audioConfig.set_application(msg::AudioConfig_Application_RESTRICTED_LOWDELAY);
+        } else if (arg == "--audio-fec" && hasValue) {
+            audioConfig.set_fec(true);
+            audioConfig.set_expected_loss_percent(atoi(argv[++i]));
+        } else if (arg == "--audio-dtx") {
+            audioConfig.set_dtx(true);
+        } else if (arg == "--no-periodic-keyframes") {
+            noPeriodicKeyframes = true;
+        } else if (arg == "--444") {
+            chroma444 = true;
+        } else if (arg == "--drop" && hasValue) {
+            dropRate = std::clamp(static_cast<float>(atof(argv[++i])), 0.0f, 100.0f);
+        } else if (arg[0] != '-' && addr.empty()) {
+            addr = arg;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    bool writesFile =
+        outputMode == HeadlessViewer::OutputMode::RAW_YUV || outputMode == HeadlessViewer::OutputMode::Y4M;
+    if (addr.empty() || (writesFile && outputPath.empty())) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    HostList hostList;
+    hostList.loadFromFile("hosts.toml");
+    HostListEntry host = findOrAddHost(hostList, addr);
+
+    std::signal(SIGINT, handleInterrupt);
+    std::signal(SIGTERM, handleInterrupt);
+
+    std::vector<std::unique_ptr<HeadlessViewer>> viewers;
+    viewers.reserve(viewerCount);
+    for (int i = 0; i < viewerCount; i++) {
+        std::string path = outputPath;
+        if (writesFile && viewerCount > 1)
+            path += fmt::format(".{}", i);
+        viewers.push_back(std::make_unique<HeadlessViewer>(i, outputMode, path, decodeAudio));
+        viewers.back()->setAudioConfig(audioConfig);
+        viewers.back()->setNoPeriodicKeyframes(noPeriodicKeyframes);
+        viewers.back()->setChroma444(chroma444);
+        viewers.back()->setDropRate(dropRate);
+    }
+
+    // Connect the first viewer alone so that a pin prompt (if any) is only shown once
+    viewers[0]->connect(host);
+    while (!viewers[0]->isConnected() && !viewers[0]->isDisconnected() && !flagInterrupted.load())
+        std::this_thread::sleep_for(10ms);
+
+    if (viewers[0]->isConnected()) {
+        hostList.saveToFile("hosts.toml");
+
+        auto &audio = viewers[0]->getAudioConfig();
+        fmt::print("Audio: {}, {:.1f} ms frame, bitrate {}, FEC {}, DTX {}\n",
+                   audio.application() == msg::AudioConfig_Application_RESTRICTED_LOWDELAY ? "restricted low delay"
+                                                                                            : "audio",
+                   audio.frame_duration() / 1000.0f, audio.bitrate(), audio.fec(), audio.dtx());
+
+        for (int i = 1; i < viewerCount; i++)
+            viewers[i]->connect(host);
+    } else {
+        viewerCount = 1;
+        viewers.resize(1);
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    auto lastStatPrint = startTime;
+    while (!flagInterrupted.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_for(100ms);
+
+        auto now = std::chrono::steady_clock::now();
+        if (0 <= duration && std::chrono::seconds(duration) <= now - startTime)
+            break;
+
+        bool anyConnected = false;
+        for (auto &viewer : viewers)
+            anyConnected |= !viewer->isDisconnected();
+        if (!anyConnected)
+            break;
+
+        if (5s <= now - lastStatPrint) {
+            lastStatPrint = now;
+            for (int i = 0; i < viewerCount; i++)
+                printStat(i, *viewers[i]);
+        }
+    }
+
+    for (int i = 0; i < viewerCount; i++) {
+        viewers[i]->disconnect();
+        printStat(i, *viewers[i]);
+    }
+
+    return 0;
+}
@@ -16,9 +16,10 @@ DecoderFFmpeg::~DecoderFFmpeg() {
 
 std::vector<CodecType> DecoderFFmpeg::enumSupportedCodecs() {
     std::vector<CodecType> ret;
-    ret.reserve(1);
+    ret.reserve(2);
 
     ret.push_back(CodecType::VP8);
+    ret.push_back(CodecType::VP9);
     return ret;
 }
 
@@ -35,6 +36,10 @@ void DecoderFFmpeg::init(CodecType codecType_, std::shared_ptr<NetworkClock> clo
         codec = avcodec_find_decoder_by_name("vp8");
         log.assert_quit(codec != nullptr, "Failed to find ffvp8 decoder");
         break;
+    case CodecType::VP9:
+        codec = avcodec_find_decoder_by_name("vp9");
+        log.assert_quit(codec != nullptr, "Failed to find ffvp9 decoder");
+        break;
     default:
         log.error_quit("Unknown codec type ({}) requested!", (intmax_t)codecType);
     }
@@ -60,6 +65,18 @@ bool DecoderFFmpeg::readSoftware(DesktopFrame<TextureSoftware>* output) {
     return true;
 }
 
+size_t DecoderFFmpeg::queuedFrames() {
+    std::lock_guard lock(frameLock);
+    return frameQueue.size();
+}
+
+bool DecoderFFmpeg::waitFrame(std::chrono::microseconds timeout) {
+    std::unique_lock lock(frameLock);
+    frameCV.wait_for(lock, timeout,
+                     [this]() { return !frameQueue.empty() || !flagRun.load(std::memory_order_relaxed); });
+    return !frameQueue.empty() && flagRun.load(std::memory_order_relaxed);
+}
+
 void DecoderFFmpeg::start() {
     int err;
     log.assert_quit(!flagRun.load(std::memory_order_relaxed), "Not stopped before start!");
@@ -115,7 +132,8 @@ void DecoderFFmpeg::pushData(DesktopFrame<ByteBuffer>&& frame) {
     if (frame.isIDR) {
         if (flagKeyInPacket) {
             // Two IDR packets in queue. Skip all remaining packets
-            log.warn("Skipping {} frames! Is decoder overloaded?", packetQueue.size());
+            static LogRateLimit overloadLimit;
+            log.warn(overloadLimit, "Skipping {} frames! Is decoder overloaded?", packetQueue.size());
 
             std::shared_ptr<CursorPos> lastPos;
             std::shared_ptr<CursorShape> lastShape;
@@ -191,6 +209,8 @@ void DecoderFFmpeg::run_() {
                     flagKeyInPacket = false;
             }
 
+            packet.timeDecodeStarted = clock->time();
+
             pkt->data = packet.desktop.data();
             pkt->size = packet.desktop.size();
             pkt->pts = pts++;
@@ -32,6 +32,8 @@ public:
 
     void pushData(DesktopFrame<ByteBuffer>&& frame) override;
     bool readSoftware(DesktopFrame<TextureSoftware>* output) override;
+    size_t queuedFrames() override;
+    bool waitFrame(std::chrono::microseconds timeout) override;
 
 private:
     void run_();
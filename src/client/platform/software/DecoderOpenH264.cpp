@@ -4,7 +4,7 @@
 
 TWILIGHT_DEFINE_LOGGER(DecoderOpenH264);
 
-DecoderOpenH264::DecoderOpenH264() : flagRun(false), width(-1), height(-1) {}
+DecoderOpenH264::DecoderOpenH264() : flagRun(false), flagKeyInPacket(false), width(-1), height(-1) {}
 
 DecoderOpenH264::~DecoderOpenH264() {
     log.assert_quit(!flagRun.load(std::memory_order_relaxed), "Being destructed without stopping");
@@ -41,6 +41,8 @@ void DecoderOpenH264::start() {
         loader->prepare();
     }
 
+    flagKeyInPacket = false;
+
     flagRun.store(true, std::memory_order_release);
     runThread = std::thread([this]() { run_(); });
 }
@@ -55,6 +57,30 @@ void DecoderOpenH264::stop() {
 
 void DecoderOpenH264::pushData(DesktopFrame<ByteBuffer> &&nextData) {
     std::lock_guard lock(packetLock);
+    if (nextData.isIDR) {
+        if (flagKeyInPacket) {
+            // Two IDR packets in queue. Skip all remaining packets
+            static LogRateLimit overloadLimit;
+            log.warn(overloadLimit, "Skipping {} frames! Is decoder overloaded?", packetQueue.size());
+
+            std::shared_ptr<CursorPos> lastPos;
+            std::shared_ptr<CursorShape> lastShape;
+            for (auto &now : packetQueue) {
+                if (now.cursorPos)
+                    lastPos = std::move(now.cursorPos);
+                if (now.cursorShape)
+                    lastShape = std::move(now.cursorShape);
+            }
+
+            packetQueue.clear();
+
+            if (lastPos && !nextData.cursorPos)
+                nextData.cursorPos = std::move(lastPos);
+            if (lastShape && !nextData.cursorShape)
+                nextData.cursorShape = std::move(lastShape);
+        }
+        flagKeyInPacket = true;
+    }
     packetQueue.push_back(std::move(nextData));
     packetCV.notify_one();
 }
@@ -69,9 +95,22 @@ bool DecoderOpenH264::readSoftware(DesktopFrame<TextureSoftware> *output) {
 
     *output = std::move(frameQueue.front());
     frameQueue.pop_front();
+    frameCV.notify_one();
     return true;
 }
 
+size_t DecoderOpenH264::queuedFrames() {
+    std::lock_guard lock(frameLock);
+    return frameQueue.size();
+}
+
+bool DecoderOpenH264::waitFrame(std::chrono::microseconds timeout) {
+    std::unique_lock lock(frameLock);
+    frameCV.wait_for(lock, timeout,
+                     [this]() { return !frameQueue.empty() || !flagRun.load(std::memory_order_relaxed); });
+    return !frameQueue.empty() && flagRun.load(std::memory_order_relaxed);
+}
+
 void DecoderOpenH264::run_() {
     int err;
     ISVCDecoder *decoder;
@@ -102,8 +141,12 @@ void DecoderOpenH264::run_() {
 
             data = std::move(packetQueue.front());
             packetQueue.pop_front();
+            if (data.isIDR)
+                flagKeyInPacket = false;
         }
 
+        data.timeDecodeStarted = clock->time();
+
         uint8_t *framebuffer[3] = {};
         SBufferInfo decBufferInfo = {};
         err = decoder->DecodeFrameNoDelay(data.desktop.data(), data.desktop.size(), framebuffer, &decBufferInfo);
@@ -138,10 +181,18 @@ void DecoderOpenH264::run_() {
 
             auto frame = data.getOtherType(TextureSoftware::reference(framebuffer, linesize, w, h, fmt).clone(arena));
             frame.timeDecoded = clock->time();
-            std::lock_guard lock(frameLock);
+
+            std::unique_lock lock(frameLock);
+            while (frameQueue.full() && flagRun.load(std::memory_order_relaxed))
+                frameCV.wait(lock);
+            if (!flagRun.load(std::memory_order_relaxed))
+                break;
             frameQueue.push_back(std::move(frame));
-        } else
-            log.info("No frame provided");
+            frameCV.notify_one();
+        } else {
+            static LogRateLimit noFrameLimit;
+            log.info(noFrameLimit, "No frame provided");
+        }
     }
 
     err = decoder->Uninitialize();
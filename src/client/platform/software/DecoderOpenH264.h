@@ -39,6 +39,8 @@ public:
 
     void pushData(DesktopFrame<ByteBuffer>&& frame) override;
     bool readSoftware(DesktopFrame<TextureSoftware>* output) override;
+    size_t queuedFrames() override;
+    bool waitFrame(std::chrono::microseconds timeout) override;
 
 private:
     void run_();
@@ -51,6 +53,7 @@ private:
     std::thread runThread;
 
     std::atomic<bool> flagRun;
+    bool flagKeyInPacket;
     int width, height;
 
     std::mutex packetLock;
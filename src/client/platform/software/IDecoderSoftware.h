@@ -6,6 +6,8 @@
 #include "client/IDecoder.h"
 #include "client/NetworkClock.h"
 
+#include <chrono>
+
 class IDecoderSoftware : public IDecoder {
 public:
     IDecoderSoftware() = default;
@@ -16,6 +18,12 @@ public:
     virtual void init(CodecType codecType, std::shared_ptr<NetworkClock> clock) = 0;
 
     virtual bool readSoftware(DesktopFrame<TextureSoftware>* output) = 0;
+
+    // Number of decoded frames ready to be read
+    virtual size_t queuedFrames() = 0;
+
+    // Waits until a decoded frame is ready to be read. Returns false on timeout or when stopped.
+    virtual bool waitFrame(std::chrono::microseconds timeout) = 0;
 };
 
 #endif
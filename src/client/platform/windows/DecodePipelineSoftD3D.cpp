@@ -1,8 +1,12 @@
 #include "DecodePipelineSoftD3D.h"
 
+#include <thread>
+
 TWILIGHT_DEFINE_LOGGER(DecodePipelineSoftD3D);
 
-DecodePipelineSoftD3D::DecodePipelineSoftD3D(std::unique_ptr<IDecoderSoftware> decoder) : decoder(std::move(decoder)) {
+DecodePipelineSoftD3D::DecodePipelineSoftD3D(std::unique_ptr<IDecoderSoftware> decoder,
+                                             std::shared_ptr<NetworkClock> clock)
+    : decoder(std::move(decoder)), scheduler(std::move(clock)), flagCursorMoved(false) {
     device = dxgiHelper.createDevice(nullptr, false);
     device->GetImmediateContext(context.data());
 
@@ -27,7 +31,30 @@ bool DecodePipelineSoftD3D::render(RendererD3D* renderer, DesktopFrame<D3D11Text
     if (!readD3D_(frame))
         return false;
 
+    flagCursorMoved.store(false, std::memory_order_relaxed);
+    auto pos = std::atomic_load(&cursorPos);
+    if (pos)
+        frame->cursorPos = std::move(pos);
+
     renderer->render(*frame);
+
+    // Shape is already uploaded
+    lastFrame = *frame;
+    lastFrame.cursorShape.reset();
+    return true;
+}
+
+void DecodePipelineSoftD3D::setCursorPos(std::shared_ptr<CursorPos> pos) {
+    std::atomic_store(&cursorPos, std::move(pos));
+    flagCursorMoved.store(true, std::memory_order_release);
+}
+
+bool DecodePipelineSoftD3D::renderCursor(RendererD3D* renderer) {
+    if (!lastFrame.desktop.isValid() || !flagCursorMoved.exchange(false, std::memory_order_acquire))
+        return false;
+
+    lastFrame.cursorPos = std::atomic_load(&cursorPos);
+    renderer->render(lastFrame);
     return true;
 }
 
@@ -41,8 +68,29 @@ void DecodePipelineSoftD3D::stop() {
 
 bool DecodePipelineSoftD3D::readD3D_(DesktopFrame<D3D11Texture2D>* output) {
     DesktopFrame<TextureSoftware> soft;
-    if (!decoder->readSoftware(&soft))
-        return false;
+
+    while (true) {
+        if (!decoder->readSoftware(&soft))
+            return false;
+
+        std::chrono::microseconds waitAmount;
+        PlayoutScheduler::Decision decision = scheduler.schedule(soft, decoder->queuedFrames(), &waitAmount);
+
+        if (decision == PlayoutScheduler::Decision::DROP) {
+            // Cursor shape is only sent on change, so it must survive dropped frames
+            if (soft.cursorShape)
+                droppedCursorShape = std::move(soft.cursorShape);
+            continue;
+        }
+
+        if (decision == PlayoutScheduler::Decision::WAIT)
+            std::this_thread::sleep_for(waitAmount);
+        break;
+    }
+
+    if (droppedCursorShape && !soft.cursorShape)
+        soft.cursorShape = std::move(droppedCursorShape);
+    droppedCursorShape.reset();
 
     scale.pushInput(std::move(soft.desktop));
     *output = soft.getOtherType(uploader.upload(scale.popOutput()));
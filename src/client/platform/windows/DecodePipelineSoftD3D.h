@@ -8,14 +8,21 @@
 
 #include "common/platform/windows/DxgiHelper.h"
 
+#include "client/NetworkClock.h"
+#include "client/PlayoutScheduler.h"
+
 #include "client/platform/software/IDecoderSoftware.h"
 
 #include "client/platform/windows/D3DTextureUploader.h"
 #include "client/platform/windows/RendererD3D.h"
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+
 class DecodePipelineSoftD3D {
 public:
-    explicit DecodePipelineSoftD3D(std::unique_ptr<IDecoderSoftware> decoder);
+    DecodePipelineSoftD3D(std::unique_ptr<IDecoderSoftware> decoder, std::shared_ptr<NetworkClock> clock);
     DecodePipelineSoftD3D(const DecodePipelineSoftD3D& copy) = delete;
     DecodePipelineSoftD3D(DecodePipelineSoftD3D&& move) = delete;
 
@@ -29,10 +36,20 @@ public:
     // Returns true if a new frame was drawn
     bool render(RendererD3D* renderer, DesktopFrame<D3D11Texture2D>* frame);
 
+    // Waits until render() has a frame to draw. Returns false on timeout.
+    bool waitFrame(std::chrono::microseconds timeout) { return decoder->waitFrame(timeout); }
+
+    // Cursor position received apart from video. Overrides one inside frames. Safe to call from any thread.
+    void setCursorPos(std::shared_ptr<CursorPos> pos);
+
+    // Draws last frame again if cursor has moved since. Returns true if drawn.
+    bool renderCursor(RendererD3D* renderer);
+
     void start();
     void stop();
 
     IDecoderSoftware* getDecoder() const { return decoder.get(); }
+    PlayoutScheduler* getScheduler() { return &scheduler; }
     DxgiHelper getDxgiHelper() const { return dxgiHelper; }
     D3D11Device getDevice() const { return device; }
 
@@ -46,6 +63,12 @@ private:
     D3D11DeviceContext context;
 
     std::unique_ptr<IDecoderSoftware> decoder;
+    PlayoutScheduler scheduler;
+    std::shared_ptr<CursorShape> droppedCursorShape;
+    DesktopFrame<D3D11Texture2D> lastFrame;
+
+    std::shared_ptr<CursorPos> cursorPos;
+    std::atomic<bool> flagCursorMoved;
     D3DTextureUploader uploader;
     ScaleSoftware scale;
 };
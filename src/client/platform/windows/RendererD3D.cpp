@@ -43,6 +43,7 @@ void RendererD3D::init(HWND hWnd_, DxgiHelper dxgiHelper_, D3D11Device device_)
     psDesktop.release();
 
     hasCursor = false;
+    uploadedCursor.reset();
     hWnd = hWnd_;
 
     dxgiHelper = std::move(dxgiHelper_);
@@ -139,7 +140,7 @@ void RendererD3D::render(const DesktopFrame<D3D11Texture2D>& frame) {
 
     HRESULT hr;
 
-    if (frame.cursorShape) {
+    if (frame.cursorShape && frame.cursorShape != uploadedCursor) {
         CursorShape* shape = frame.cursorShape.get();
         if (cursorTexSize < shape->width || cursorTexSize < shape->height) {
             cursorTexSize = std::max(shape->width, shape->height);
@@ -161,6 +162,7 @@ void RendererD3D::render(const DesktopFrame<D3D11Texture2D>& frame) {
 
         context->Unmap(cursorTex.ptr(), 0);
         hasCursor = true;
+        uploadedCursor = frame.cursorShape;
         usingXORCursor = shape->format == CursorShapeFormat::RGBA_XOR;
     }
 
@@ -243,6 +245,7 @@ void RendererD3D::recreateCursorTexture_() {
     cursorTex.release();
     cursorSRV.release();
     hasCursor = false;
+    uploadedCursor.reset();
 
     D3D11_TEXTURE2D_DESC cursorTexDesc = {};
     cursorTexDesc.Width = cursorTexSize;
@@ -6,6 +6,8 @@
 
 #include "common/platform/windows/DxgiHelper.h"
 
+#include <memory>
+
 class RendererD3D {
 public:
     RendererD3D();
@@ -34,6 +36,7 @@ private:
 
     bool hasCursor;
     bool usingXORCursor;
+    std::shared_ptr<CursorShape> uploadedCursor;  // Cached shapes come back as the same object
 
     DxgiHelper dxgiHelper;
     D3D11Device device;
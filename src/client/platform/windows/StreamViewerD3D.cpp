@@ -9,6 +9,9 @@
 
 TWILIGHT_DEFINE_LOGGER(StreamViewerD3D);
 
+// How often cursor position is checked while there's no video frame to draw
+static constexpr std::chrono::microseconds CURSOR_POLL_INTERVAL(2000);
+
 StreamViewerD3D::StreamViewerD3D(std::shared_ptr<NetworkClock> clock_, StreamClient *client)
     : StreamViewerBase(),
       clock(std::move(clock_)),
@@ -17,8 +20,11 @@ StreamViewerD3D::StreamViewerD3D(std::shared_ptr<NetworkClock> clock_, StreamCli
       flagStreamStarted(false),
       flagInitialized(false),
       flagRunRender(false),
-      pipeline(std::make_unique<DecoderFFmpeg>()) {
+      keyframeGate([this]() { sc->requestKeyframe(); }),
+      tracer("client", 2),
+      pipeline(std::make_unique<DecoderFFmpeg>(), clock) {
     pipeline.getDecoder()->init(CodecType::VP8, clock);
+    tracer.startTrace();
 }
 
 StreamViewerD3D::~StreamViewerD3D() {
@@ -48,6 +54,15 @@ void StreamViewerD3D::resizeEvent(QResizeEvent *ev) {
 
 void StreamViewerD3D::setDrawCursor(bool newval) {}
 
+void StreamViewerD3D::setPlayoutMode(PlayoutScheduler::Mode mode, std::chrono::microseconds targetDelay) {
+    pipeline.getScheduler()->setMode(mode);
+    pipeline.getScheduler()->setTargetDelay(targetDelay);
+}
+
+void StreamViewerD3D::setAudioDelay(std::chrono::microseconds delay) {
+    pipeline.getScheduler()->setAudioDelay(delay);
+}
+
 void StreamViewerD3D::processDesktopFrame(const msg::Packet &pkt, uint8_t *extraData) {
     if (!flagStreamStarted.exchange(true) && flagWindowReady.load())
         init_();
@@ -55,12 +70,20 @@ void StreamViewerD3D::processDesktopFrame(const msg::Packet &pkt, uint8_t *extra
     auto &res = pkt.desktop_frame();
     clock->monotonicHint(res.time_encoded());
 
+    if (!keyframeGate.admit(res.is_idr()))
+        return;
+
     DesktopFrame<ByteBuffer> now;
     now.desktop.write(0, extraData, pkt.extra_data_len());
 
+    now.frameId = res.frame_id();
     now.timeCaptured = std::chrono::microseconds(res.time_captured());
     now.timeEncoded = std::chrono::microseconds(res.time_encoded());
     now.timeReceived = clock->time();
+    if (res.time_scaled() != 0)
+        now.timeScaled = std::chrono::microseconds(res.time_scaled());
+    if (res.time_send_queued() != 0)
+        now.timeSendQueued = std::chrono::microseconds(res.time_send_queued());
 
     now.isIDR = res.is_idr();
 
@@ -82,6 +105,15 @@ void StreamViewerD3D::processDesktopFrame(const msg::Packet &pkt, uint8_t *extra
 void StreamViewerD3D::processCursorShape(const msg::Packet &pkt, uint8_t *extraData) {
     const auto &data = pkt.cursor_shape();
 
+    if (data.cached()) {
+        std::shared_ptr<CursorShape> cached;
+        if (cursorCache.find(data.id(), &cached))
+            std::atomic_exchange(&pendingCursorChange, cached);
+        else
+            log.warn("Server referred to unknown cursor shape {:016x}", data.id());
+        return;
+    }
+
     auto now = std::make_shared<CursorShape>();
     now->image.write(0, extraData, pkt.extra_data_len());
     now->height = data.height();
@@ -101,9 +133,21 @@ void StreamViewerD3D::processCursorShape(const msg::Packet &pkt, uint8_t *extraD
         now->format = CursorShapeFormat::RGBA;
     }
 
+    cursorCache.insert(data.id(), now);
     std::atomic_exchange(&pendingCursorChange, now);
 }
 
+void StreamViewerD3D::processCursorPosition(const msg::Packet &pkt) {
+    const auto &data = pkt.cursor_position();
+
+    auto now = std::make_shared<CursorPos>();
+    now->visible = data.visible();
+    now->x = now->visible ? data.x() : -1;
+    now->y = now->visible ? data.y() : -1;
+
+    pipeline.setCursorPos(std::move(now));
+}
+
 void StreamViewerD3D::init_() {
     bool prev = flagInitialized.exchange(true, std::memory_order_relaxed);
     if (prev)
@@ -137,11 +181,18 @@ void StreamViewerD3D::renderLoop_() {
     while (flagRunRender.load(std::memory_order_acquire)) {
         // TODO: Handle window size changes
 
+        // Redraw pointer alone while waiting, so that it moves faster than video frame rate
+        if (!pipeline.waitFrame(CURSOR_POLL_INTERVAL)) {
+            pipeline.renderCursor(&renderer);
+            continue;
+        }
+
         DesktopFrame<D3D11Texture2D> frame;
         if (!pipeline.render(&renderer, &frame))
             continue;
 
         frame.timePresented = clock->time();
+        tracer.addFrame(frame);
         if (frame.timeCaptured.count() > 0) {
             encodingTime.pushValue((frame.timeEncoded - frame.timeCaptured).count() / 1000.0f);
             totalTime.pushValue((frame.timePresented - frame.timeCaptured).count() / 1000.0f);
@@ -160,6 +211,18 @@ void StreamViewerD3D::renderLoop_() {
                 log.info("Total latency: {:.2f}ms  (Encoding: {:.2f} ms", totStat.avg, encStat.avg);
                 log.info("    Network: {:.2f} ms  Decoding: {:.2f} ms)", netStat.avg, decStat.avg);
             }
+
+            log.info("Per-stage latency:");
+            tracer.logStat(log);
+
+            auto playout = pipeline.getScheduler()->getStat();
+            log.info("Playout: queue {}  dropped {}/{}  added delay {:.2f} ms  target {:.2f} ms", playout.queueDepth,
+                     playout.droppedFrames, playout.droppedFrames + playout.presentedFrames,
+                     playout.addedDelay.count() / 1000.0f, playout.targetDelay.count() / 1000.0f);
+            if (playout.hasAudio)
+                log.info("A/V offset: {:.2f} ms  (Video delay: {:.2f} ms)", playout.avOffset.count() / 1000.0f,
+                         playout.videoDelay.count() / 1000.0f);
+            pipeline.getScheduler()->resetStat();
         }
     }
 }
@@ -2,9 +2,12 @@
 #define TWILIGHT_CLIENT_PLATFORM_WINDOWS_STREAMVIEWERD3D_H
 
 #include "common/ByteBuffer.h"
+#include "common/CursorShapeCache.h"
+#include "common/LatencyTracer.h"
 #include "common/log.h"
 #include "common/util.h"
 
+#include "client/KeyframeGate.h"
 #include "client/NetworkClock.h"
 #include "client/StreamClient.h"
 #include "client/StreamViewerBase.h"
@@ -27,8 +30,11 @@ public:
 
 protected:
     void setDrawCursor(bool newval) override;
+    void setPlayoutMode(PlayoutScheduler::Mode mode, std::chrono::microseconds targetDelay) override;
+    void setAudioDelay(std::chrono::microseconds delay) override;
     void processDesktopFrame(const msg::Packet &pkt, uint8_t *extraData) override;
     void processCursorShape(const msg::Packet &pkt, uint8_t *extraData) override;
+    void processCursorPosition(const msg::Packet &pkt) override;
 
     void resizeEvent(QResizeEvent *ev) override;
 
@@ -53,6 +59,10 @@ private:
 
     std::thread renderThread;
     std::shared_ptr<CursorShape> pendingCursorChange;
+    CursorShapeCache cursorCache;  // Only accessed by the network thread
+    KeyframeGate keyframeGate;
+
+    LatencyTracer tracer;
 
     DecodePipelineSoftD3D pipeline;
 };
@@ -21,7 +21,7 @@ public:
     public:
         explicit View(ByteBuffer *_parent) : parent(_parent) {}
 
-        size_t size() const { return parent->nowSize / sizeof(T); }
+        size_t size() const { return parent->size_ / sizeof(T); }
 
         T *data() const { return reinterpret_cast<T *>(parent->ptr); }
         T *begin() const { return reinterpret_cast<T *>(parent->ptr); }
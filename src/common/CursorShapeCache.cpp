@@ -0,0 +1,39 @@
+#include "CursorShapeCache.h"
+
+#include "common/util.h"
+
+#include <algorithm>
+
+CursorShapeCache::CursorShapeCache() {
+    entries.reserve(CAPACITY);
+}
+
+CursorShapeCache::~CursorShapeCache() {}
+
+uint64_t CursorShapeCache::hash(const CursorShape& shape) {
+    int32_t header[5] = {shape.width, shape.height, shape.hotspotX, shape.hotspotY, static_cast<int32_t>(shape.format)};
+    uint64_t ret = hashBytesFNV1a(header, sizeof(header));
+    return hashBytesFNV1a(shape.image.data(), shape.image.size(), ret);
+}
+
+bool CursorShapeCache::find(uint64_t id, std::shared_ptr<CursorShape>* out) {
+    auto itr = std::find_if(entries.begin(), entries.end(), [id](const Entry& now) { return now.id == id; });
+    if (itr == entries.end())
+        return false;
+
+    std::rotate(entries.begin(), itr, itr + 1);
+    if (out != nullptr)
+        *out = entries.front().shape;
+    return true;
+}
+
+void CursorShapeCache::insert(uint64_t id, std::shared_ptr<CursorShape> shape) {
+    if (find(id)) {
+        entries.front().shape = std::move(shape);
+        return;
+    }
+
+    if (entries.size() == CAPACITY)
+        entries.pop_back();
+    entries.insert(entries.begin(), Entry{id, std::move(shape)});
+}
@@ -0,0 +1,43 @@
+#ifndef TWILIGHT_COMMON_CURSORSHAPECACHE_H
+#define TWILIGHT_COMMON_CURSORSHAPECACHE_H
+
+#include "common/DesktopFrame.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Least recently used set of cursor shapes, keyed by content hash.
+// Server and client apply the same operations in the same order, so that both sides always hold the same set
+// of shapes and the server can refer to one by its id instead of resending the image.
+class CursorShapeCache {
+public:
+    // Applications only switch between a handful of cursors
+    static constexpr size_t CAPACITY = 16;
+
+    CursorShapeCache();
+    CursorShapeCache(const CursorShapeCache& copy) = delete;
+    CursorShapeCache(CursorShapeCache&& move) = delete;
+    ~CursorShapeCache();
+
+    static uint64_t hash(const CursorShape& shape);
+
+    // Returns whether `id` is cached and marks it as most recently used. Stores the shape to `out` if not null.
+    bool find(uint64_t id, std::shared_ptr<CursorShape>* out = nullptr);
+
+    // Adds `id` as most recently used, evicting the least recently used one if full
+    void insert(uint64_t id, std::shared_ptr<CursorShape> shape);
+
+    void clear() { entries.clear(); }
+
+private:
+    struct Entry {
+        uint64_t id;
+        std::shared_ptr<CursorShape> shape;
+    };
+
+    // Ordered from most recently used. Small enough that linear search beats any index.
+    std::vector<Entry> entries;
+};
+
+#endif
@@ -13,7 +13,7 @@
 // TODO: Move this to a more proper place
 enum class ScaleType { AYUV, NV12 };
 
-enum class CodecType { INVALID, H264_BASELINE, VP8 };
+enum class CodecType { INVALID, H264_BASELINE, VP8, VP9 };
 
 enum class CursorShapeFormat { RGBA, RGBA_XOR };
 
@@ -26,9 +26,15 @@ struct DesktopFrame {
     std::shared_ptr<CursorPos> cursorPos;
     std::shared_ptr<CursorShape> cursorShape;
 
+    // Sequential id assigned by server. Used to correlate traces.
+    uint64_t frameId;
+
     std::chrono::microseconds timeCaptured;
+    std::chrono::microseconds timeScaled;
     std::chrono::microseconds timeEncoded;
+    std::chrono::microseconds timeSendQueued;
     std::chrono::microseconds timeReceived;
+    std::chrono::microseconds timeDecodeStarted;
     std::chrono::microseconds timeDecoded;
     std::chrono::microseconds timePresented;
 
@@ -41,9 +47,14 @@ struct DesktopFrame {
         ret.cursorPos = cursorPos;
         ret.cursorShape = cursorShape;
 
+        ret.frameId = frameId;
+
         ret.timeCaptured = timeCaptured;
+        ret.timeScaled = timeScaled;
         ret.timeEncoded = timeEncoded;
+        ret.timeSendQueued = timeSendQueued;
         ret.timeReceived = timeReceived;
+        ret.timeDecodeStarted = timeDecodeStarted;
         ret.timeDecoded = timeDecoded;
         ret.timePresented = timePresented;
 
@@ -55,9 +66,13 @@ struct DesktopFrame {
         : desktop(),
           cursorPos(),
           cursorShape(),
+          frameId(0),
           timeCaptured(-1),
+          timeScaled(-1),
           timeEncoded(-1),
+          timeSendQueued(-1),
           timeReceived(-1),
+          timeDecodeStarted(-1),
           timeDecoded(-1),
           timePresented(-1),
           isIDR(false) {}
@@ -72,9 +87,13 @@ struct DesktopFrame {
         swap(a.desktop, b.desktop);
         swap(a.cursorPos, b.cursorPos);
         swap(a.cursorShape, b.cursorShape);
+        swap(a.frameId, b.frameId);
         swap(a.timeCaptured, b.timeCaptured);
+        swap(a.timeScaled, b.timeScaled);
         swap(a.timeEncoded, b.timeEncoded);
+        swap(a.timeSendQueued, b.timeSendQueued);
         swap(a.timeReceived, b.timeReceived);
+        swap(a.timeDecodeStarted, b.timeDecodeStarted);
         swap(a.timeDecoded, b.timeDecoded);
         swap(a.timePresented, b.timePresented);
         swap(a.isIDR, b.isIDR);
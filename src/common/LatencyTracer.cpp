@@ -0,0 +1,189 @@
+#include "LatencyTracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+TWILIGHT_DEFINE_LOGGER(LatencyTracer);
+
+LatencyTracer::LatencyTracer(const char* processName, int processId)
+    : processName(processName), processId(processId), tracing(false) {
+    addTrack({});
+}
+
+LatencyTracer::~LatencyTracer() {
+    stopTrace();
+}
+
+const char* LatencyTracer::stageName(Stage stage) {
+    switch (stage) {
+    case Stage::SCALE:
+        return "scale";
+    case Stage::ENCODE:
+        return "encode";
+    case Stage::SEND_QUEUE:
+        return "send-queue";
+    case Stage::SEND:
+        return "send";
+    case Stage::NETWORK:
+        return "network";
+    case Stage::DECODE_QUEUE:
+        return "decode-queue";
+    case Stage::DECODE:
+        return "decode";
+    case Stage::PRESENT:
+        return "present";
+    case Stage::TOTAL:
+        return "total";
+    default:
+        return "unknown";
+    }
+}
+
+int LatencyTracer::addTrack(const std::string& name) {
+    std::lock_guard lk(lock);
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (tracks[i].name == name)
+            return (int)i;
+    }
+
+    Track& track = tracks.emplace_back();
+    track.name = name;
+    for (StatisticMixer& w : track.windows)
+        w.setPoolSize(WINDOW_SIZE);
+    return (int)tracks.size() - 1;
+}
+
+void LatencyTracer::startTrace(std::string path) {
+    if (path.empty()) {
+        const char* env = getenv("TWILIGHT_TRACE");
+        if (env == nullptr || env[0] == '\0')
+            return;
+        path = env;
+    }
+
+    std::lock_guard lk(lock);
+    log.info("Writing latency trace to {}", path);
+    tracing = true;
+    tracePath = std::move(path);
+    events.clear();
+    events.reserve(4096);
+}
+
+void LatencyTracer::stopTrace() {
+    std::lock_guard lk(lock);
+    if (!tracing)
+        return;
+
+    tracing = false;
+    writeTrace_();
+    events.clear();
+    events.shrink_to_fit();
+}
+
+void LatencyTracer::addSpan(Stage stage, uint64_t frameId, std::chrono::microseconds begin,
+                            std::chrono::microseconds end, int track) {
+    if (begin.count() < 0 || end.count() < 0)
+        return;
+
+    long long dur = std::max<long long>(0, (end - begin).count());
+
+    std::lock_guard lk(lock);
+
+    tracks[track].windows[(size_t)stage].pushValue(dur / 1000.0f);
+
+    if (tracing && events.size() < MAX_EVENTS)
+        events.push_back(Event{track, stage, frameId, begin.count(), dur});
+}
+
+void LatencyTracer::addFrame_(int track, uint64_t frameId, const std::chrono::microseconds (&stamps)[8]) {
+    enum { CAPTURED, SCALED, ENCODED, SEND_QUEUED, RECEIVED, DECODE_STARTED, DECODED, PRESENTED };
+
+    auto known = [&](int idx) { return 0 <= stamps[idx].count(); };
+
+    // Falls back to previous known stamp so that missing stages don't break the chain
+    auto prev = [&](int idx) {
+        for (int i = idx - 1; i >= 0; i--) {
+            if (known(i))
+                return stamps[i];
+        }
+        return std::chrono::microseconds(-1);
+    };
+
+    addSpan(Stage::SCALE, frameId, stamps[CAPTURED], stamps[SCALED], track);
+    addSpan(Stage::ENCODE, frameId, prev(ENCODED), stamps[ENCODED], track);
+    addSpan(Stage::SEND_QUEUE, frameId, stamps[ENCODED], stamps[SEND_QUEUED], track);
+    addSpan(Stage::NETWORK, frameId, prev(RECEIVED), stamps[RECEIVED], track);
+    addSpan(Stage::DECODE_QUEUE, frameId, stamps[RECEIVED], stamps[DECODE_STARTED], track);
+    addSpan(Stage::DECODE, frameId, prev(DECODED), stamps[DECODED], track);
+    addSpan(Stage::PRESENT, frameId, stamps[DECODED], stamps[PRESENTED], track);
+
+    for (int i = PRESENTED; i > CAPTURED; i--) {
+        if (known(i)) {
+            addSpan(Stage::TOTAL, frameId, stamps[CAPTURED], stamps[i], track);
+            break;
+        }
+    }
+}
+
+LatencyTracer::StageStat LatencyTracer::calcStat(Stage stage, int track) const {
+    StatisticMixer::Stat stat;
+
+    /* lock */ {
+        std::lock_guard lk(lock);
+        stat = tracks[track].windows[(size_t)stage].calcStat();
+    }
+
+    StageStat ret;
+    ret.samples = stat.samples;
+    ret.p50 = stat.p50;
+    ret.p99 = stat.p99;
+    return ret;
+}
+
+void LatencyTracer::logStat(const NamedLogger& logger, int track) const {
+    for (int i = 0; i < (int)Stage::COUNT; i++) {
+        StageStat stat = calcStat((Stage)i, track);
+        if (stat.samples == 0)
+            continue;
+        logger.info("    {:>12}: p50 {:.2f} ms  p99 {:.2f} ms", stageName((Stage)i), stat.p50, stat.p99);
+    }
+}
+
+void LatencyTracer::writeTrace_() {
+    FILE* f = fopen(tracePath.c_str(), "wb");
+    if (f == nullptr) {
+        log.error("Failed to open {} for writing trace", tracePath);
+        return;
+    }
+
+    // Chrome trace event format. Also readable by Perfetto.
+    // Each stage of each track gets its own row; merge server and client traces to see the whole pipeline.
+    auto tid = [](int track, Stage stage) { return track * (int)Stage::COUNT + (int)stage; };
+
+    fmt::print(f, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fmt::print(f, "{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},\"args\":{{\"name\":\"{}\"}}}}", processId,
+               processName);
+    for (int t = 0; t < (int)tracks.size(); t++) {
+        for (int i = 0; i < (int)Stage::COUNT; i++) {
+            std::string name = tracks[t].name.empty() ? std::string(stageName((Stage)i))
+                                                      : fmt::format("{} {}", tracks[t].name, stageName((Stage)i));
+            fmt::print(f, ",\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},"
+                       "\"args\":{{\"name\":\"{}\"}}}}",
+                       processId, tid(t, (Stage)i), name);
+        }
+    }
+    for (const Event& ev : events) {
+        fmt::print(f,
+                   ",\n{{\"name\":\"{}\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":{},\"tid\":{},\"ts\":{},\"dur\":{},"
+                   "\"args\":{{\"frame\":{},\"track\":{}}}}}",
+                   stageName(ev.stage), processId, tid(ev.track, ev.stage), ev.begin, ev.dur, ev.frameId, ev.track);
+    }
+    fmt::print(f, "\n]}}\n");
+
+    fclose(f);
+
+    if (events.size() >= MAX_EVENTS)
+        log.warn("Trace was truncated to {} events", MAX_EVENTS);
+}
@@ -0,0 +1,109 @@
+#ifndef TWILIGHT_COMMON_LATENCYTRACER_H
+#define TWILIGHT_COMMON_LATENCYTRACER_H
+
+#include "common/DesktopFrame.h"
+#include "common/StatisticMixer.h"
+#include "common/log.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Collects per-frame pipeline stages as spans.
+// All times must be in the server clock domain (LocalClock on server, NetworkClock on client).
+//
+// Frame ids are only unique within a stream of frames, so streams sharing a tracer (like simulcast layers)
+// record into separate tracks, each with its own statistics and trace rows.
+//
+// Each trace file is a complete JSON object. Server and client traces use distinct process ids, so their
+// events can be merged into a single timeline with:
+//   jq -s '{displayTimeUnit: "ms", traceEvents: map(.traceEvents) | add}' server.json client.json > merged.json
+class LatencyTracer {
+public:
+    enum class Stage : int {
+        SCALE,         //< captured -> scaled
+        ENCODE,        //< scaled (or captured) -> encoded
+        SEND_QUEUE,    //< encoded -> queued for send
+        SEND,          //< queued for send -> written to socket
+        NETWORK,       //< queued for send (or encoded) -> received
+        DECODE_QUEUE,  //< received -> decode started
+        DECODE,        //< decode started -> decoded
+        PRESENT,       //< decoded -> presented
+        TOTAL,         //< captured -> last known stage
+        COUNT
+    };
+
+    struct StageStat {
+        size_t samples;
+        float p50, p99;  //< In milliseconds. NaN if no samples.
+    };
+
+    // Process name and id show up in the trace viewer. Use distinct ids to merge traces.
+    LatencyTracer(const char* processName, int processId);
+    LatencyTracer(const LatencyTracer& copy) = delete;
+    LatencyTracer(LatencyTracer&& move) = delete;
+    ~LatencyTracer();
+
+    static const char* stageName(Stage stage);
+
+    // Track 0 always exists and is unnamed. Returns the existing track if one has the same name.
+    int addTrack(const std::string& name);
+
+    // Begins collecting trace events. Written to `path` on stopTrace() or destruction.
+    // Uses path from environment variable TWILIGHT_TRACE if path is empty.
+    void startTrace(std::string path = {});
+    void stopTrace();
+
+    // Ignored if either time is unknown (negative)
+    void addSpan(Stage stage, uint64_t frameId, std::chrono::microseconds begin, std::chrono::microseconds end,
+                 int track = 0);
+
+    // Adds every span derivable from timestamps in frame
+    template <typename T>
+    void addFrame(const DesktopFrame<T>& frame, int track = 0) {
+        std::chrono::microseconds stamps[] = {frame.timeCaptured,   frame.timeScaled,        frame.timeEncoded,
+                                              frame.timeSendQueued, frame.timeReceived,      frame.timeDecodeStarted,
+                                              frame.timeDecoded,    frame.timePresented};
+        addFrame_(track, frame.frameId, stamps);
+    }
+
+    StageStat calcStat(Stage stage, int track = 0) const;
+
+    // Logs p50/p99 of all stages of the track with samples
+    void logStat(const NamedLogger& logger, int track = 0) const;
+
+private:
+    static constexpr size_t WINDOW_SIZE = 512;
+    static constexpr size_t MAX_EVENTS = 1 << 20;
+
+    struct Track {
+        std::string name;
+        std::array<StatisticMixer, (size_t)Stage::COUNT> windows;
+    };
+
+    struct Event {
+        int track;
+        Stage stage;
+        uint64_t frameId;
+        long long begin, dur;
+    };
+
+    void addFrame_(int track, uint64_t frameId, const std::chrono::microseconds (&stamps)[8]);
+    void writeTrace_();
+
+    static NamedLogger log;
+
+    std::string processName;
+    int processId;
+
+    mutable std::mutex lock;
+    bool tracing;
+    std::string tracePath;
+    std::vector<Event> events;
+    std::vector<Track> tracks;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "Metrics.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+
+TWILIGHT_DEFINE_LOGGER(MetricsRegistry);
+
+MetricHistogram::MetricHistogram(std::vector<double> bounds)
+    : bounds(std::move(bounds)), counts(std::make_unique<std::atomic<uint64_t>[]>(this->bounds.size() + 1)), sum(0) {
+    for (size_t i = 0; i <= this->bounds.size(); i++)
+        counts[i].store(0, std::memory_order_relaxed);
+}
+
+void MetricHistogram::observe(double val) {
+    size_t idx = std::lower_bound(bounds.begin(), bounds.end(), val) - bounds.begin();
+    counts[idx].fetch_add(1, std::memory_order_relaxed);
+
+    // No fetch_add for floating point until C++20
+    double prev = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(prev, prev + val, std::memory_order_relaxed))
+        ;
+}
+
+void MetricHistogram::snapshot(std::vector<uint64_t>* cumulative, double* sum) const {
+    cumulative->resize(bounds.size() + 1);
+
+    uint64_t total = 0;
+    for (size_t i = 0; i <= bounds.size(); i++) {
+        total += counts[i].load(std::memory_order_relaxed);
+        (*cumulative)[i] = total;
+    }
+    *sum = this->sum.load(std::memory_order_relaxed);
+}
+
+MetricsRegistry& MetricsRegistry::global() {
+    static MetricsRegistry instance;
+    return instance;
+}
+
+std::vector<double> MetricsRegistry::latencyBuckets() {
+    std::vector<double> ret;
+    for (int i = 0; i < 12; i++)
+        ret.push_back(std::ldexp(0.0005, i));
+    return ret;
+}
+
+MetricCounter& MetricsRegistry::counter(std::string_view name, std::string_view help, std::string_view labels) {
+    std::lock_guard lk(lock);
+    Entry& entry = findOrAdd_(Type::COUNTER, name, help, labels);
+    entry.users++;
+    if (!entry.counter)
+        entry.counter = std::make_unique<MetricCounter>();
+    return *entry.counter;
+}
+
+MetricGauge& MetricsRegistry::gauge(std::string_view name, std::string_view help, std::string_view labels) {
+    std::lock_guard lk(lock);
+    Entry& entry = findOrAdd_(Type::GAUGE, name, help, labels);
+    entry.users++;
+    if (!entry.gauge)
+        entry.gauge = std::make_unique<MetricGauge>();
+    return *entry.gauge;
+}
+
+MetricHistogram& MetricsRegistry::histogram(std::string_view name, std::string_view help, std::string_view labels,
+                                            std::vector<double> bounds) {
+    std::lock_guard lk(lock);
+    Entry& entry = findOrAdd_(Type::HISTOGRAM, name, help, labels);
+    entry.users++;
+    if (!entry.histogram)
+        entry.histogram = std::make_unique<MetricHistogram>(std::move(bounds));
+    return *entry.histogram;
+}
+
+MetricsRegistry::Entry& MetricsRegistry::findOrAdd_(Type type, std::string_view name, std::string_view help,
+                                                    std::string_view labels) {
+    for (auto& now : entries) {
+        if (now->name != name)
+            continue;
+
+        log.assert_quit(now->type == type, "Metric {} registered again with different type", name);
+        if (now->labels == labels)
+            return *now;
+    }
+
+    auto entry = std::make_unique<Entry>();
+    entry->type = type;
+    entry->name = name;
+    entry->help = help;
+    entry->labels = labels;
+    entry->users = 0;
+    entries.push_back(std::move(entry));
+    return *entries.back();
+}
+
+void MetricsRegistry::release(std::string_view name, std::string_view labels) {
+    std::lock_guard lk(lock);
+
+    auto it = std::find_if(entries.begin(), entries.end(),
+                           [&](const auto& now) { return now->name == name && now->labels == labels; });
+    log.assert_quit(it != entries.end(), "Released metric {}{{{}}} which is not registered", name, labels);
+
+    if (--(*it)->users == 0)
+        entries.erase(it);
+}
+
+std::string MetricsRegistry::render() const {
+    static const char* TYPE_NAMES[] = {"counter", "gauge", "histogram"};
+
+    // Held until done, since entries may be released meanwhile
+    std::lock_guard lk(lock);
+
+    std::vector<const Entry*> sorted;
+    for (auto& now : entries)
+        sorted.push_back(now.get());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Entry* a, const Entry* b) { return a->name < b->name; });
+
+    fmt::memory_buffer buf;
+    std::vector<uint64_t> cumulative;
+
+    for (size_t i = 0; i < sorted.size(); i++) {
+        const Entry& entry = *sorted[i];
+        if (i == 0 || sorted[i - 1]->name != entry.name) {
+            fmt::format_to(std::back_inserter(buf), "# HELP {} {}\n", entry.name, entry.help);
+            fmt::format_to(std::back_inserter(buf), "# TYPE {} {}\n", entry.name,
+                           TYPE_NAMES[static_cast<int>(entry.type)]);
+        }
+
+        std::string labels = entry.labels.empty() ? "" : fmt::format("{{{}}}", entry.labels);
+        switch (entry.type) {
+        case Type::COUNTER:
+            fmt::format_to(std::back_inserter(buf), "{}{} {}\n", entry.name, labels, entry.counter->get());
+            break;
+        case Type::GAUGE:
+            fmt::format_to(std::back_inserter(buf), "{}{} {}\n", entry.name, labels, entry.gauge->get());
+            break;
+        case Type::HISTOGRAM: {
+            const auto& bounds = entry.histogram->getBounds();
+            const std::string prefix = entry.labels.empty() ? "" : entry.labels + ",";
+            double sum;
+            entry.histogram->snapshot(&cumulative, &sum);
+
+            for (size_t j = 0; j < bounds.size(); j++)
+                fmt::format_to(std::back_inserter(buf), "{}_bucket{{{}le=\"{}\"}} {}\n", entry.name, prefix,
+                               bounds[j], cumulative[j]);
+            fmt::format_to(std::back_inserter(buf), "{}_bucket{{{}le=\"+Inf\"}} {}\n", entry.name, prefix,
+                           cumulative.back());
+            fmt::format_to(std::back_inserter(buf), "{}_sum{} {}\n", entry.name, labels, sum);
+            fmt::format_to(std::back_inserter(buf), "{}_count{} {}\n", entry.name, labels, cumulative.back());
+            break;
+        }
+        }
+    }
+
+    return fmt::to_string(buf);
+}
@@ -0,0 +1,99 @@
+#ifndef TWILIGHT_COMMON_METRICS_H
+#define TWILIGHT_COMMON_METRICS_H
+
+#include "common/log.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A reference returned by the registry stays valid until the matching release(), or for the whole process if it is
+// never released. Look each one up once (e.g. as a member) and update it from any thread; Updates are single
+// relaxed atomics.
+
+class MetricCounter {
+public:
+    void add(uint64_t amount = 1) { value.fetch_add(amount, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value = 0;
+};
+
+class MetricGauge {
+public:
+    void set(double val) { value.store(val, std::memory_order_relaxed); }
+    double get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> value = 0;
+};
+
+class MetricHistogram {
+public:
+    // [in] bounds: Upper bounds of buckets in increasing order. Bucket of +Inf is implied.
+    explicit MetricHistogram(std::vector<double> bounds);
+
+    void observe(double val);
+
+    const std::vector<double>& getBounds() const { return bounds; }
+
+    // [out] cumulative: Samples less than or equal to each bound, followed by total count
+    void snapshot(std::vector<uint64_t>* cumulative, double* sum) const;
+
+private:
+    std::vector<double> bounds;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;  // Not cumulative. Last one is +Inf.
+    std::atomic<double> sum;
+};
+
+// Process wide set of metrics, rendered in Prometheus text format
+class MetricsRegistry {
+public:
+    static MetricsRegistry& global();
+
+    // 0.5 ms to about 1 s in seconds, doubling each step
+    static std::vector<double> latencyBuckets();
+
+    // Returns the existing one if already registered with the same name and labels.
+    // Each call counts as a user of the metric, until release() is called with the same name and labels.
+    // [in] labels: Constant labels in Prometheus syntax without braces (e.g. `stage="encode"`), or empty
+    MetricCounter& counter(std::string_view name, std::string_view help, std::string_view labels = {});
+    MetricGauge& gauge(std::string_view name, std::string_view help, std::string_view labels = {});
+    MetricHistogram& histogram(std::string_view name, std::string_view help, std::string_view labels = {},
+                               std::vector<double> bounds = latencyBuckets());
+
+    // Drops one user of a metric, removing it once nobody uses it. References to it must not be used afterwards.
+    // For metrics labelled per object (e.g. per session), so that labels don't pile up over time.
+    void release(std::string_view name, std::string_view labels);
+
+    std::string render() const;
+
+private:
+    enum class Type { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Entry {
+        Type type;
+        std::string name;
+        std::string help;
+        std::string labels;
+        int users;
+
+        std::unique_ptr<MetricCounter> counter;
+        std::unique_ptr<MetricGauge> gauge;
+        std::unique_ptr<MetricHistogram> histogram;
+    };
+
+    static NamedLogger log;
+
+    Entry& findOrAdd_(Type type, std::string_view name, std::string_view help, std::string_view labels);
+
+    mutable std::mutex lock;
+    std::vector<std::unique_ptr<Entry>> entries;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef TWILIGHT_COMMON_SPSCRINGBUFFER_H
+#define TWILIGHT_COMMON_SPSCRINGBUFFER_H
+
+#include "common/util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Wait-free ring buffer for exactly one producer thread and one consumer thread.
+// Producer may only call write(), beginWrite(), endWrite() and available().
+// Consumer may only call read(), beginRead(), endRead(), drop() and size().
+// Safe to use in realtime threads (e.g. audio callbacks); never blocks nor allocates.
+template <class T, size_t MIN_SIZE>
+class SpscRingBuffer {
+public:
+    static_assert(std::is_trivial<T>::value, "Ring buffer should only be used with trivial types");
+    static_assert(MIN_SIZE > 0, "Must reserve size greater than 0");
+    static_assert(std::atomic<size_t>::is_always_lock_free, "Requires lock-free atomic size_t");
+    constexpr static size_t SIZE = constexpr_nextPowerOfTwo(MIN_SIZE);
+    constexpr static size_t CACHE_LINE_SIZE = 64;
+
+    SpscRingBuffer() : writePos_(0), readCache_(0), readPos_(0), writeCache_(0) {}
+    SpscRingBuffer(const SpscRingBuffer &copy) = delete;
+    SpscRingBuffer(SpscRingBuffer &&move) = delete;
+    ~SpscRingBuffer() {}
+
+    SpscRingBuffer &operator=(const SpscRingBuffer &copy) = delete;
+    SpscRingBuffer &operator=(SpscRingBuffer &&move) = delete;
+
+    // Consumer side. Items readable right now; more may arrive concurrently.
+    size_t size() const {
+        return writePos_.load(std::memory_order_acquire) - readPos_.load(std::memory_order_relaxed);
+    }
+
+    // Producer side. Items writable right now; more may be freed concurrently.
+    size_t available() const {
+        return SIZE - (writePos_.load(std::memory_order_relaxed) - readPos_.load(std::memory_order_acquire));
+    }
+
+    // Producer side. Returns false if full.
+    bool write(T val) { return write(&val, 1) == 1; }
+
+    // Producer side. Writes as many as possible and returns written amount.
+    size_t write(const T *arr, size_t amount) {
+        const size_t wpos = writePos_.load(std::memory_order_relaxed);
+        if (SIZE - (wpos - readCache_) < amount)
+            readCache_ = readPos_.load(std::memory_order_acquire);
+
+        amount = std::min(amount, SIZE - (wpos - readCache_));
+        if (amount == 0)
+            return 0;
+
+        const size_t idx = wpos % SIZE;
+        const size_t firstAmount = std::min(amount, SIZE - idx);
+        memcpy(buffer_ + idx, arr, firstAmount * sizeof(T));
+        memcpy(buffer_, arr + firstAmount, (amount - firstAmount) * sizeof(T));
+
+        writePos_.store(wpos + amount, std::memory_order_release);
+        return amount;
+    }
+
+    // Producer side. Returns contiguous writable area; may be shorter than available() due to wrap around.
+    // Call endWrite() with amount actually written to publish it.
+    T *beginWrite(size_t *amount) {
+        const size_t wpos = writePos_.load(std::memory_order_relaxed);
+        readCache_ = readPos_.load(std::memory_order_acquire);
+
+        const size_t idx = wpos % SIZE;
+        *amount = std::min(SIZE - (wpos - readCache_), SIZE - idx);
+        return buffer_ + idx;
+    }
+
+    void endWrite(size_t amount) {
+        writePos_.store(writePos_.load(std::memory_order_relaxed) + amount, std::memory_order_release);
+    }
+
+    // Consumer side. Returns contiguous readable area; may be shorter than size() due to wrap around.
+    // Call endRead() with amount actually consumed to release it.
+    const T *beginRead(size_t *amount) {
+        const size_t rpos = readPos_.load(std::memory_order_relaxed);
+        writeCache_ = writePos_.load(std::memory_order_acquire);
+
+        const size_t idx = rpos % SIZE;
+        *amount = std::min(writeCache_ - rpos, SIZE - idx);
+        return buffer_ + idx;
+    }
+
+    void endRead(size_t amount) {
+        readPos_.store(readPos_.load(std::memory_order_relaxed) + amount, std::memory_order_release);
+    }
+
+    // Consumer side. Returns false if empty.
+    bool read(T *val) { return read(val, 1) == 1; }
+
+    // Consumer side. Reads as many as possible and returns read amount.
+    size_t read(T *arr, size_t amount) {
+        const size_t rpos = readPos_.load(std::memory_order_relaxed);
+        if (writeCache_ - rpos < amount)
+            writeCache_ = writePos_.load(std::memory_order_acquire);
+
+        amount = std::min(amount, writeCache_ - rpos);
+        if (amount == 0)
+            return 0;
+
+        const size_t idx = rpos % SIZE;
+        const size_t firstAmount = std::min(amount, SIZE - idx);
+        memcpy(arr, buffer_ + idx, firstAmount * sizeof(T));
+        memcpy(arr + firstAmount, buffer_, (amount - firstAmount) * sizeof(T));
+
+        readPos_.store(rpos + amount, std::memory_order_release);
+        return amount;
+    }
+
+    // Consumer side. Discards up to amount items and returns discarded amount.
+    size_t drop(size_t amount) {
+        const size_t rpos = readPos_.load(std::memory_order_relaxed);
+        if (writeCache_ - rpos < amount)
+            writeCache_ = writePos_.load(std::memory_order_acquire);
+
+        amount = std::min(amount, writeCache_ - rpos);
+        readPos_.store(rpos + amount, std::memory_order_release);
+        return amount;
+    }
+
+    // Not thread safe. Only call while neither side is running.
+    void reset() {
+        writePos_.store(0, std::memory_order_relaxed);
+        readPos_.store(0, std::memory_order_relaxed);
+        readCache_ = 0;
+        writeCache_ = 0;
+    }
+
+private:
+    // Positions increase monotonically and wrap around naturally; SIZE is a power of two.
+    // Each side's index and its cached copy of the other index share one cache line.
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> writePos_;
+    size_t readCache_;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> readPos_;
+    size_t writeCache_;
+
+    alignas(CACHE_LINE_SIZE) T buffer_[SIZE];
+};
+
+#endif
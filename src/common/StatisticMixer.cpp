@@ -6,60 +6,186 @@
 
 TWILIGHT_DEFINE_LOGGER(StatisticMixer);
 
-StatisticMixer::StatisticMixer(size_t initialSize) : arr(initialSize), arrIdx(0) {
-    std::fill(arr.begin(), arr.end(), std::numeric_limits<float>::quiet_NaN());
+void LogHistogram::merge(const LogHistogram& other) {
+    for (size_t i = 0; i < BUCKETS; i++)
+        counts[i] += other.counts[i];
+    total += other.total;
 }
 
-StatisticMixer::~StatisticMixer() {
-    static_assert(std::numeric_limits<float>::has_quiet_NaN, "Current design requires quiet NaN");
+void LogHistogram::clear() {
+    counts.fill(0);
+    total = 0;
 }
 
-void StatisticMixer::setPoolSize(int samples) {
-    int prevSize = arr.size();
-    if (prevSize == samples)
-        return;
+float LogHistogram::quantile(float q) const {
+    if (total == 0)
+        return std::numeric_limits<float>::quiet_NaN();
+
+    size_t rank = static_cast<size_t>(std::clamp(q, 0.0f, 1.0f) * (total - 1));
+    size_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (rank < seen)
+            return valueOf_(i);
+    }
+    return valueOf_(BUCKETS - 1);
+}
+
+size_t LogHistogram::bucketOf_(float val) {
+    float mag = std::abs(val);
+    if (!(std::ldexp(1.0f, MIN_EXP) <= mag))
+        return HALF_BUCKETS;
 
-    arr.resize(samples);
+    // mag = frac * 2^exp where frac is in [0.5, 1)
+    int exp;
+    float frac = std::frexp(mag, &exp);
+    exp -= 1;
 
-    if (samples < prevSize)
-        arrIdx = samples <= arrIdx ? 0 : arrIdx;
+    size_t idx;
+    if (MAX_EXP <= exp || std::isinf(mag))
+        idx = HALF_BUCKETS - 1;
     else
-        std::fill(arr.begin() + prevSize, arr.end(), std::numeric_limits<float>::quiet_NaN());
+        idx = (exp - MIN_EXP) * SUB_BUCKETS + static_cast<int>((frac * 2 - 1) * SUB_BUCKETS);
+
+    return val < 0 ? HALF_BUCKETS - 1 - idx : HALF_BUCKETS + 1 + idx;
 }
 
-void StatisticMixer::pushValue(float val) {
-    arr[arrIdx++] = val;
-    if (arrIdx >= arr.size())
-        arrIdx = 0;
+float LogHistogram::valueOf_(size_t bucket) {
+    if (bucket == HALF_BUCKETS)
+        return 0;
+
+    size_t idx = HALF_BUCKETS < bucket ? bucket - HALF_BUCKETS - 1 : HALF_BUCKETS - 1 - bucket;
+    int exp = MIN_EXP + static_cast<int>(idx / SUB_BUCKETS);
+    float mid = std::ldexp(1.0f + (idx % SUB_BUCKETS + 0.5f) / SUB_BUCKETS, exp);
+    return HALF_BUCKETS < bucket ? mid : -mid;
 }
 
-StatisticMixer::Stat StatisticMixer::calcStat(bool skipNaN) {
-    Stat ret = {};
-
-    float min = std::numeric_limits<float>::max();
-    float max = std::numeric_limits<float>::min();
-    double sum = 0;
-    for (float now : arr) {
-        if (skipNaN && std::isnan(now))
-            break;
-        min = std::min(min, now);
-        max = std::max(max, now);
-        sum += now;
+StatisticMixer::Snapshot::Snapshot()
+    : count(0),
+      mean(0),
+      m2(0),
+      min(std::numeric_limits<float>::quiet_NaN()),
+      max(std::numeric_limits<float>::quiet_NaN()) {}
+
+void StatisticMixer::Snapshot::merge(const Snapshot& other) {
+    if (other.count == 0)
+        return;
+
+    if (count == 0) {
+        *this = other;
+        return;
     }
 
-    int cnt = 0;
-    float avg = static_cast<float>(sum / arr.size());
-    double deviation = 0;
-    for (float now : arr) {
-        if (skipNaN && std::isnan(now))
-            break;
-        deviation += (avg - now) * (avg - now);
-        cnt++;
+    // Chan et al. parallel variance
+    size_t total = count + other.count;
+    double delta = other.mean - mean;
+    mean += delta * other.count / total;
+    m2 += other.m2 + delta * delta * count * other.count / total;
+    count = total;
+
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    hist.merge(other.hist);
+}
+
+StatisticMixer::Stat StatisticMixer::Snapshot::calcStat() const {
+    Stat ret;
+    ret.samples = count;
+
+    if (count == 0) {
+        ret.min = ret.avg = ret.max = ret.stddev = ret.p50 = ret.p99 = std::numeric_limits<float>::quiet_NaN();
+        return ret;
     }
 
     ret.min = min;
     ret.max = max;
-    ret.avg = avg;
-    ret.stddev = static_cast<float>(std::sqrt(deviation / (cnt - 1)));
+    ret.avg = static_cast<float>(mean);
+    ret.stddev = count < 2 ? 0.0f : static_cast<float>(std::sqrt(std::max(0.0, m2 / (count - 1))));
+
+    // Buckets are coarser than actual extremes
+    ret.p50 = std::clamp(hist.quantile(0.5f), min, max);
+    ret.p99 = std::clamp(hist.quantile(0.99f), min, max);
     return ret;
 }
+
+StatisticMixer::StatisticMixer(size_t poolSize) {
+    setPoolSize(poolSize);
+}
+
+StatisticMixer::~StatisticMixer() {}
+
+void StatisticMixer::setPoolSize(size_t samples) {
+    poolSize = samples;
+    arr.assign(samples, 0.0f);
+    minQueue.assign(samples, 0);
+    maxQueue.assign(samples, 0);
+    clear();
+}
+
+void StatisticMixer::clear() {
+    window = Snapshot();
+    pushed = 0;
+    minFront = minLen = 0;
+    maxFront = maxLen = 0;
+}
+
+void StatisticMixer::pushValue(float val) {
+    if (std::isnan(val))
+        return;
+
+    if (0 < poolSize && window.count == poolSize)
+        popValue_();
+
+    // Welford
+    window.count++;
+    double delta = val - window.mean;
+    window.mean += delta / window.count;
+    window.m2 += delta * (val - window.mean);
+    window.hist.add(val);
+
+    if (poolSize == 0) {
+        window.min = window.count == 1 ? val : std::min(window.min, val);
+        window.max = window.count == 1 ? val : std::max(window.max, val);
+        return;
+    }
+
+    const uint64_t seq = pushed++;
+    arr[seq % poolSize] = val;
+
+    while (0 < minLen && val <= arr[minQueue[(minFront + minLen - 1) % poolSize] % poolSize])
+        minLen--;
+    minQueue[(minFront + minLen++) % poolSize] = seq;
+
+    while (0 < maxLen && arr[maxQueue[(maxFront + maxLen - 1) % poolSize] % poolSize] <= val)
+        maxLen--;
+    maxQueue[(maxFront + maxLen++) % poolSize] = seq;
+
+    window.min = arr[minQueue[minFront] % poolSize];
+    window.max = arr[maxQueue[maxFront] % poolSize];
+}
+
+void StatisticMixer::popValue_() {
+    const uint64_t seq = pushed - window.count;
+    const float val = arr[seq % poolSize];
+
+    // Reverse of Welford update
+    if (window.count == 1) {
+        window.mean = 0;
+        window.m2 = 0;
+    } else {
+        double prevMean = window.mean;
+        window.mean = (window.mean * window.count - val) / (window.count - 1);
+        window.m2 = std::max(0.0, window.m2 - (val - prevMean) * (val - window.mean));
+    }
+    window.count--;
+    window.hist.remove(val);
+
+    if (minQueue[minFront] == seq) {
+        minFront = (minFront + 1) % poolSize;
+        minLen--;
+    }
+    if (maxQueue[maxFront] == seq) {
+        maxFront = (maxFront + 1) % poolSize;
+        maxLen--;
+    }
+}
@@ -3,31 +3,113 @@
 
 #include "common/log.h"
 
+#include <array>
+#include <cmath>
 #include <cstdint>
 #include <vector>
 
+// Counts samples in buckets about 6% wide on log scale (for both signs), like HDR histogram.
+// Cheap to add and remove, and merging two is just adding counts; Quantiles are accurate to a bucket.
+class LogHistogram {
+public:
+    static constexpr int SUB_BUCKETS = 16;  //< Per power of two
+    static constexpr int MIN_EXP = -10;     //< Smaller magnitudes count as zero
+    static constexpr int MAX_EXP = 20;      //< Larger magnitudes count as the largest bucket
+    static constexpr size_t HALF_BUCKETS = (MAX_EXP - MIN_EXP) * SUB_BUCKETS;
+    static constexpr size_t BUCKETS = HALF_BUCKETS * 2 + 1;
+
+    LogHistogram() { clear(); }
+
+    void add(float val) {
+        counts[bucketOf_(val)]++;
+        total++;
+    }
+
+    // Must have been added before
+    void remove(float val) {
+        counts[bucketOf_(val)]--;
+        total--;
+    }
+
+    void merge(const LogHistogram& other);
+    void clear();
+
+    size_t size() const { return total; }
+
+    // Representative value of the bucket `q` (0 to 1) of samples fall under. NaN if empty.
+    float quantile(float q) const;
+
+private:
+    static size_t bucketOf_(float val);
+    static float valueOf_(size_t bucket);
+
+    std::array<uint32_t, BUCKETS> counts;
+    size_t total;
+};
+
+// Statistics of last few samples (or all of them), updated in O(1) per sample:
+// Mean and variance by Welford's method, min and max by monotonic queues, and quantiles by LogHistogram.
+// Not thread safe. To report across threads, take snapshot() of each under its own lock and merge them.
 class StatisticMixer {
 public:
     struct Stat {
         float min, avg, max, stddev;
+        float p50, p99;
+        size_t samples;
 
-        bool valid() const { return !isnan(avg); }
+        bool valid() const { return !std::isnan(avg); }
     };
 
-    explicit StatisticMixer(size_t initialSize = 0);
-    StatisticMixer(size_t initialSize, float initialValue);
+    // Mergeable summary of samples
+    class Snapshot {
+    public:
+        Snapshot();
+
+        // Result is as if all samples of both were pushed to one
+        void merge(const Snapshot& other);
+
+        Stat calcStat() const;
+
+    private:
+        friend class StatisticMixer;
+
+        size_t count;
+        double mean;
+        double m2;  // Sum of squared differences from mean
+        float min, max;
+        LogHistogram hist;
+    };
+
+    // Keeps only last `poolSize` samples. Zero keeps all samples without a window (no min/max tracking cost).
+    explicit StatisticMixer(size_t poolSize = 0);
     ~StatisticMixer();
 
-    void setPoolSize(int samples);
+    // Discards all samples
+    void setPoolSize(size_t samples);
+    void clear();
 
+    // NaN is ignored
     void pushValue(float val);
-    Stat calcStat(bool skipNaN = false);
+
+    Stat calcStat() const { return window.calcStat(); }
+    Snapshot snapshot() const { return window; }
 
 private:
+    void popValue_();
+
     static NamedLogger log;
 
+    size_t poolSize;
+    Snapshot window;
+
+    // Ring buffer of samples, indexed by sequence number modulo pool size
     std::vector<float> arr;
-    size_t arrIdx;
+    uint64_t pushed;
+
+    // Sequence numbers of samples that may become min (or max) after older ones leave the window.
+    // Values increase from front in minQueue, and decrease in maxQueue.
+    std::vector<uint64_t> minQueue, maxQueue;
+    size_t minFront, minLen, maxFront, maxLen;
 };
 
 #endif
@@ -0,0 +1,53 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+TWILIGHT_DEFINE_LOGGER(ThreadPool);
+
+ThreadPool::ThreadPool(size_t threadCount) : flagRun(true) {
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    workers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++)
+        workers.emplace_back([this]() { run_(); });
+}
+
+ThreadPool::~ThreadPool() {
+    /* lock */ {
+        std::lock_guard lock(taskLock);
+        flagRun = false;
+    }
+    taskCV.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    /* lock */ {
+        std::lock_guard lock(taskLock);
+        log.assert_quit(flagRun, "Submitted a task to a stopping pool");
+        tasks.push_back(std::move(task));
+    }
+    taskCV.notify_one();
+}
+
+void ThreadPool::run_() {
+    while (true) {
+        std::function<void()> task;
+
+        /* lock */ {
+            std::unique_lock lock(taskLock);
+            while (tasks.empty() && flagRun)
+                taskCV.wait(lock);
+            if (tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef TWILIGHT_COMMON_THREADPOOL_H
+#define TWILIGHT_COMMON_THREADPOOL_H
+
+#include "common/log.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed number of worker threads running submitted tasks in FIFO order.
+// Tasks still queued when the pool is destructed are run before the workers exit.
+class ThreadPool {
+public:
+    // 0 for as many threads as hardware threads
+    explicit ThreadPool(size_t threadCount = 0);
+    ThreadPool(const ThreadPool& copy) = delete;
+    ThreadPool(ThreadPool&& move) = delete;
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+
+    size_t size() const { return workers.size(); }
+
+private:
+    static NamedLogger log;
+
+    void run_();
+
+    std::mutex taskLock;
+    std::condition_variable taskCV;
+    std::deque<std::function<void()>> tasks;
+    bool flagRun;
+
+    std::vector<std::thread> workers;
+};
+
+#endif
@@ -18,7 +18,9 @@ extern "C" {
 #include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 
+#include <libavutil/adler32.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
 }
 
 #ifdef _MSC_VER
@@ -2,18 +2,31 @@
 
 #include "common/ffmpeg-headers.h"
 
+#include <spdlog/async.h>
 #include <spdlog/pattern_formatter.h>
 
 #include <spdlog/sinks/base_sink.h>
 #include <spdlog/sinks/basic_file_sink.h>
+#ifdef WIN32
 #include <spdlog/sinks/msvc_sink.h>
 #include <spdlog/sinks/wincolor_sink.h>
+#else
+#include <spdlog/sinks/ansicolor_sink.h>
+#endif
 
 #include <mbedtls/error.h>
 
 #include <cstdarg>
+#include <cstdlib>
 #include <cstring>
 
+// Enough for a few seconds of per-frame logs; Oldest are dropped beyond this, instead of blocking media threads
+static constexpr size_t ASYNC_QUEUE_SIZE = 8192;
+
+// Shares sinks with the default (async) logger
+static std::shared_ptr<spdlog::logger> syncLoggerPtr;
+static std::atomic<spdlog::logger *> syncLogger;
+
 static void libav_log_sink(void *_obj, int level, const char *format, va_list vl) {
     static std::mutex logLock;
     static char buf[4096] = "";
@@ -63,17 +76,43 @@ void setupLogger() {
     } else {
         std::vector<spdlog::sink_ptr> sinks;
         sinks.reserve(2);
+#ifdef WIN32
         sinks.emplace_back(std::make_shared<spdlog::sinks::msvc_sink_mt>());
         sinks.emplace_back(std::make_shared<spdlog::sinks::wincolor_stdout_sink_mt>(spdlog::color_mode::automatic));
-
-        auto ptr = std::make_shared<spdlog::logger>("twilight", sinks.begin(), sinks.end());
+#else
+        // stdout is reserved for output of headless tools
+        sinks.emplace_back(std::make_shared<spdlog::sinks::ansicolor_stderr_sink_mt>(spdlog::color_mode::automatic));
+#endif
+
+        spdlog::init_thread_pool(ASYNC_QUEUE_SIZE, 1);
+        auto ptr = std::make_shared<spdlog::async_logger>("twilight", sinks.begin(), sinks.end(), spdlog::thread_pool(),
+                                                          spdlog::async_overflow_policy::overrun_oldest);
         spdlog::register_logger(ptr);
         spdlog::set_default_logger(ptr);
+
+        syncLoggerPtr = std::make_shared<spdlog::logger>("twilight", sinks.begin(), sinks.end());
+        syncLogger.store(syncLoggerPtr.get(), std::memory_order_release);
+
+        // Write out queued logs before exiting
+        std::atexit([]() {
+            syncLogger.store(nullptr, std::memory_order_release);
+            spdlog::shutdown();
+        });
     }
 
     setupFFmpegLogs();
 }
 
+void NamedLogger::write_(spdlog::level::level_enum lvl, std::string_view msg) {
+    spdlog::logger *target = nullptr;
+    if (spdlog::level::err <= lvl)
+        target = syncLogger.load(std::memory_order_acquire);
+    if (target == nullptr)
+        target = spdlog::default_logger_raw();
+    if (target != nullptr)
+        target->log(lvl, spdlog::string_view_t(msg.data(), msg.size()));
+}
+
 std::string interpretMbedtlsError(mbedtls_error err) {
     std::string ret;
     ret.resize(256);
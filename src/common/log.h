@@ -17,16 +17,48 @@
 
 // clang-format on
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
 #include <string>
 #include <type_traits>
 #include <utility>
 
 struct fatal_error {};
 
-// Forward logs from various libraries.
+// Forward logs from various libraries, and start writing logs in a background thread.
 // Call once at start
 void setupLogger();
 
+// Lets through one log per interval and counts the rest. Use one per call site,
+// e.g. `static LogRateLimit limit; log.warn(limit, "...");`. Safe to share between threads.
+class LogRateLimit {
+public:
+    explicit LogRateLimit(std::chrono::milliseconds interval = std::chrono::seconds(1))
+        : interval(std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval).count()),
+          next(0),
+          suppressed(0) {}
+
+    // Returns whether to log now.
+    // [out] skipped: Logs suppressed since the last allowed one (only valid when returned true)
+    bool allow(uint64_t *skipped) {
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        auto nextNow = next.load(std::memory_order_relaxed);
+        if (now < nextNow || !next.compare_exchange_strong(nextNow, now + interval, std::memory_order_relaxed)) {
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        *skipped = suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    std::chrono::steady_clock::rep interval;
+    std::atomic<std::chrono::steady_clock::rep> next;
+    std::atomic<uint64_t> suppressed;
+};
+
 // Define static member variable declared like `static NamedLogger log` as `NamedLogger ClassName::log("ClassName");`
 #define TWILIGHT_DEFINE_LOGGER(CLS) NamedLogger CLS ::log(#CLS)
 
@@ -42,7 +74,7 @@ void setupLogger();
 // Include as class static member variable
 class NamedLogger {
 public:
-    explicit NamedLogger(const char *name) : name(name) {}
+    explicit NamedLogger(const char *name) : name(name), prefix(fmt::format("[twilight] {}: ", name)) {}
     NamedLogger(const NamedLogger &copy) = default;
     NamedLogger(NamedLogger &&move) = default;
 
@@ -72,18 +104,58 @@ public:
 
     // Plain loggers
 
+    // Messages are formatted once into a stack buffer, and written by a background thread.
+
     void log(spdlog::level::level_enum lvl, std::string_view msg) const {
         if (!spdlog::should_log(lvl))
             return;
-        spdlog::log(lvl, "[twilight] {}: {}", name, msg);
+        fmt::memory_buffer buf;
+        buf.append(prefix.data(), prefix.data() + prefix.size());
+        buf.append(msg.data(), msg.data() + msg.size());
+        write_(lvl, std::string_view(buf.data(), buf.size()));
     }
 
     template <typename... Args>
     void log(spdlog::level::level_enum lvl, std::string_view pattern, Args &&...args) const {
         if (!spdlog::should_log(lvl))
             return;
-        std::string ptrn = fmt::format("[twilight] {}: {}", name, pattern);
-        spdlog::log(lvl, ptrn, std::forward<Args>(args)...);
+        fmt::memory_buffer buf;
+        format_(buf, pattern, args...);
+        write_(lvl, std::string_view(buf.data(), buf.size()));
+    }
+
+    // Rate limited loggers, for call sites that may fire every frame
+
+    template <typename... Args>
+    void log(LogRateLimit &limit, spdlog::level::level_enum lvl, std::string_view pattern, Args &&...args) const {
+        uint64_t skipped;
+        if (!spdlog::should_log(lvl) || !limit.allow(&skipped))
+            return;
+        fmt::memory_buffer buf;
+        format_(buf, pattern, args...);
+        if (skipped > 0)
+            fmt::format_to(std::back_inserter(buf), " ({} more suppressed)", skipped);
+        write_(lvl, std::string_view(buf.data(), buf.size()));
+    }
+
+    template <typename... Args>
+    void error(LogRateLimit &limit, std::string_view msg, Args &&...args) const {
+        log(limit, spdlog::level::err, msg, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    void warn(LogRateLimit &limit, std::string_view msg, Args &&...args) const {
+        log(limit, spdlog::level::warn, msg, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    void info(LogRateLimit &limit, std::string_view msg, Args &&...args) const {
+        log(limit, spdlog::level::info, msg, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    void debug(LogRateLimit &limit, std::string_view msg, Args &&...args) const {
+        log(limit, spdlog::level::debug, msg, std::forward<Args>(args)...);
     }
 
     // Logs with arguments
@@ -130,7 +202,22 @@ public:
     }
 
 private:
+    template <typename... Args>
+    void format_(fmt::memory_buffer &buf, std::string_view pattern, Args &...args) const {
+        buf.append(prefix.data(), prefix.data() + prefix.size());
+        try {
+            fmt::vformat_to(std::back_inserter(buf), pattern, fmt::make_format_args(args...));
+        } catch (const fmt::format_error &e) {
+            buf.resize(prefix.size());
+            fmt::format_to(std::back_inserter(buf), "{} (Invalid format: {})", pattern, e.what());
+        }
+    }
+
+    // Errors are written right away so that they are never lost on abort; Rest are queued.
+    static void write_(spdlog::level::level_enum lvl, std::string_view msg);
+
     const char *name;
+    std::string prefix;
 };
 
 #ifdef TWILIGHT_MESSING_WITH_ASSERTION
@@ -0,0 +1,114 @@
+#include "MediaHeader.h"
+
+#include <type_traits>
+
+template <typename T>
+static void writeLE(uint8_t*& out, T val) {
+    auto raw = static_cast<std::make_unsigned_t<T>>(val);
+    for (size_t i = 0; i < sizeof(T); i++)
+        *out++ = static_cast<uint8_t>(raw >> (i * 8));
+}
+
+template <typename T>
+static T readLE(const uint8_t*& in) {
+    std::make_unsigned_t<T> raw = 0;
+    for (size_t i = 0; i < sizeof(T); i++)
+        raw |= static_cast<std::make_unsigned_t<T>>(*in++) << (i * 8);
+    return static_cast<T>(raw);
+}
+
+size_t MediaHeader::encode(const msg::Packet& pkt, uint8_t* out) {
+    uint8_t* begin = out;
+
+    switch (pkt.msg_case()) {
+    case msg::Packet::kDesktopFrame: {
+        const msg::DesktopFrame& m = pkt.desktop_frame();
+        writeLE<uint8_t>(out, MARKER);
+        writeLE<uint8_t>(out, DESKTOP_FRAME);
+        writeLE<uint32_t>(out, pkt.extra_data_len());
+        writeLE<uint8_t>(out, (m.cursor_visible() ? 1 : 0) | (m.is_idr() ? 2 : 0));
+        writeLE<int32_t>(out, m.cursor_x());
+        writeLE<int32_t>(out, m.cursor_y());
+        writeLE<uint64_t>(out, m.frame_id());
+        writeLE<uint64_t>(out, m.time_captured());
+        writeLE<uint64_t>(out, m.time_scaled());
+        writeLE<uint64_t>(out, m.time_encoded());
+        writeLE<uint64_t>(out, m.time_send_queued());
+        break;
+    }
+    case msg::Packet::kAudioFrame: {
+        const msg::AudioFrame& m = pkt.audio_frame();
+        writeLE<uint8_t>(out, MARKER);
+        writeLE<uint8_t>(out, AUDIO_FRAME);
+        writeLE<uint32_t>(out, pkt.extra_data_len());
+        writeLE<uint8_t>(out, m.is_first_packet() ? 1 : 0);
+        writeLE<uint8_t>(out, m.channels());
+        writeLE<uint32_t>(out, m.sequence());
+        writeLE<uint64_t>(out, m.time_captured());
+        break;
+    }
+    case msg::Packet::kCursorPosition: {
+        const msg::CursorPosition& m = pkt.cursor_position();
+        writeLE<uint8_t>(out, MARKER);
+        writeLE<uint8_t>(out, CURSOR_POSITION);
+        writeLE<uint32_t>(out, pkt.extra_data_len());
+        writeLE<uint8_t>(out, m.visible() ? 1 : 0);
+        writeLE<int32_t>(out, m.x());
+        writeLE<int32_t>(out, m.y());
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    return out - begin;
+}
+
+size_t MediaHeader::bodySize(uint8_t type) {
+    switch (type) {
+    case DESKTOP_FRAME:
+        return 4 + 1 + 4 + 4 + 8 * 5;
+    case AUDIO_FRAME:
+        return 4 + 1 + 1 + 4 + 8;
+    case CURSOR_POSITION:
+        return 4 + 1 + 4 + 4;
+    default:
+        return 0;
+    }
+}
+
+void MediaHeader::decode(uint8_t type, const uint8_t* body, msg::Packet* pkt) {
+    pkt->set_extra_data_len(readLE<uint32_t>(body));
+
+    switch (type) {
+    case DESKTOP_FRAME: {
+        msg::DesktopFrame* m = pkt->mutable_desktop_frame();
+        uint8_t flags = readLE<uint8_t>(body);
+        m->set_cursor_visible((flags & 1) != 0);
+        m->set_is_idr((flags & 2) != 0);
+        m->set_cursor_x(readLE<int32_t>(body));
+        m->set_cursor_y(readLE<int32_t>(body));
+        m->set_frame_id(readLE<uint64_t>(body));
+        m->set_time_captured(readLE<uint64_t>(body));
+        m->set_time_scaled(readLE<uint64_t>(body));
+        m->set_time_encoded(readLE<uint64_t>(body));
+        m->set_time_send_queued(readLE<uint64_t>(body));
+        break;
+    }
+    case AUDIO_FRAME: {
+        msg::AudioFrame* m = pkt->mutable_audio_frame();
+        m->set_is_first_packet((readLE<uint8_t>(body) & 1) != 0);
+        m->set_channels(readLE<uint8_t>(body));
+        m->set_sequence(readLE<uint32_t>(body));
+        m->set_time_captured(readLE<uint64_t>(body));
+        break;
+    }
+    case CURSOR_POSITION: {
+        msg::CursorPosition* m = pkt->mutable_cursor_position();
+        m->set_visible((readLE<uint8_t>(body) & 1) != 0);
+        m->set_x(readLE<int32_t>(body));
+        m->set_y(readLE<int32_t>(body));
+        break;
+    }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef TWILIGHT_COMMON_NET_MEDIAHEADER_H
+#define TWILIGHT_COMMON_NET_MEDIAHEADER_H
+
+#include <packet.pb.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Fixed layout little-endian header used instead of protobuf for high rate media packets.
+//
+// Protobuf packets are framed by a varint length, which is never zero as NetworkSocket refuses empty packets.
+// A media packet starts with a zero byte instead, followed by a type byte and the body of that type:
+//   common:          u32 extra_data_len
+//   DESKTOP_FRAME:   u8 flags (1: cursor_visible, 2: is_idr), i32 cursor_x, i32 cursor_y,
+//                    u64 frame_id, time_captured, time_scaled, time_encoded, time_send_queued
+//   AUDIO_FRAME:     u8 flags (1: is_first_packet), u8 channels, u32 sequence, u64 time_captured
+//   CURSOR_POSITION: u8 flags (1: visible), i32 x, i32 y
+// Every field of these messages must be listed here; Update this when changing them in stream.proto.
+class MediaHeader {
+public:
+    enum Type : uint8_t { DESKTOP_FRAME = 1, AUDIO_FRAME = 2, CURSOR_POSITION = 3 };
+
+    static constexpr uint8_t MARKER = 0x00;
+    static constexpr size_t MAX_BODY_SIZE = 4 + 49;
+    static constexpr size_t MAX_SIZE = 2 + MAX_BODY_SIZE;
+
+    // Writes marker, type and body. Returns written bytes, or 0 if the packet has no fast path.
+    // [out] out: Must have at least MAX_SIZE bytes
+    static size_t encode(const msg::Packet& pkt, uint8_t* out);
+
+    // Size of body following the type byte, or 0 if type is unknown
+    static size_t bodySize(uint8_t type);
+
+    // Reuses submessage of `pkt` if it already has the same type, so that steady streams don't allocate.
+    // [in] body: bodySize(type) bytes
+    static void decode(uint8_t type, const uint8_t* body, msg::Packet* pkt);
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "MetricsServer.h"
+
+#include "common/Metrics.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+TWILIGHT_DEFINE_LOGGER(MetricsServer);
+
+static constexpr size_t MAX_REQUEST_SIZE = 4096;
+
+// Whole request and response, so that a stalled client can't hold back other scrapes for long
+static constexpr std::chrono::milliseconds REQUEST_TIMEOUT(2000);
+
+// Closing the listening socket doesn't interrupt a blocked accept on POSIX, so poll to notice stop()
+static constexpr uint32_t ACCEPT_POLL_INTERVAL = 200;  // ms
+
+MetricsServer::MetricsServer() : flagRun(false) {
+    mbedtls_net_init(&ctx);
+}
+
+MetricsServer::~MetricsServer() {
+    stop();
+}
+
+void MetricsServer::start(uint16_t port) {
+    bool prev = flagRun.exchange(true, std::memory_order_acq_rel);
+    log.assert_quit(!prev, "Starting metrics server again when already running");
+
+    char portString[8] = {};
+    sprintf(portString, "%d", port);
+    static_assert(sizeof(port) == 2, "sprintf above is safe because port is u16");
+
+    // Metrics are not sensitive, but are not for anyone else either
+    int stat = mbedtls_net_bind(&ctx, "127.0.0.1", portString, MBEDTLS_NET_PROTO_TCP);
+    if (stat != 0) {
+        log.error("Failed to bind metrics port {}: {}", port, mbedtls_error{stat});
+        flagRun.store(false, std::memory_order_release);
+        return;
+    }
+
+    log.info("Serving metrics at http://127.0.0.1:{}/metrics", port);
+
+    runThread = std::thread([this]() {
+        while (flagRun.load(std::memory_order_acquire)) {
+            int ready = mbedtls_net_poll(&ctx, MBEDTLS_NET_POLL_READ, ACCEPT_POLL_INTERVAL);
+            if (ready < 0) {
+                log.error("Failed to poll metrics socket: {}", mbedtls_error{ready});
+                break;
+            }
+            if (ready == 0)
+                continue;
+
+            mbedtls_net_context client;
+            mbedtls_net_init(&client);
+            int stat = mbedtls_net_accept(&ctx, &client, nullptr, 0, nullptr);
+            if (stat != 0) {
+                mbedtls_net_free(&client);
+                break;
+            }
+
+            serve_(&client);
+            mbedtls_net_free(&client);
+        }
+    });
+}
+
+void MetricsServer::stop() {
+    flagRun.store(false, std::memory_order_release);
+
+    if (runThread.joinable())
+        runThread.join();
+
+    mbedtls_net_free(&ctx);
+}
+
+void MetricsServer::serve_(mbedtls_net_context *client) {
+    const auto deadline = std::chrono::steady_clock::now() + REQUEST_TIMEOUT;
+
+    // Milliseconds left until deadline, or 0 if passed
+    auto remaining = [deadline]() -> uint32_t {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        return static_cast<uint32_t>(std::max<long long>(0, left.count()));
+    };
+
+    // Sending would block forever on a client that doesn't read
+    if (mbedtls_net_set_nonblock(client) != 0)
+        return;
+
+    std::string request;
+    char buf[512];
+
+    while (request.find("\r\n\r\n") == std::string::npos) {
+        uint32_t timeout = remaining();
+        if (MAX_REQUEST_SIZE < request.size() || timeout == 0)
+            return;
+
+        int stat = mbedtls_net_recv_timeout(client, reinterpret_cast<uint8_t *>(buf), sizeof(buf), timeout);
+        if (stat == MBEDTLS_ERR_SSL_WANT_READ)
+            continue;
+        if (stat <= 0)
+            return;
+        request.append(buf, stat);
+    }
+
+    std::string_view line(request);
+    line = line.substr(0, line.find("\r\n"));
+
+    std::string body;
+    std::string_view status;
+    if (line.rfind("GET /metrics ", 0) == 0 || line.rfind("GET / ", 0) == 0) {
+        body = MetricsRegistry::global().render();
+        status = "200 OK";
+    } else {
+        body = "Not found\n";
+        status = "404 Not Found";
+    }
+
+    std::string response = fmt::format(
+        "HTTP/1.0 {}\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: {}\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        status, body.size());
+    response.append(body);
+
+    size_t written = 0;
+    while (written < response.size()) {
+        int stat = mbedtls_net_send(client, reinterpret_cast<const uint8_t *>(response.data() + written),
+                                    response.size() - written);
+        if (stat == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            uint32_t timeout = remaining();
+            if (timeout == 0 || mbedtls_net_poll(client, MBEDTLS_NET_POLL_WRITE, timeout) <= 0)
+                return;
+            continue;
+        }
+        if (stat <= 0)
+            return;
+        written += stat;
+    }
+}
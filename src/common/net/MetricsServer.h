@@ -0,0 +1,35 @@
+#ifndef TWILIGHT_COMMON_NET_METRICSSERVER_H
+#define TWILIGHT_COMMON_NET_METRICSSERVER_H
+
+#include "common/log.h"
+
+#include <mbedtls/net_sockets.h>
+
+#include <atomic>
+#include <thread>
+
+// Serves MetricsRegistry::global() to local Prometheus scraper (or curl) over plain HTTP.
+// Binds to loopback only, and answers one request at a time.
+class MetricsServer {
+public:
+    MetricsServer();
+    MetricsServer(const MetricsServer &copy) = delete;
+    MetricsServer(MetricsServer &&move) = delete;
+
+    ~MetricsServer();
+
+    void start(uint16_t port);
+    void stop();
+
+private:
+    static NamedLogger log;
+
+    void serve_(mbedtls_net_context *client);
+
+    std::atomic<bool> flagRun;
+    std::thread runThread;
+
+    mbedtls_net_context ctx;
+};
+
+#endif
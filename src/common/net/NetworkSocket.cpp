@@ -1,17 +1,33 @@
 #include "NetworkSocket.h"
 
 #include "common/ByteBuffer.h"
+#include "common/Metrics.h"
 #include "common/util.h"
 
+#include "common/net/MediaHeader.h"
+
 #include <mbedtls/error.h>
 
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 
+#include <chrono>
+#include <cstring>
 #include <string>
 
 TWILIGHT_DEFINE_LOGGER(NetworkSocket);
 
+// Extra data up to this size is sent in the same TLS record as its header
+constexpr static size_t COALESCE_LIMIT = 4096;
+
+// Shared by all sockets of this process
+static MetricCounter &metricBytesSent =
+    MetricsRegistry::global().counter("twilight_net_sent_bytes_total", "Bytes written to TLS, before encryption");
+static MetricCounter &metricBytesReceived =
+    MetricsRegistry::global().counter("twilight_net_received_bytes_total", "Bytes read from TLS, after decryption");
+static MetricHistogram &metricWriteTime =
+    MetricsRegistry::global().histogram("twilight_net_tls_write_seconds", "Time taken to write a packet to TLS");
+
 // FIXME: Deduplicate from NetworkServer.cpp
 // Mozilla Intermediate SSL but prefers chacha20 over AES
 constexpr static std::string_view ALLOWED_CIPHERS =
@@ -190,13 +206,21 @@ bool NetworkSocket::send(const msg::Packet &pkt, const uint8_t *extraData) {
 
     int ret;
 
-    size_t packetLen = pkt.ByteSizeLong();
     size_t written = 0;
-    sendBuffer.resize(packetLen + 16);
-
     const size_t extraDataLen = pkt.extra_data_len();
 
-    /* Write data */ {
+    if (extraDataLen > 0)
+        log.assert_quit(extraData != nullptr, "Extra data is nullptr (expected {} bytes)", extraDataLen);
+
+    const bool coalesce = extraDataLen <= COALESCE_LIMIT;
+    sendBuffer.resize(MediaHeader::MAX_SIZE + (coalesce ? extraDataLen : 0));
+    written = MediaHeader::encode(pkt, sendBuffer.data());
+
+    if (written == 0) {
+        size_t packetLen = pkt.ByteSizeLong();
+        log.assert_quit(packetLen != 0, "Tried to send an empty packet, which would read as a media header");
+        sendBuffer.resize(packetLen + 16 + (coalesce ? extraDataLen : 0));
+
         google::protobuf::io::ArrayOutputStream aout(sendBuffer.data(), sendBuffer.size());
         google::protobuf::io::CodedOutputStream cout(&aout);
 
@@ -214,6 +238,13 @@ bool NetworkSocket::send(const msg::Packet &pkt, const uint8_t *extraData) {
         written = cout.ByteCount();
     }
 
+    if (coalesce && extraDataLen > 0) {
+        memcpy(sendBuffer.data() + written, extraData, extraDataLen);
+        written += extraDataLen;
+    }
+
+    const auto writeStart = std::chrono::steady_clock::now();
+
     size_t offset = 0;
     while (offset < written) {
         ret = mbedtls_ssl_write(&ssl, sendBuffer.data() + offset, written - offset);
@@ -225,8 +256,7 @@ bool NetworkSocket::send(const msg::Packet &pkt, const uint8_t *extraData) {
         offset += ret;
     }
 
-    if (extraDataLen > 0) {
-        log.assert_quit(extraData != nullptr, "Extra data is nullptr (expected {} bytes)", extraDataLen);
+    if (!coalesce) {
         offset = 0;
         while (offset < extraDataLen) {
             ret = mbedtls_ssl_write(&ssl, extraData + offset, extraDataLen - offset);
@@ -239,6 +269,8 @@ bool NetworkSocket::send(const msg::Packet &pkt, const uint8_t *extraData) {
         }
     }
 
+    metricBytesSent.add(written + (coalesce ? 0 : extraDataLen));
+    metricWriteTime.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - writeStart).count());
     return true;
 }
 
@@ -257,19 +289,40 @@ bool NetworkSocket::recv(msg::Packet *pkt, ByteBuffer *extraData) {
     if (!connected.load(std::memory_order_acquire))
         return false;
 
+    const int startPos = inputStream->CurrentPosition();
+
     int msgLen;
     if (!inputStream->ReadVarintSizeAsInt(&msgLen))
         return false;
 
-    auto limit = inputStream->PushLimit(msgLen);
+    if (msgLen == MediaHeader::MARKER) {
+        uint8_t type;
+        uint8_t body[MediaHeader::MAX_BODY_SIZE];
 
-    if (!pkt->ParseFromCodedStream(inputStream.get()))
-        return false;
+        if (!inputStream->ReadRaw(&type, 1))
+            return false;
 
-    if (!inputStream->ConsumedEntireMessage())
-        return false;
+        size_t bodyLen = MediaHeader::bodySize(type);
+        if (bodyLen == 0) {
+            log.warn("Received unknown media header type {}", type);
+            return false;
+        }
+
+        if (!inputStream->ReadRaw(body, bodyLen))
+            return false;
 
-    inputStream->PopLimit(limit);
+        MediaHeader::decode(type, body, pkt);
+    } else {
+        auto limit = inputStream->PushLimit(msgLen);
+
+        if (!pkt->ParseFromCodedStream(inputStream.get()))
+            return false;
+
+        if (!inputStream->ConsumedEntireMessage())
+            return false;
+
+        inputStream->PopLimit(limit);
+    }
 
     int extraDataLen = pkt->extra_data_len();
 
@@ -284,6 +337,7 @@ bool NetworkSocket::recv(msg::Packet *pkt, ByteBuffer *extraData) {
         }
     }
 
+    metricBytesReceived.add(inputStream->CurrentPosition() - startPos);
     return true;
 }
 
@@ -0,0 +1,17 @@
+#include "PacketArena.h"
+
+PacketArena::PacketArena() : block(std::make_unique<char[]>(BLOCK_SIZE)), arena(options_(block.get())) {}
+
+PacketArena::~PacketArena() {}
+
+google::protobuf::ArenaOptions PacketArena::options_(char* block) {
+    google::protobuf::ArenaOptions ret;
+    ret.initial_block = block;
+    ret.initial_block_size = BLOCK_SIZE;
+    return ret;
+}
+
+msg::Packet& PacketArena::next() {
+    arena.Reset();
+    return *google::protobuf::Arena::CreateMessage<msg::Packet>(&arena);
+}
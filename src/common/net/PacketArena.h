@@ -0,0 +1,37 @@
+#ifndef TWILIGHT_COMMON_NET_PACKETARENA_H
+#define TWILIGHT_COMMON_NET_PACKETARENA_H
+
+#include <packet.pb.h>
+
+#include <google/protobuf/arena.h>
+
+#include <cstddef>
+#include <memory>
+
+// Hands out packets allocated in a protobuf arena with a preallocated first block.
+// Resetting an arena keeps a user supplied block, so packets and their submessages that fit in it never touch
+// the heap once the arena exists, no matter how often the oneof case changes.
+// Contents of long strings are still heap allocated, but media packets have none.
+//
+// Not thread safe; Use one instance per thread.
+class PacketArena {
+public:
+    // Largest control packet is far smaller than this; Media packets carry their payload outside protobuf.
+    static constexpr size_t BLOCK_SIZE = 16 * 1024;
+
+    PacketArena();
+    PacketArena(const PacketArena& copy) = delete;
+    PacketArena(PacketArena&& move) = delete;
+    ~PacketArena();
+
+    // Returns an empty packet. Invalidates every packet previously returned.
+    msg::Packet& next();
+
+private:
+    static google::protobuf::ArenaOptions options_(char* block);
+
+    std::unique_ptr<char[]> block;  // Must outlive arena
+    google::protobuf::Arena arena;
+};
+
+#endif
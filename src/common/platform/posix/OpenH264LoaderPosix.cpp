@@ -0,0 +1,71 @@
+#include "OpenH264LoaderPosix.h"
+
+#include <dlfcn.h>
+
+TWILIGHT_DEFINE_LOGGER(OpenH264LoaderPosix);
+
+OpenH264LoaderPosix::OpenH264LoaderPosix() {}
+
+OpenH264LoaderPosix::~OpenH264LoaderPosix() {
+    if (handle != nullptr)
+        dlclose(handle);
+}
+
+void OpenH264LoaderPosix::prepare() {
+    // Prefer the binary distributed by Cisco, then whatever the system provides
+    handle = dlopen("libopenh264-2.1.1-linux64.6.so", RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
+        handle = dlopen("libopenh264.so.6", RTLD_NOW | RTLD_LOCAL);
+    log.assert_quit(handle != nullptr, "Failed to load openh264 library! ({})", dlerror());
+    log.critical("LICENSE NOTICE: OpenH264 Video Codec provided by Cisco Systems, Inc.");
+
+    CreateSVCEncoderProc = (decltype(CreateSVCEncoderProc))dlsym(handle, "WelsCreateSVCEncoder");
+    log.assert_quit(CreateSVCEncoderProc != nullptr, "Failed to load WelsCreateSVCEncoder!");
+
+    DestroySVCEncoderProc = (decltype(DestroySVCEncoderProc))dlsym(handle, "WelsDestroySVCEncoder");
+    log.assert_quit(DestroySVCEncoderProc != nullptr, "Failed to load WelsDestroySVCEncoder!");
+
+    CreateDecoderProc = (decltype(CreateDecoderProc))dlsym(handle, "WelsCreateDecoder");
+    log.assert_quit(CreateDecoderProc != nullptr, "Failed to load WelsCreateDecoder!");
+
+    DestroyDecoderProc = (decltype(DestroyDecoderProc))dlsym(handle, "WelsDestroyDecoder");
+    log.assert_quit(DestroyDecoderProc != nullptr, "Failed to load WelsDestroyDecoder!");
+
+    GetCodecVersionProc = (decltype(GetCodecVersionProc))dlsym(handle, "WelsGetCodecVersion");
+    log.assert_quit(GetCodecVersionProc != nullptr, "Failed to load WelsGetCodecVersion!");
+
+    GetCodecVersionExProc = (decltype(GetCodecVersionExProc))dlsym(handle, "WelsGetCodecVersionEx");
+    log.assert_quit(GetCodecVersionExProc != nullptr, "Failed to load WelsGetCodecVersionEx!");
+
+    checkVersion();
+
+    ready.store(true, std::memory_order_release);
+}
+
+bool OpenH264LoaderPosix::isReady() const {
+    return ready.load(std::memory_order_acquire);
+}
+
+int OpenH264LoaderPosix::CreateSVCEncoder(ISVCEncoder **ppEncoder) const {
+    return CreateSVCEncoderProc(ppEncoder);
+}
+
+void OpenH264LoaderPosix::DestroySVCEncoder(ISVCEncoder *pEncoder) const {
+    return DestroySVCEncoderProc(pEncoder);
+}
+
+long OpenH264LoaderPosix::CreateDecoder(ISVCDecoder **ppDecoder) const {
+    return CreateDecoderProc(ppDecoder);
+}
+
+void OpenH264LoaderPosix::DestroyDecoder(ISVCDecoder *pDecoder) const {
+    return DestroyDecoderProc(pDecoder);
+}
+
+OpenH264Version OpenH264LoaderPosix::GetCodecVersion(void) const {
+    return GetCodecVersionProc();
+}
+
+void OpenH264LoaderPosix::GetCodecVersionEx(OpenH264Version *pVersion) const {
+    return GetCodecVersionExProc(pVersion);
+}
@@ -0,0 +1,43 @@
+#ifndef TWILIGHT_COMMON_PLATFORM_POSIX_OPENH264LOADERPOSIX_H
+#define TWILIGHT_COMMON_PLATFORM_POSIX_OPENH264LOADERPOSIX_H
+
+#include <atomic>
+
+#include <common/log.h>
+#include <common/platform/software/OpenH264Loader.h>
+
+class OpenH264LoaderPosix : public OpenH264Loader {
+public:
+    OpenH264LoaderPosix();
+    ~OpenH264LoaderPosix();
+
+    void prepare() override;
+    bool isReady() const override;
+
+    int CreateSVCEncoder(ISVCEncoder **ppEncoder) const override;
+    void DestroySVCEncoder(ISVCEncoder *pEncoder) const override;
+
+    long CreateDecoder(ISVCDecoder **ppDecoder) const override;
+    void DestroyDecoder(ISVCDecoder *pDecoder) const override;
+
+    OpenH264Version GetCodecVersion(void) const override;
+    void GetCodecVersionEx(OpenH264Version *pVersion) const override;
+
+private:
+    static NamedLogger log;
+
+    std::atomic<bool> ready = false;
+
+    void *handle = nullptr;
+
+    int (*CreateSVCEncoderProc)(ISVCEncoder **ppEncoder) = nullptr;
+    void (*DestroySVCEncoderProc)(ISVCEncoder *pEncoder) = nullptr;
+
+    long (*CreateDecoderProc)(ISVCDecoder **ppDecoder) = nullptr;
+    void (*DestroyDecoderProc)(ISVCDecoder *pDecoder) = nullptr;
+
+    OpenH264Version (*GetCodecVersionProc)(void) = nullptr;
+    void (*GetCodecVersionExProc)(OpenH264Version *pVersion) = nullptr;
+};
+
+#endif
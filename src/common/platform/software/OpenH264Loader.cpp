@@ -4,6 +4,10 @@
 
 #ifdef WIN32
 #include "common/platform/windows/OpenH264LoaderWin32.h"
+using OpenH264LoaderNative = OpenH264LoaderWin32;
+#elif defined(__unix__)
+#include "common/platform/posix/OpenH264LoaderPosix.h"
+using OpenH264LoaderNative = OpenH264LoaderPosix;
 #else
 #error OpenH264 Unsupported platform
 #endif
@@ -30,7 +34,7 @@ std::shared_ptr<OpenH264Loader> OpenH264Loader::getInstance() {
     if (ptr != nullptr)
         return ptr;
 
-    ptr = std::make_shared<OpenH264LoaderWin32>();
+    ptr = std::make_shared<OpenH264LoaderNative>();
     instance = ptr;
     return ptr;
 }
@@ -63,6 +63,15 @@ TextureSoftware ScaleSoftware::popOutput() {
     return outputTex.clone(outputArena);
 }
 
+const TextureSoftware& ScaleSoftware::peekOutput() {
+    log.assert_quit(hasTexture, "Tried to peek output when empty");
+
+    if (dirty)
+        convert_();
+
+    return outputTex;
+}
+
 void ScaleSoftware::flush() {
     if (dirty)
         convert_();
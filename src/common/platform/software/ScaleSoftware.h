@@ -22,6 +22,9 @@ public:
     void pushInput(TextureSoftware &&tex);
     TextureSoftware popOutput();
 
+    // Converted output without copying it. Valid until the next pushInput() or format change.
+    const TextureSoftware &peekOutput();
+
     void flush();
 
 private:
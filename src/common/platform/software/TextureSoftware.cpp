@@ -63,7 +63,7 @@ TextureSoftware &TextureSoftware::operator=(TextureSoftware &&move) noexcept {
     return *this;
 }
 
-TextureSoftware TextureSoftware::reference(uint8_t **data, const int *linesize, int w, int h, AVPixelFormat fmt) {
+TextureSoftware TextureSoftware::reference(uint8_t *const *data, const int *linesize, int w, int h, AVPixelFormat fmt) {
     TextureSoftware self;
 
     self.width = w;
@@ -22,7 +22,7 @@ public:
     TextureSoftware &operator=(const TextureSoftware &copy) = delete;
     TextureSoftware &operator=(TextureSoftware &&move) noexcept;
 
-    static TextureSoftware reference(uint8_t **data, const int *linesize, int w, int h, AVPixelFormat fmt);
+    static TextureSoftware reference(uint8_t *const *data, const int *linesize, int w, int h, AVPixelFormat fmt);
 
     TextureSoftware clone(TextureAllocArena *targetArena) const;
     TextureSoftware clone(TextureAllocArena &targetArena) const { return clone(&targetArena); }
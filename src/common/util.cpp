@@ -1,8 +1,16 @@
 #include "util.h"
 
+#ifdef WIN32
+#include "common/platform/windows/winheaders.h"
+#else
+#include <time.h>
+#endif
+
 #include <mbedtls/sha256.h>
 
+#include <cerrno>
 #include <cstdio>
+#include <thread>
 
 std::optional<ByteBuffer> loadEntireFile(const char *path) {
     std::optional<ByteBuffer> ret;
@@ -58,6 +66,59 @@ bool writeByteBuffer(const char *filename, const ByteBuffer &data) {
     return offset == data.size();
 }
 
+std::chrono::microseconds threadCpuTime() {
+#ifdef WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return std::chrono::microseconds(0);
+
+    // In 100ns unit
+    uint64_t kernelTime = (static_cast<uint64_t>(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+    uint64_t userTime = (static_cast<uint64_t>(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+    return std::chrono::microseconds((kernelTime + userTime) / 10);
+#else
+    timespec ts = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::microseconds(ts.tv_sec * 1'000'000LL + ts.tv_nsec / 1000);
+#endif
+}
+
+void sleepUntil(std::chrono::steady_clock::time_point deadline) {
+#ifdef WIN32
+    // Sleep() wakes up on scheduler ticks, which are 1 ms at best. A high resolution timer doesn't.
+    // One timer is kept for each thread that sleeps, for as long as the process lives.
+    thread_local HANDLE timer =
+        CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+    auto remaining = deadline - std::chrono::steady_clock::now();
+    if (remaining <= std::chrono::steady_clock::duration::zero())
+        return;
+
+    if (timer != nullptr) {
+        using Ticks = std::chrono::duration<long long, std::ratio<1, 10'000'000>>;
+
+        // Negative for relative time, in 100ns unit
+        LARGE_INTEGER due;
+        due.QuadPart = -std::chrono::duration_cast<Ticks>(remaining).count();
+        if (SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE)) {
+            WaitForSingleObject(timer, INFINITE);
+            return;
+        }
+    }
+
+    // Timer is not available before Windows 10 1803
+    std::this_thread::sleep_until(deadline);
+#else
+    // steady_clock is CLOCK_MONOTONIC, so the deadline is given as is rather than as a relative sleep
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    timespec ts = {};
+    ts.tv_sec = ns / 1'000'000'000;
+    ts.tv_nsec = ns % 1'000'000'000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+#endif
+}
+
 bool secureMemcmp(const void *a, const void *b, size_t bytes) {
     const volatile unsigned char *pa = reinterpret_cast<const volatile unsigned char *>(a);
     const volatile unsigned char *pb = reinterpret_cast<const volatile unsigned char *>(b);
@@ -76,3 +137,12 @@ ByteBuffer hashBytesSHA256(const ByteBuffer &raw) {
         abort();  // Unlikely to happen
     return ret;
 }
+
+uint64_t hashBytesFNV1a(const void *data, size_t len, uint64_t hash) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -1,7 +1,12 @@
 #ifndef TWILIGHT_COMMON_UTIL_H
 #define TWILIGHT_COMMON_UTIL_H
 
+#include <immintrin.h>
+
 #include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
 #include <optional>
 #include <string>
 #include <type_traits>
@@ -17,6 +22,15 @@ bool writeByteBuffer(const char *filename, const ByteBuffer &data);
 
 ByteBuffer hashBytesSHA256(const ByteBuffer &raw);
 
+// Fast non-cryptographic hash (64-bit FNV-1a). Chain calls by passing previous result as `hash`.
+uint64_t hashBytesFNV1a(const void *data, size_t len, uint64_t hash = 0xcbf29ce484222325ULL);
+
+// CPU time (user and kernel) the calling thread has spent so far
+std::chrono::microseconds threadCpuTime();
+
+// Sleeps until the absolute deadline, with sub-millisecond precision where the OS allows
+void sleepUntil(std::chrono::steady_clock::time_point deadline);
+
 // Returns true if equals
 bool secureMemcmp(const void *a, const void *b, size_t bytes);
 
@@ -1,6 +1,10 @@
 #ifndef TWILIGHT_COMMON_VERSION_H
 #define TWILIGHT_COMMON_VERSION_H
 
+#include <cstdint>
+
+// Server and client must have the same version. Bump on any incompatible change of the wire format.
+constexpr int32_t PROTOCOL_VERSION = 3;
 
 extern const char GIT_COMMIT[];
 extern const long long GIT_DATE;
@@ -1,16 +1,29 @@
 #include "AudioEncoder.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
 TWILIGHT_DEFINE_LOGGER(AudioEncoder);
 
-AudioEncoder::AudioEncoder() : cap(std::make_unique<AudioCaptureWASAPI>()) {
+AudioEncoder::AudioEncoder(LocalClock& clock_, std::unique_ptr<IAudioCapture> capture)
+    : clock(clock_),
+      cap(std::move(capture)),
+      frameSize(960),
+      lookahead(0),
+      writtenFrames(0),
+      readFrames(0),
+      metricPackets(MetricsRegistry::global().counter("twilight_audio_packets_total", "Opus packets encoded")),
+      metricBytes(MetricsRegistry::global().counter("twilight_audio_bytes_total", "Opus bytes encoded")),
+      metricBuffered(MetricsRegistry::global().gauge("twilight_audio_buffered_seconds",
+                                                     "Resampled audio waiting to be encoded")) {
     cap->setOnConfigured([this](AVSampleFormat fmt, int sr, int ch) {
         samplingRate = sr;
         channels = ch;
-
-        if (fmt != AV_SAMPLE_FMT_FLT)
-            log.error("Some code assumes float input");
+        bytesPerFrame = av_get_bytes_per_sample(fmt) * ch;
 
         log.assert_quit(ch == 1 || ch == 2, "Unsupported audio channel count: {}", ch);
+        log.assert_quit(0 < bytesPerFrame && !av_sample_fmt_is_planar(fmt), "Unsupported sample format: {}", fmt);
 
         int64_t layout = channels == 1 ? AV_CH_LAYOUT_MONO : AV_CH_LAYOUT_STEREO;
 
@@ -19,23 +32,50 @@ AudioEncoder::AudioEncoder() : cap(std::make_unique<AudioCaptureWASAPI>()) {
         swr_init(swrCtx);
 
         int err;
-        enc = opus_encoder_create(48000, 2, OPUS_APPLICATION_AUDIO, &err);
+        int application = config.lowDelay ? OPUS_APPLICATION_RESTRICTED_LOWDELAY : OPUS_APPLICATION_AUDIO;
+        enc = opus_encoder_create(48000, CHANNELS, application, &err);
         log.assert_quit(enc != nullptr && err == OPUS_OK, "Failed to create opus encoder");
+
+        if (config.bitrate > 0)
+            opus_encoder_ctl(enc, OPUS_SET_BITRATE(config.bitrate));
+        opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(config.fec ? 1 : 0));
+        opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(config.expectedLossPercent));
+        opus_encoder_ctl(enc, OPUS_SET_DTX(config.dtx ? 1 : 0));
+        opus_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(&lookahead));
     });
     cap->setOnAudioData([this](const uint8_t* data, size_t len) {
-        // FIXME: Assumes input to be float
-        std::lock_guard lock(bufferLock);
-        int maxOutput = swr_get_out_samples(swrCtx, len / channels / sizeof(float));
-        ByteBuffer& now = buffer.emplace_back(maxOutput * channels * sizeof(float));
-
-        uint8_t* outPtr = now.data();
-        int stat = swr_convert(swrCtx, &outPtr, maxOutput, &data, len / channels / sizeof(float));
-        log.assert_quit(0 <= stat, "Failed to call swr_convert");
-        if (stat != maxOutput) {
-            // log->warn("Resizing output buffer");
-            now.resize(stat * channels * sizeof(float));
+        // Last input sample was captured just now
+        const long long timeNow = clock.time().count();
+        int inputFrames = len / bytesPerFrame;
+
+        // Resample directly into the ring. Input that doesn't fit before wrap around is kept by swr.
+        while (true) {
+            size_t writable;
+            uint8_t* outPtr = reinterpret_cast<uint8_t*>(buffer.beginWrite(&writable));
+            int maxOutput = writable / CHANNELS;
+            if (maxOutput == 0)
+                break;
+
+            int stat = swr_convert(swrCtx, &outPtr, maxOutput, &data, inputFrames);
+            log.assert_quit(0 <= stat, "Failed to call swr_convert");
+            buffer.endWrite(stat * CHANNELS);
+            writtenFrames += stat;
+
+            inputFrames = 0;
+            if (stat < maxOutput)
+                break;
+        }
+
+        // Worker can't keep up if this is full; then there is no point to timestamp anything precisely
+        anchors.write(TimeAnchor{writtenFrames, timeNow - swr_get_delay(swrCtx, 1'000'000)});
+
+        if ((size_t)frameSize * CHANNELS <= decltype(buffer)::SIZE - buffer.available()) {
+            // Taking the lock makes sure the worker is either waiting already or will see the new data
+            /* lock */ {
+                std::lock_guard lock(bufferLock);
+            }
+            bufferLockCV.notify_one();
         }
-        bufferLockCV.notify_one();
     });
 }
 
@@ -44,6 +84,32 @@ AudioEncoder::~AudioEncoder() {
         workerThread.join();
 }
 
+void AudioEncoder::setConfig(const Config& newConfig) {
+    config = newConfig;
+
+    // Opus only accepts these durations
+    const int durations[] = {2500, 5000, 10'000, 20'000, 40'000, 60'000};
+    int bestDuration = durations[0];
+    for (int now : durations) {
+        if (std::abs(now - config.frameDuration) < std::abs(bestDuration - config.frameDuration))
+            bestDuration = now;
+    }
+    config.frameDuration = bestDuration;
+
+    // FEC is a SILK feature, which restricted low delay mode never uses
+    if (config.lowDelay || config.frameDuration < 10'000)
+        config.fec = false;
+
+    config.bitrate = config.bitrate <= 0 ? 0 : std::clamp(config.bitrate, 6000, MAX_BITRATE);
+    config.expectedLossPercent = std::clamp(config.expectedLossPercent, 0, 100);
+
+    frameSize = 48000 / 100 * config.frameDuration / 10'000;
+
+    log.info("Audio config: {}, {:.1f} ms frame, bitrate {}, FEC {}, DTX {}",
+             config.lowDelay ? "restricted low delay" : "audio", config.frameDuration / 1000.0f, config.bitrate,
+             config.fec, config.dtx);
+}
+
 void AudioEncoder::start() {
     int stat;
 
@@ -53,6 +119,11 @@ void AudioEncoder::start() {
     if (workerThread.joinable())
         workerThread.join();
 
+    buffer.reset();
+    anchors.reset();
+    writtenFrames = 0;
+    readFrames = 0;
+
     flagRun.store(true, std::memory_order_release);
     workerThread = std::thread(&AudioEncoder::runWorker_, this);
 
@@ -62,59 +133,72 @@ void AudioEncoder::start() {
 void AudioEncoder::stop() {
     cap->stop();
 
-    flagRun.store(false, std::memory_order_release);
+    /* lock */ {
+        std::lock_guard lock(bufferLock);
+        flagRun.store(false, std::memory_order_release);
+    }
     bufferLockCV.notify_all();
-    // workerThread.join();
-    // Can't join here because workerThread may be the one calling stop; I don't like it
 
-    buffer.clear();
+    // Worker may still be encoding with enc, or reading the ring
+    log.assert_quit(std::this_thread::get_id() != workerThread.get_id(), "Can't be stopped from its own callback");
+    if (workerThread.joinable())
+        workerThread.join();
+
     swr_free(&swrCtx);
     opus_encoder_destroy(enc);
     enc = nullptr;
 }
 
 void AudioEncoder::runWorker_() {
-    const int frameSize = 960;
-    // FIXME: Assuming stereo
-    ByteBuffer buf(frameSize * sizeof(float) * 2);
-    int writeIdx = 0;
+    const size_t frameLen = frameSize * CHANNELS;
+
+    // Only used when a frame wraps around the ring
+    ByteBuffer staging(frameLen * sizeof(float));
 
     // constrain max bitrate
-    ByteBuffer output(256'000 / 8 * 20 / 1000);
+    ByteBuffer output(std::max(MAX_BITRATE / 8 * config.frameDuration / 1'000'000, 64));
 
-    memset(buf.data(), 0, buf.size());
+    bool hasAnchor = false;
+    TimeAnchor anchor = {};
 
     while (flagRun.load(std::memory_order_acquire)) {
-        ByteBuffer curr;
+        size_t readable;
+        const float* pcm = buffer.beginRead(&readable);
+
+        // Positions map linearly to time, so the newest anchor is good enough for any frame
+        while (anchors.read(&anchor))
+            hasAnchor = true;
+
+        std::chrono::microseconds timeCaptured(0);
+        if (hasAnchor) {
+            // Decoded output of a packet is delayed by encoder lookahead
+            long long frames = static_cast<long long>(anchor.pos - readFrames) + lookahead;
+            timeCaptured = std::chrono::microseconds(anchor.time - frames * 1'000'000 / 48000);
+        }
 
-        /* lock */ {
+        if (frameLen <= readable) {
+            encode_(pcm, output, timeCaptured);
+            buffer.endRead(frameLen);
+            readFrames += frameSize;
+        } else if (frameLen <= buffer.size()) {
+            buffer.read(reinterpret_cast<float*>(staging.data()), frameLen);
+            encode_(reinterpret_cast<float*>(staging.data()), output, timeCaptured);
+            readFrames += frameSize;
+        } else {
             std::unique_lock lock(bufferLock);
-            while (buffer.empty() && flagRun.load(std::memory_order_acquire))
+            while (buffer.size() < frameLen && flagRun.load(std::memory_order_acquire))
                 bufferLockCV.wait(lock);
-
-            if (!buffer.empty()) {
-                curr = std::move(buffer.front());
-                buffer.pop_front();
-            } else {
-                // flag run is now false
-                break;
-            }
-        }
-
-        int readIdx = 0;
-        while (readIdx < curr.size()) {
-            int readAmount = std::min(curr.size() - readIdx, buf.size() - writeIdx);
-            memcpy(buf.data() + writeIdx, curr.data() + readIdx, readAmount);
-            readIdx += readAmount;
-            writeIdx += readAmount;
-
-            if (writeIdx == buf.size()) {
-                writeIdx = 0;
-                int stat = opus_encode_float(enc, reinterpret_cast<float*>(buf.data()), frameSize, output.data(),
-                                             output.size());
-                log.assert_quit(0 <= stat, "Failed to call opus_encode_float");
-                onAudioData(output.data(), stat);
-            }
         }
     }
 }
+
+void AudioEncoder::encode_(const float* pcm, ByteBuffer& output, std::chrono::microseconds timeCaptured) {
+    int stat = opus_encode_float(enc, pcm, frameSize, output.data(), output.size());
+    log.assert_quit(0 <= stat, "Failed to call opus_encode_float");
+
+    metricPackets.add();
+    metricBytes.add(stat);
+    metricBuffered.set(static_cast<double>(buffer.size() / CHANNELS) / 48000);
+
+    onAudioData(output.data(), stat, timeCaptured);
+}
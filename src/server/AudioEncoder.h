@@ -2,21 +2,33 @@
 #define TWILIGHT_SERVER_AUDIOENCODER_H
 
 #include "common/ByteBuffer.h"
+#include "common/Metrics.h"
+#include "common/SpscRingBuffer.h"
 #include "common/ffmpeg-headers.h"
 #include "common/log.h"
 
-#include "server/platform/windows/AudioCaptureWASAPI.h"
+#include "server/IAudioCapture.h"
+#include "server/LocalClock.h"
 
 #include <opus.h>
 
+#include <chrono>
 #include <condition_variable>
-#include <deque>
 #include <memory>
 #include <mutex>
 
 class AudioEncoder {
 public:
-    AudioEncoder();
+    struct Config {
+        bool lowDelay = false;        //< Use OPUS_APPLICATION_RESTRICTED_LOWDELAY
+        int frameDuration = 20'000;   //< In microseconds
+        int bitrate = 0;              //< In bits per second. 0 for opus default
+        bool fec = false;             //< In-band FEC
+        int expectedLossPercent = 0;  //< Hint for FEC
+        bool dtx = false;
+    };
+
+    AudioEncoder(LocalClock& clock, std::unique_ptr<IAudioCapture> capture);
     ~AudioEncoder();
 
     template <class Fn>
@@ -24,29 +36,58 @@ public:
         onAudioData = std::move(fn);
     }
 
+    // Takes effect on next start(). Unsupported values are replaced with nearest supported one.
+    void setConfig(const Config& newConfig);
+    Config getConfig() const { return config; }
+
     void start();
     void stop();
 
 private:
+    static constexpr int CHANNELS = 2;
+    static constexpr int MAX_BITRATE = 256'000;
+
     static NamedLogger log;
 
+    // Capture time of the ring position `pos`, counted in frames since start()
+    struct TimeAnchor {
+        uint64_t pos;
+        long long time;
+    };
+
+    LocalClock& clock;
     std::atomic<bool> flagRun;
 
-    std::unique_ptr<AudioCaptureWASAPI> cap;
+    std::unique_ptr<IAudioCapture> cap;
     std::thread workerThread;
 
-    std::function<void(const uint8_t*, size_t)> onAudioData;  // (data, len)
+    std::function<void(const uint8_t*, size_t, std::chrono::microseconds)> onAudioData;  // (data, len, timeCaptured)
 
     SwrContext* swrCtx = nullptr;
     OpusEncoder* enc = nullptr;
 
+    Config config;
+    int frameSize;
+    int lookahead;
+
+    // Only used to sleep and wake up the worker; data itself is passed through the ring without locking
     std::mutex bufferLock;
     std::condition_variable bufferLockCV;
-    std::deque<ByteBuffer> buffer;
+    SpscRingBuffer<float, 48000 * CHANNELS / 2> buffer;
     int samplingRate;
     int channels;
+    int bytesPerFrame;
+
+    SpscRingBuffer<TimeAnchor, 64> anchors;
+    uint64_t writtenFrames;  // Capture side only
+    uint64_t readFrames;     // Worker only
+
+    MetricCounter& metricPackets;
+    MetricCounter& metricBytes;
+    MetricGauge& metricBuffered;
 
     void runWorker_();
+    void encode_(const float* pcm, ByteBuffer& output, std::chrono::microseconds timeCaptured);
 };
 
 #endif
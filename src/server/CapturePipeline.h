@@ -5,35 +5,74 @@
 #include "common/DesktopFrame.h"
 #include "common/Rational.h"
 
+#include <chrono>
 #include <functional>
 #include <string>
 #include <vector>
 
+// Output settings of an encoder branch
+struct EncoderConfig {
+    int width = 0;
+    int height = 0;
+    Rational framerate;
+    int bitrate = 0;                   //< In bits per second. 0 for encoder default
+    bool noPeriodicKeyframes = false;  //< Only requested keyframes, which are kept small
+    bool chroma444 = false;            //< VP9 in 4:4:4, until falling back to 4:2:0 if it can't keep up
+
+    bool operator==(const EncoderConfig& other) const {
+        return width == other.width && height == other.height && bitrate == other.bitrate &&
+               noPeriodicKeyframes == other.noPeriodicKeyframes && chroma444 == other.chroma444 &&
+               static_cast<long long>(framerate.num()) * other.framerate.den() ==
+                   static_cast<long long>(other.framerate.num()) * framerate.den();
+    }
+    bool operator!=(const EncoderConfig& other) const { return !(*this == other); }
+};
+
+// One capture feeding any number of branches, each with its own scaler and encoder.
 class CapturePipeline {
 public:
+    using OutputFn = std::function<void(DesktopFrame<ByteBuffer>&&)>;
+
     CapturePipeline() = default;
     CapturePipeline(const CapturePipeline& copy) = delete;
     CapturePipeline(CapturePipeline&& move) = delete;
 
     virtual ~CapturePipeline() = default;
 
+    // Called from the capture thread as soon as the cursor moves, bypassing scaler and encoder
     template <typename Fn>
-    void setOutputCallback(Fn fn) {
-        writeOutput = std::move(fn);
+    void setCursorCallback(Fn fn) {
+        writeCursor = std::move(fn);
     }
 
     virtual bool init() = 0;
 
+    // Starts capturing. Frames only flow to branches added by addBranch().
     virtual void start() = 0;
     virtual void stop() = 0;
 
     virtual void getNativeMode(int* width, int* height, Rational* framerate) = 0;
 
     virtual bool setCaptureMode(int width, int height, Rational framerate) = 0;
-    virtual bool setEncoderMode(int width, int height, Rational framerate) = 0;
+
+    // Whether branches can be added with EncoderConfig::chroma444
+    virtual bool supportsChroma444() const { return false; }
+
+    // Can be called whether running or not. Encoded frames are given to `output` from a thread of the pipeline,
+    // never concurrently for the same branch. Returns id of the new branch, or 0 if no more branches are supported.
+    virtual size_t addBranch(const EncoderConfig& config, OutputFn output) = 0;
+
+    // `output` of the branch is never called after this returns
+    virtual void removeBranch(size_t id) = 0;
+
+    // CPU time spent to scale and encode for the branch so far
+    virtual std::chrono::microseconds getBranchCpuTime(size_t id) = 0;
+
+    // Makes the next encoded frame of the branch an IDR frame. Safe to call from any thread.
+    virtual void requestKeyframe(size_t id) = 0;
 
 protected:
-    std::function<void(DesktopFrame<ByteBuffer>&&)> writeOutput;
+    std::function<void(const CursorPos&)> writeCursor;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -5,10 +5,31 @@
 
 #include "server/StreamServer.h"
 
+#include <algorithm>
+
 TWILIGHT_DEFINE_LOGGER(Connection);
 
-// FIXME: Deduplicate
-static constexpr int PROTOCOL_VERSION = 2;
+static AudioEncoder::Config audioConfigFromMsg(const msg::AudioConfig& m) {
+    AudioEncoder::Config ret;
+    ret.lowDelay = m.application() == msg::AudioConfig_Application_RESTRICTED_LOWDELAY;
+    if (m.frame_duration() > 0)
+        ret.frameDuration = m.frame_duration();
+    ret.bitrate = m.bitrate();
+    ret.fec = m.fec();
+    ret.expectedLossPercent = m.expected_loss_percent();
+    ret.dtx = m.dtx();
+    return ret;
+}
+
+static void audioConfigToMsg(const AudioEncoder::Config& config, msg::AudioConfig* m) {
+    m->set_application(config.lowDelay ? msg::AudioConfig_Application_RESTRICTED_LOWDELAY
+                                       : msg::AudioConfig_Application_AUDIO);
+    m->set_frame_duration(config.frameDuration);
+    m->set_bitrate(config.bitrate);
+    m->set_fec(config.fec);
+    m->set_expected_loss_percent(config.expectedLossPercent);
+    m->set_dtx(config.dtx);
+}
 
 // Deduplicate with StreamClient.cpp
 // Returns negative on error (mbedtls error code)
@@ -61,7 +82,13 @@ struct AuthState {
 };
 
 Connection::Connection(StreamServer* parent, std::unique_ptr<NetworkSocket>&& sock_)
-    : server(parent), sock(std::move(sock_)), authorized(false), streaming(false) {
+    : server(parent),
+      sock(std::move(sock_)),
+      authorized(false),
+      streaming(false),
+      metricSendFailures(MetricsRegistry::global().counter("twilight_connection_send_failures_total",
+                                                           "Packets that failed to be sent to a client")) {
+    MetricsRegistry::global().counter("twilight_connections_accepted_total", "Accepted client connections").add();
     runThread = std::thread([this] { run_(); });
 }
 
@@ -79,14 +106,30 @@ void Connection::disconnect() {
     sock->disconnect();
 }
 
+bool Connection::sendCursorShape(msg::Packet& pkt, uint64_t id, const ByteBuffer& image) {
+    msg::CursorShape* m = pkt.mutable_cursor_shape();
+    m->set_id(id);
+
+    if (cursorCache.find(id)) {
+        m->set_cached(true);
+        pkt.set_extra_data_len(0);
+        return send(pkt, nullptr);
+    }
+
+    cursorCache.insert(id, nullptr);
+    m->set_cached(false);
+    pkt.set_extra_data_len(image.size());
+    return send(pkt, image);
+}
+
 void Connection::run_() {
     sock->setExpectedRemoteCert(server->listKnownClients());
     authorized = sock->verifyCert();
 
-    msg::Packet pkt;
     ByteBuffer data;
 
     while (sock->isConnected()) {
+        msg::Packet& pkt = recvArena.next();
         if (!sock->recv(&pkt, &data))
             continue;
 
@@ -112,6 +155,9 @@ void Connection::run_() {
         case msg::Packet::kStopStreamRequest:
             msg_stopStreamRequest_(pkt.stop_stream_request());
             break;
+        case msg::Packet::kKeyframeRequest:
+            msg_keyframeRequest_(pkt.keyframe_request());
+            break;
         case msg::Packet::kAuthRequest:
             msg_authRequest_(pkt.auth_request(), data);
             break;
@@ -128,7 +174,7 @@ void Connection::run_() {
 }
 
 void Connection::msg_clientIntro_(const msg::ClientIntro& req) {
-    msg::Packet pkt;
+    msg::Packet& pkt = replyArena.next();
     pkt.set_extra_data_len(0);
 
     auto* res = pkt.mutable_server_intro();
@@ -150,7 +196,7 @@ void Connection::msg_pingRequest_(const msg::PingRequest& req) {
     if (!authorized)
         return;
 
-    msg::Packet pkt;
+    msg::Packet& pkt = replyArena.next();
     pkt.set_extra_data_len(0);
 
     if (req.latency() != 0)
@@ -163,7 +209,7 @@ void Connection::msg_pingRequest_(const msg::PingRequest& req) {
 }
 
 void Connection::msg_queryHostCapsRequest_(const msg::QueryHostCapsRequest& req) {
-    msg::Packet pkt;
+    msg::Packet& pkt = replyArena.next();
     pkt.set_extra_data_len(0);
 
     auto* res = pkt.mutable_query_host_caps_response();
@@ -199,7 +245,7 @@ void Connection::msg_queryHostCapsRequest_(const msg::QueryHostCapsRequest& req)
 }
 
 void Connection::msg_configureStreamRequest_(const msg::ConfigureStreamRequest& req) {
-    msg::Packet pkt;
+    msg::Packet& pkt = replyArena.next();
     pkt.set_extra_data_len(0);
 
     auto* res = pkt.mutable_configure_stream_response();
@@ -228,22 +274,29 @@ void Connection::msg_configureStreamRequest_(const msg::ConfigureStreamRequest&
         return;
     }
 
-    server->configureStream(this, req.width(), req.height(), Rational(req.fps_num(), req.fps_den()));
+    streamConfig.width = req.width();
+    streamConfig.height = req.height();
+    streamConfig.framerate = Rational(req.fps_num(), req.fps_den());
+    streamConfig.bitrate = std::max(0, req.video_bitrate());
+    streamConfig.noPeriodicKeyframes = req.no_periodic_keyframes();
+    streamConfig.chroma444 = req.chroma444() && server->canEncodeChroma444();
+
+    server->configureStream(this, audioConfigFromMsg(req.audio()));
     res->set_status(msg::ConfigureStreamResponse_Status_OK);
     int capWidth, capHeight;
-    int videoWidth, videoHeight;
     server->getCaptureResolution(&capWidth, &capHeight);
-    server->getVideoResolution(&videoWidth, &videoHeight);
 
     res->set_capture_width(capWidth);
     res->set_capture_height(capHeight);
-    res->set_video_width(videoWidth);
-    res->set_video_height(videoHeight);
+    res->set_video_width(streamConfig.width);
+    res->set_video_height(streamConfig.height);
+    res->set_chroma444(streamConfig.chroma444);
+    audioConfigToMsg(server->getAudioConfig(), res->mutable_audio());
     send(pkt, nullptr);
 }
 
 void Connection::msg_startStreamRequest_(const msg::StartStreamRequest& req) {
-    msg::Packet pkt;
+    msg::Packet& pkt = replyArena.next();
     pkt.set_extra_data_len(0);
 
     auto* res = pkt.mutable_start_stream_response();
@@ -254,7 +307,13 @@ void Connection::msg_startStreamRequest_(const msg::StartStreamRequest& req) {
         return;
     }
 
-    bool success = server->startStream(this);
+    if (streamConfig.width <= 0) {
+        res->set_status(msg::StartStreamResponse_Status_INAVLID_CONFIGURATION);
+        send(pkt, nullptr);
+        return;
+    }
+
+    bool success = !streaming && server->startStream(this, streamConfig);
     if (success)
         streaming = true;
 
@@ -264,8 +323,9 @@ void Connection::msg_startStreamRequest_(const msg::StartStreamRequest& req) {
 
 void Connection::msg_stopStreamRequest_(const msg::StopStreamRequest& req) {
     server->endStream(this);
+    streaming = false;
 
-    msg::Packet pkt;
+    msg::Packet& pkt = replyArena.next();
     pkt.set_extra_data_len(0);
 
     auto* res = pkt.mutable_stop_stream_response();
@@ -273,9 +333,17 @@ void Connection::msg_stopStreamRequest_(const msg::StopStreamRequest& req) {
     send(pkt, nullptr);
 }
 
+void Connection::msg_keyframeRequest_(const msg::KeyframeRequest& req) {
+    // Silently ignored like ping, as no reply is expected
+    if (!authorized || !streaming)
+        return;
+
+    server->requestKeyframe(this);
+}
+
 void Connection::msg_authRequest_(const msg::AuthRequest& req, const ByteBuffer& extraData) {
     int err;
-    msg::Packet pkt;
+    msg::Packet& pkt = replyArena.next();
 
     if (req.client_nonce_len() < 16) {
         log.error("Aborting authentication because client nonce is too short");
@@ -339,7 +407,7 @@ void Connection::msg_authRequest_(const msg::AuthRequest& req, const ByteBuffer&
 
 void Connection::msg_clientNonceNotify_(const msg::ClientNonceNotify& req, const ByteBuffer& extraData) {
     int err;
-    msg::Packet pkt;
+    msg::Packet& pkt = replyArena.next();
 
     if (authState == nullptr) {
         log.error("Received unexpected ClientNonceNotify packet");
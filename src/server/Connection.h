@@ -1,9 +1,14 @@
 #ifndef TWILIGHT_SERVER_CONNECTION_H
 #define TWILIGHT_SERVER_CONNECTION_H
 
+#include "common/CursorShapeCache.h"
+#include "common/Metrics.h"
 #include "common/log.h"
 
 #include "common/net/NetworkSocket.h"
+#include "common/net/PacketArena.h"
+
+#include "server/CapturePipeline.h"
 
 #include <chrono>
 #include <cstdint>
@@ -21,18 +26,28 @@ public:
 
     void disconnect();
 
-    bool send(const msg::Packet& pkt, const uint8_t* extraData) { return sock->send(pkt, extraData); }
-    bool send(const msg::Packet& pkt, const ByteBuffer& extraData) { return sock->send(pkt, extraData); }
+    bool send(const msg::Packet& pkt, const uint8_t* extraData) { return countFailure_(sock->send(pkt, extraData)); }
+    bool send(const msg::Packet& pkt, const ByteBuffer& extraData) { return countFailure_(sock->send(pkt, extraData)); }
+
+    // Omits the image if this client already has it. Only call from the thread sending video to this client.
+    bool sendCursorShape(msg::Packet& pkt, uint64_t id, const ByteBuffer& image);
 
 private:
     void run_();
 
+    bool countFailure_(bool sent) {
+        if (!sent)
+            metricSendFailures.add();
+        return sent;
+    }
+
     void msg_clientIntro_(const msg::ClientIntro& req);
     void msg_pingRequest_(const msg::PingRequest& req);
     void msg_queryHostCapsRequest_(const msg::QueryHostCapsRequest& req);
     void msg_configureStreamRequest_(const msg::ConfigureStreamRequest& req);
     void msg_startStreamRequest_(const msg::StartStreamRequest& req);
     void msg_stopStreamRequest_(const msg::StopStreamRequest& req);
+    void msg_keyframeRequest_(const msg::KeyframeRequest& req);
 
     void msg_authRequest_(const msg::AuthRequest& req, const ByteBuffer& extraData);
     void msg_clientNonceNotify_(const msg::ClientNonceNotify& req, const ByteBuffer& extraData);
@@ -45,8 +60,18 @@ private:
 
     std::thread runThread;
 
+    // Only used by runThread
+    PacketArena recvArena;
+    PacketArena replyArena;
+
+    // Mirrors the client side cache; Only ids are needed
+    CursorShapeCache cursorCache;
+
     bool authorized;
     bool streaming;
+    EncoderConfig streamConfig;  // Zero size until configured
+
+    MetricCounter& metricSendFailures;
 };
 
 #endif
@@ -0,0 +1,60 @@
+#include "FramePacer.h"
+
+#include <algorithm>
+
+FramePacer::FramePacer(LocalClock& clock)
+    : clock(clock),
+      framerate(60, 1),
+      idleInterval(0),
+      flagDamage(true),
+      startTime(clock.time()),
+      lastTaken(startTime),
+      nextTickIndex(0),
+      stat{0, 0},
+      metricSkipped(MetricsRegistry::global().counter("twilight_frame_pacer_skipped_ticks_total",
+                                                      "Frame ticks missed because the encoder was still busy")),
+      metricIdle(MetricsRegistry::global().counter("twilight_frame_pacer_idle_ticks_total",
+                                                   "Frame ticks not encoded because the desktop was unchanged")),
+      metricLateness(MetricsRegistry::global().histogram(
+          "twilight_frame_pacer_lateness_seconds", "Time from the deadline of a tick until it was taken", {},
+          {0.0001, 0.0002, 0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05})) {}
+
+void FramePacer::setFramerate(Rational framerate_) {
+    framerate = framerate_;
+    startTime = clock.time();
+    lastTaken = startTime;
+    nextTickIndex = 0;
+    stat = Stat{0, 0};
+    flagDamage.store(true, std::memory_order_relaxed);
+}
+
+bool FramePacer::poll() {
+    std::chrono::microseconds now = clock.time();
+    if (now < tickTime_(nextTickIndex))
+        return false;
+
+    // Take the latest tick which is due. Rounding may put it before the next one.
+    long long latest = framerate.imul((now - startTime).count()) / 1'000'000;
+    latest = std::max(latest, nextTickIndex);
+    while (tickTime_(latest + 1) <= now)
+        latest++;
+
+    metricSkipped.add(latest - nextTickIndex);
+    stat.ticks += latest + 1 - nextTickIndex;
+    stat.skipped += latest - nextTickIndex;
+    nextTickIndex = latest + 1;
+
+    bool damaged = flagDamage.exchange(false, std::memory_order_acquire);
+    if (idleInterval.count() > 0 && !damaged && now - lastTaken < idleInterval) {
+        metricIdle.add();
+        return false;
+    }
+
+    lastTaken = now;
+    metricLateness.observe(std::chrono::duration<double>(now - tickTime_(latest)).count());
+    return true;
+}
+
+std::chrono::microseconds FramePacer::tickTime_(long long index) const {
+    return startTime + std::chrono::microseconds(framerate.inv().imul(index * 1'000'000));
+}
@@ -0,0 +1,62 @@
+#ifndef TWILIGHT_SERVER_FRAMEPACER_H
+#define TWILIGHT_SERVER_FRAMEPACER_H
+
+#include "common/Metrics.h"
+#include "common/Rational.h"
+
+#include "server/LocalClock.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Decides when a frame should be encoded, on a fixed grid of ticks derived from the framerate.
+// Ticks are absolute, so being late for one tick doesn't delay the ones after it.
+// Not thread safe, except for markDamage().
+class FramePacer {
+public:
+    struct Stat {
+        uint64_t ticks;    //< Passed since setFramerate(), whether taken or not
+        uint64_t skipped;  //< Passed while the caller was busy
+    };
+
+    explicit FramePacer(LocalClock& clock);
+
+    // Restarts the grid of ticks from now. The first tick is due immediately.
+    void setFramerate(Rational framerate_);
+
+    // Nonzero to only take a tick if markDamage() was called since the last one, or if nothing was taken for
+    // this long. Zero (default) takes every tick.
+    void setIdleInterval(std::chrono::microseconds interval) { idleInterval = interval; }
+
+    // Safe to call from any thread
+    void markDamage() { flagDamage.store(true, std::memory_order_release); }
+
+    // Time of the next tick in LocalClock
+    std::chrono::microseconds nextTick() const { return tickTime_(nextTickIndex); }
+
+    // Returns true if a tick is due and should be encoded now. Ticks missed while the caller was busy are skipped
+    // rather than caught up.
+    bool poll();
+
+    Stat getStat() const { return stat; }
+
+private:
+    std::chrono::microseconds tickTime_(long long index) const;
+
+    LocalClock& clock;
+    Rational framerate;
+    std::chrono::microseconds idleInterval;
+    std::atomic<bool> flagDamage;
+
+    std::chrono::microseconds startTime;
+    std::chrono::microseconds lastTaken;
+    long long nextTickIndex;
+    Stat stat;
+
+    MetricCounter& metricSkipped;
+    MetricCounter& metricIdle;
+    MetricHistogram& metricLateness;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "IAudioCapture.h"
+
+#include "server/platform/software/AudioCaptureSynthetic.h"
+
+#ifdef WIN32
+#include "server/platform/windows/AudioCaptureWASAPI.h"
+#endif
+
+#include <cstdlib>
+#include <string>
+
+TWILIGHT_DEFINE_LOGGER(IAudioCapture);
+
+std::unique_ptr<IAudioCapture> IAudioCapture::createFromSpec_(std::string_view spec) {
+    if (spec.substr(0, 4) == "wav:") {
+        auto ret = std::make_unique<AudioCaptureSynthetic>(AudioCaptureSynthetic::Mode::SILENCE, AV_SAMPLE_FMT_FLT,
+                                                           48000, 2);
+        if (!ret->loadWav(std::string(spec.substr(4))))
+            log.error_quit("Failed to load audio source {}", spec);
+        return ret;
+    }
+
+    // kind[:rate[:format]]
+    std::string_view kind = spec.substr(0, spec.find(':'));
+    std::string_view rest = kind.size() < spec.size() ? spec.substr(kind.size() + 1) : std::string_view();
+    std::string_view rate = rest.substr(0, rest.find(':'));
+    std::string_view format = rate.size() < rest.size() ? rest.substr(rate.size() + 1) : std::string_view();
+
+    AudioCaptureSynthetic::Mode mode;
+    if (kind == "silence")
+        mode = AudioCaptureSynthetic::Mode::SILENCE;
+    else if (kind == "tone")
+        mode = AudioCaptureSynthetic::Mode::TONE;
+    else
+        log.error_quit("Unknown audio source {}", spec);
+
+    AVSampleFormat sampleFormat;
+    if (format.empty() || format == "flt")
+        sampleFormat = AV_SAMPLE_FMT_FLT;
+    else if (format == "s16")
+        sampleFormat = AV_SAMPLE_FMT_S16;
+    else if (format == "s32")
+        sampleFormat = AV_SAMPLE_FMT_S32;
+    else
+        log.error_quit("Unknown sample format {} (Expected s16, s32 or flt)", format);
+
+    int samplingRate = rate.empty() ? 48000 : atoi(std::string(rate).c_str());
+    return std::make_unique<AudioCaptureSynthetic>(mode, sampleFormat, samplingRate, 2);
+}
+
+std::unique_ptr<IAudioCapture> IAudioCapture::createInstance() {
+    const char* spec = getenv("TWILIGHT_AUDIO_SOURCE");
+    if (spec != nullptr && spec[0] != '\0') {
+        log.info("Using audio source {}", spec);
+        return createFromSpec_(spec);
+    }
+
+#ifdef WIN32
+    return std::make_unique<AudioCaptureWASAPI>();
+#else
+    log.warn("No system audio capture on this platform; Sending silence");
+    return createFromSpec_("silence");
+#endif
+}
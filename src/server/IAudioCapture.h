@@ -0,0 +1,48 @@
+#ifndef TWILIGHT_SERVER_IAUDIOCAPTURE_H
+#define TWILIGHT_SERVER_IAUDIOCAPTURE_H
+
+#include "common/ffmpeg-headers.h"
+#include "common/log.h"
+
+#include <functional>
+#include <memory>
+#include <string_view>
+
+class IAudioCapture {
+public:
+    IAudioCapture() = default;
+    IAudioCapture(const IAudioCapture& copy) = delete;
+    IAudioCapture(IAudioCapture&& move) = delete;
+
+    virtual ~IAudioCapture() = default;
+
+    // Called once from capture thread after start(), before any audio data
+    template <typename Fn>
+    void setOnConfigured(Fn fn) {
+        onConfigured = std::move(fn);
+    }
+
+    // Interleaved samples in format given to onConfigured
+    template <typename Fn>
+    void setOnAudioData(Fn fn) {
+        onAudioData = std::move(fn);
+    }
+
+    virtual void start() = 0;
+    virtual void stop() = 0;
+
+    // Uses source described by environment variable TWILIGHT_AUDIO_SOURCE if set, system audio otherwise.
+    // Format is one of: silence[:rate[:format]], tone[:rate[:format]], wav:<path>
+    static std::unique_ptr<IAudioCapture> createInstance();
+
+protected:
+    static NamedLogger log;
+
+    std::function<void(AVSampleFormat, int, int)> onConfigured;  // (format, samplingRate, channels)
+    std::function<void(const uint8_t*, size_t)> onAudioData;     // (data, len_bytes)
+
+private:
+    static std::unique_ptr<IAudioCapture> createFromSpec_(std::string_view spec);
+};
+
+#endif
@@ -1,9 +1,16 @@
 #include "LocalClock.h"
 
-LocalClock::LocalClock() : epoch(std::chrono::steady_clock::now()) {}
+static long long steadyClockNow() {
+    auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+}
+
+LocalClock::LocalClock() : LocalClock(&steadyClockNow) {}
+
+LocalClock::LocalClock(SteadyClockFn steadyNow_) : steadyNow(steadyNow_), epoch(steadyNow_()) {}
 
 LocalClock::~LocalClock() {}
 
 std::chrono::microseconds LocalClock::time() const {
-    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch);
+    return std::chrono::microseconds(steadyNow() - epoch);
 }
@@ -5,13 +5,24 @@
 
 class LocalClock {
 public:
+    // Returns a steady local time in microseconds
+    using SteadyClockFn = long long (*)();
+
     LocalClock();
+    // Reads local time from `steadyNow` instead of std::chrono::steady_clock, so that tests can simulate it
+    explicit LocalClock(SteadyClockFn steadyNow);
     ~LocalClock();
 
     std::chrono::microseconds time() const;
 
+    // Converts a value of time() into a point of steady_clock, e.g. to sleep until it
+    std::chrono::steady_clock::time_point toSteady(std::chrono::microseconds time) const {
+        return std::chrono::steady_clock::time_point(std::chrono::microseconds(epoch) + time);
+    }
+
 private:
-    std::chrono::steady_clock::time_point epoch;
+    SteadyClockFn steadyNow;
+    long long epoch;  // In steadyNow()
 };
 
 #endif
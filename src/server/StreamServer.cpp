@@ -4,13 +4,29 @@
 
 #include <mbedtls/sha256.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
 TWILIGHT_DEFINE_LOGGER(StreamServer);
 
 constexpr uint16_t SERVICE_PORT = 6495;
-constexpr int32_t PROTOCOL_VERSION = 1;
 
-StreamServer::StreamServer() : requestedWidth(0), requestedHeight(0), flagRunDeleter(true), streaming(false) {
+static bool chroma444FromEnv() {
+    const char* value = getenv("TWILIGHT_CHROMA444");
+    return value != nullptr && strcmp(value, "1") == 0;
+}
+
+StreamServer::StreamServer()
+    : flagRunDeleter(true),
+      streaming(false),
+      allowChroma444(chroma444FromEnv()),
+      tracer("server", 1),
+      audioEncoder(clock, IAudioCapture::createInstance()),
+      audioSequence(0),
+      metricConnections(MetricsRegistry::global().gauge("twilight_connections", "Connected clients")) {
     knownClients.loadFile("clients.toml");
+    tracer.startTrace();
 
     deleterThread = std::thread([this]() {
         std::unique_lock lock(connectionsLock);
@@ -23,6 +39,8 @@ StreamServer::StreamServer() : requestedWidth(0), requestedHeight(0), flagRunDel
             Connection* conn = deleteReq.front();
             deleteReq.pop_front();
 
+            endStream_locked(conn);
+
             while (true) {
                 bool erased = false;
                 for (auto it = connections.begin(); it != connections.end(); ++it) {
@@ -36,11 +54,7 @@ StreamServer::StreamServer() : requestedWidth(0), requestedHeight(0), flagRunDel
                     break;
             }
 
-            if (connections.empty() && streaming) {
-                streaming = false;
-                audioEncoder.stop();
-                capture->stop();
-            }
+            metricConnections.set(connections.size());
         }
     });
 
@@ -48,18 +62,30 @@ StreamServer::StreamServer() : requestedWidth(0), requestedHeight(0), flagRunDel
     auto opt = factory->getBestOption();
     capture = factory->createPipeline(clock, opt.first, opt.second);
 
-    capture->setOutputCallback([this](DesktopFrame<ByteBuffer>&& cap) { processOutput_(std::move(cap)); });
-    audioEncoder.setOnAudioData([this](const uint8_t* data, size_t len) {
-        msg::Packet pkt;
-        pkt.set_extra_data_len(len);
-        auto audioFrame = pkt.mutable_audio_frame();
+    capture->setCursorCallback([this](const CursorPos& pos) {
+        auto m = cursorPosPacket.mutable_cursor_position();
+        m->Clear();
+        m->set_visible(pos.visible);
+        if (pos.visible) {
+            m->set_x(pos.x);
+            m->set_y(pos.y);
+        }
+        broadcast_(cursorPosPacket, nullptr, &cursorRecipients);
+    });
+    audioEncoder.setOnAudioData([this](const uint8_t* data, size_t len, std::chrono::microseconds timeCaptured) {
+        audioPacket.set_extra_data_len(len);
+        auto audioFrame = audioPacket.mutable_audio_frame();
         audioFrame->set_channels(2);
-        broadcast_(pkt, data);
+        audioFrame->set_is_first_packet(audioSequence == 0);
+        audioFrame->set_sequence(audioSequence++);
+        audioFrame->set_time_captured(timeCaptured.count());
+        broadcast_(audioPacket, data, &audioRecipients);
     });
 
     server.setOnNewConnection([this](std::unique_ptr<NetworkSocket>&& newSock) {
         std::lock_guard lock(connectionsLock);
-        connections.push_back(std::make_unique<Connection>(this, std::move(newSock)));
+        connections.push_back(std::make_shared<Connection>(this, std::move(newSock)));
+        metricConnections.set(connections.size());
     });
 }
 
@@ -71,14 +97,22 @@ StreamServer::~StreamServer() {
 
 void StreamServer::start() {
     server.startListen(SERVICE_PORT);
+
+    const char* metricsPort = getenv("TWILIGHT_METRICS_PORT");
+    if (metricsPort != nullptr && metricsPort[0] != '\0')
+        metricsServer.start(static_cast<uint16_t>(atoi(metricsPort)));
 }
 
 void StreamServer::stop() {
     server.stopListen();
+    metricsServer.stop();
 
     std::lock_guard lock(connectionsLock);
-    for (std::unique_ptr<Connection>& conn : connections)
+    for (std::shared_ptr<Connection>& conn : connections) {
+        // Disconnecting first fails frames still being sent to it, so that branches stop quickly
         conn->disconnect();
+        endStream_locked(conn.get());
+    }
 
     // Drop all elements
     connections.resize(0);
@@ -94,11 +128,6 @@ void StreamServer::getCaptureResolution(int* w, int* h) {
     capture->getNativeMode(w, h, &fps);
 }
 
-void StreamServer::getVideoResolution(int* w, int* h) {
-    *w = requestedWidth;
-    *h = requestedHeight;
-}
-
 void StreamServer::onDisconnected(Connection* conn) {
     std::lock_guard lock(connectionsLock);
 
@@ -106,88 +135,104 @@ void StreamServer::onDisconnected(Connection* conn) {
     deleteReqCV.notify_one();
 }
 
-void StreamServer::configureStream(Connection* conn, int width, int height, Rational framerate) {
-    requestedWidth = width;
-    requestedHeight = height;
-    requestedFramerate = framerate;
+void StreamServer::configureStream(Connection* conn, const AudioEncoder::Config& audio) {
+    std::lock_guard lock(connectionsLock);
+    if (!streaming)
+        audioEncoder.setConfig(audio);
 }
 
-bool StreamServer::startStream(Connection* conn) {
-    if (streaming)
-        return false;
+bool StreamServer::startStream(Connection* conn, const EncoderConfig& config) {
+    std::lock_guard lock(connectionsLock);
+
+    auto connIt = std::find_if(connections.begin(), connections.end(),
+                               [conn](const std::shared_ptr<Connection>& now) { return now.get() == conn; });
+    log.assert_quit(connIt != connections.end(), "Starting stream of a connection not in the list");
+
+    StreamSession* session = nullptr;
+    for (auto& now : sessions) {
+        if (now->getConfig() == config) {
+            session = now.get();
+            break;
+        }
+    }
+
+    if (session == nullptr) {
+        auto newSession = std::make_unique<StreamSession>(clock, tracer, *capture, config);
+        if (!newSession->start())
+            return false;
+
+        session = newSession.get();
+        sessions.push_back(std::move(newSession));
+    }
+
+    session->addConnection(*connIt);
+
+    /* lock */ {
+        std::lock_guard streamingLk(streamingLock);
+        streamingConnections.push_back(*connIt);
+    }
+
+    if (!streaming) {
+        streaming = true;
+        capture->start();
+        audioSequence = 0;
+        audioEncoder.start();
+    }
 
-    // TODO: Allow multiple clients
-    streaming = true;
-    capture->setEncoderMode(requestedWidth, requestedHeight, requestedFramerate);
-    capture->start();
-    audioEncoder.start();
     return true;
 }
 
 void StreamServer::endStream(Connection* conn) {
-    if (streaming) {
-        streaming = false;
-        audioEncoder.stop();
-        capture->stop();
-    }
+    std::lock_guard lock(connectionsLock);
+    endStream_locked(conn);
 }
 
-ByteBuffer StreamServer::getLocalCert() {
-    return server.getCert().der();
+void StreamServer::requestKeyframe(Connection* conn) {
+    std::lock_guard lock(connectionsLock);
+    for (auto& session : sessions)
+        session->requestKeyframe(conn);
 }
 
-void StreamServer::processOutput_(DesktopFrame<ByteBuffer>&& cap) {
-    if (cap.cursorPos)
-        cursorPos = std::move(cap.cursorPos);
-
-    msg::Packet pkt;
-    if (cap.cursorShape) {
-        msg::CursorShape* m = pkt.mutable_cursor_shape();
-        m->set_width(cap.cursorShape->width);
-        m->set_height(cap.cursorShape->height);
-        m->set_hotspot_x(cap.cursorShape->hotspotX);
-        m->set_hotspot_y(cap.cursorShape->hotspotY);
-        switch (cap.cursorShape->format) {
-        case CursorShapeFormat::RGBA:
-            m->set_format(msg::CursorShape_Format_RGBA);
-            break;
-        case CursorShapeFormat::RGBA_XOR:
-            m->set_format(msg::CursorShape_Format_RGBA_XOR);
-            break;
-        default:
-            log.error_quit("Unknown cursor shape format: {}", (int)cap.cursorShape->format);
-        }
-
-        pkt.set_extra_data_len(cap.cursorShape->image.size());
-        broadcast_(pkt, cap.cursorShape->image.data());
+void StreamServer::endStream_locked(Connection* conn) {
+    /* lock */ {
+        std::lock_guard streamingLk(streamingLock);
+        streamingConnections.erase(
+            std::remove_if(streamingConnections.begin(), streamingConnections.end(),
+                           [conn](const std::shared_ptr<Connection>& now) { return now.get() == conn; }),
+            streamingConnections.end());
     }
 
-    msg::DesktopFrame* m = pkt.mutable_desktop_frame();
-    if (cursorPos) {
-        m->set_cursor_visible(cursorPos->visible);
-        if (cursorPos->visible) {
-            m->set_cursor_x(cursorPos->x);
-            m->set_cursor_y(cursorPos->y);
+    for (auto it = sessions.begin(); it != sessions.end(); ++it) {
+        StreamSession* session = it->get();
+        if (!session->removeConnection(conn))
+            continue;
+
+        if (session->empty()) {
+            session->stop();
+            sessions.erase(it);
         }
-    } else {
-        m->set_cursor_visible(false);
+        break;
     }
 
-    m->set_time_captured(cap.timeCaptured.count());
-    m->set_time_encoded(cap.timeEncoded.count());
-
-    m->set_is_idr(cap.isIDR);
-
-    pkt.set_extra_data_len(cap.desktop.size());
-    broadcast_(pkt, cap.desktop);
+    if (sessions.empty() && streaming) {
+        streaming = false;
+        audioEncoder.stop();
+        capture->stop();
+    }
 }
 
-void StreamServer::broadcast_(const msg::Packet& pkt, const uint8_t* extraData) {
-    for (const std::unique_ptr<Connection>& conn : connections)
-        conn->send(pkt, extraData);
+ByteBuffer StreamServer::getLocalCert() {
+    return server.getCert().der();
 }
 
-void StreamServer::broadcast_(const msg::Packet& pkt, const ByteBuffer& extraData) {
-    for (const std::unique_ptr<Connection>& conn : connections)
+void StreamServer::broadcast_(const msg::Packet& pkt, const uint8_t* extraData,
+                              std::vector<std::shared_ptr<Connection>>* recipients) {
+    /* lock */ {
+        std::lock_guard lock(streamingLock);
+        recipients->assign(streamingConnections.begin(), streamingConnections.end());
+    }
+
+    for (const std::shared_ptr<Connection>& conn : *recipients)
         conn->send(pkt, extraData);
+    recipients->clear();
 }
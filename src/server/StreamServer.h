@@ -3,15 +3,19 @@
 
 #include "CapturePipeline.h"
 
+#include "common/LatencyTracer.h"
+#include "common/Metrics.h"
 #include "common/Rational.h"
 #include "common/log.h"
 
+#include "common/net/MetricsServer.h"
 #include "common/net/NetworkServer.h"
 
 #include "server/AudioEncoder.h"
 #include "server/Connection.h"
 #include "server/KnownClients.h"
 #include "server/LocalClock.h"
+#include "server/StreamSession.h"
 
 #include <atomic>
 #include <deque>
@@ -29,12 +33,20 @@ public:
 
     void getNativeMode(int* w, int* h, Rational* fps);
     void getCaptureResolution(int* w, int* h);
-    void getVideoResolution(int* w, int* h);
+
+    // Only with TWILIGHT_CHROMA444=1, as it is untested how much bitrate and CPU it costs
+    bool canEncodeChroma444() const { return allowChroma444 && capture->supportsChroma444(); }
 
     void onDisconnected(Connection* conn);
-    void configureStream(Connection* conn, int width, int height, Rational framerate);
-    bool startStream(Connection* conn);
+
+    // Audio is shared by all sessions, so its config is ignored while any session is running
+    void configureStream(Connection* conn, const AudioEncoder::Config& audio);
+    AudioEncoder::Config getAudioConfig() const { return audioEncoder.getConfig(); }
+
+    // Joins the session with the same config, or starts a new one
+    bool startStream(Connection* conn, const EncoderConfig& config);
     void endStream(Connection* conn);
+    void requestKeyframe(Connection* conn);
 
     const LocalClock& getClock() const { return clock; }
 
@@ -49,6 +61,7 @@ private:
     static NamedLogger log;
 
     NetworkServer server;
+    MetricsServer metricsServer;
 
     std::mutex connectionsLock;
 
@@ -58,25 +71,41 @@ private:
     std::thread deleterThread;
     std::atomic<bool> flagRunDeleter;
 
-    int requestedWidth;
-    int requestedHeight;
-    Rational requestedFramerate;
-    bool streaming;
+    bool streaming;  // Guarded by connectionsLock
+    bool allowChroma444;
 
     LocalClock clock;
+    LatencyTracer tracer;
 
     AudioEncoder audioEncoder;
+    uint32_t audioSequence;
+
+    // Reused for every packet of its kind, so that steady streaming doesn't allocate.
+    // Each one is only touched by the thread producing that kind.
+    msg::Packet cursorPosPacket;
+    msg::Packet audioPacket;
+
+    // Sessions and sends in flight may hold a connection a little longer than this list
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::vector<std::unique_ptr<StreamSession>> sessions;  // Guarded by connectionsLock
+
+    // Connections in a session, to which cursor and audio are broadcast. Has its own lock, as broadcasting threads
+    // are stopped while connectionsLock is held. Taken after connectionsLock when both are needed.
+    std::mutex streamingLock;
+    std::vector<std::shared_ptr<Connection>> streamingConnections;
 
-    std::vector<std::unique_ptr<Connection>> connections;
+    // Snapshots of streamingConnections, each only used by the thread producing that kind of packet
+    std::vector<std::shared_ptr<Connection>> cursorRecipients;
+    std::vector<std::shared_ptr<Connection>> audioRecipients;
 
     std::unique_ptr<CapturePipeline> capture;
-    std::shared_ptr<CursorPos> cursorPos;
 
-    std::chrono::steady_clock::time_point lastStatReport;
+    MetricGauge& metricConnections;
 
-    void processOutput_(DesktopFrame<ByteBuffer>&& cap);
-    void broadcast_(const msg::Packet& pkt, const uint8_t* extraData);
-    void broadcast_(const msg::Packet& pkt, const ByteBuffer& extraData);
+    void endStream_locked(Connection* conn);
+    // Sends to streaming connections outside of any lock. `recipients` is scratch space owned by the calling thread.
+    void broadcast_(const msg::Packet& pkt, const uint8_t* extraData,
+                    std::vector<std::shared_ptr<Connection>>* recipients);
 };
 
 #endif
@@ -0,0 +1,444 @@
+#include "StreamSession.h"
+
+#include "common/CursorShapeCache.h"
+
+#include "server/Connection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+TWILIGHT_DEFINE_LOGGER(StreamSession);
+
+static constexpr int MAX_SIMULCAST_LAYERS = 3;
+static constexpr int DEFAULT_SIMULCAST_BITRATE = 8000000;  // Used as top layer bitrate if client had no preference
+
+// Each layer has 2/3 the size and 3/8 the bitrate of the one above, like 1080p/8Mbps, 720p/3Mbps, 480p/1Mbps
+static constexpr int LAYER_SCALE_NUM = 2;
+static constexpr int LAYER_SCALE_DEN = 3;
+static constexpr int LAYER_BITRATE_NUM = 3;
+static constexpr int LAYER_BITRATE_DEN = 8;
+
+static constexpr auto BANDWIDTH_WINDOW = std::chrono::seconds(1);
+static constexpr auto UPGRADE_HOLD = std::chrono::seconds(10);  // Since last switch, to avoid flapping
+static constexpr double DOWNGRADE_RATIO = 0.8;                   // Go down if layer takes more than this
+static constexpr double UPGRADE_RATIO = 0.6;                     // Go up if upper layer takes less than this
+
+// Requests for a layer are merged until its IDR frame is sent, unless it takes longer than this
+static constexpr auto KEYFRAME_RETRY = std::chrono::seconds(1);
+
+static int simulcastLayers() {
+    static const int layers = []() {
+        const char* env = getenv("TWILIGHT_SIMULCAST_LAYERS");
+        if (env == nullptr || env[0] == '\0')
+            return 1;
+        return std::clamp(atoi(env), 1, MAX_SIMULCAST_LAYERS);
+    }();
+    return layers;
+}
+
+static std::string configName(const EncoderConfig& config) {
+    std::string ret = fmt::format("{}x{}@{:.2f}", config.width, config.height, config.framerate.toFloat());
+    if (0 < config.bitrate)
+        ret += fmt::format("/{}kbps", config.bitrate / 1000);
+    if (config.noPeriodicKeyframes)
+        ret += "/nokf";
+    if (config.chroma444)
+        ret += "/444";
+    return ret;
+}
+
+static int roundEven(double val) {
+    return std::max(2, static_cast<int>(std::lround(val / 2)) * 2);
+}
+
+StreamSession::StreamSession(LocalClock& clock_, LatencyTracer& tracer_, CapturePipeline& capture_,
+                             const EncoderConfig& config_)
+    : clock(clock_),
+      tracer(tracer_),
+      capture(capture_),
+      config(config_),
+      name(configName(config_)),
+      running(false),
+      metricLabels(fmt::format("session=\"{}\"", name)),
+      metricClients(MetricsRegistry::global().gauge("twilight_session_clients", "Clients receiving the session",
+                                                    metricLabels)),
+      metricFps(MetricsRegistry::global().gauge("twilight_video_fps",
+                                                "Video frames per second of the top layer, over last report",
+                                                metricLabels)),
+      metricCpuUsage(MetricsRegistry::global().gauge("twilight_session_cpu_usage",
+                                                     "CPU cores used to scale and encode, over last report",
+                                                     metricLabels)),
+      metricFrames(MetricsRegistry::global().counter("twilight_video_frames_total", "Video frames sent")),
+      metricIdrFrames(MetricsRegistry::global().counter("twilight_video_idr_frames_total", "IDR frames sent")),
+      metricVideoBytes(MetricsRegistry::global().counter("twilight_video_bytes_total", "Encoded video bytes sent")),
+      metricLayerSwitches(MetricsRegistry::global().counter("twilight_simulcast_switches_total",
+                                                            "Clients moved to another simulcast layer")),
+      metricKeyframeRequests(MetricsRegistry::global().counter("twilight_keyframe_requests_total",
+                                                               "Keyframes requested, not counting merged requests")),
+      metricEncodeTime(MetricsRegistry::global().histogram("twilight_video_encode_seconds",
+                                                           "Time from capture to end of encoding")),
+      metricKeyframeDelay(MetricsRegistry::global().histogram("twilight_keyframe_delay_seconds",
+                                                              "Time from keyframe request to sending the IDR frame")) {}
+
+StreamSession::~StreamSession() {
+    log.assert_quit(!running, "Destructing without stopping first!");
+
+    MetricsRegistry::global().release("twilight_session_clients", metricLabels);
+    MetricsRegistry::global().release("twilight_video_fps", metricLabels);
+    MetricsRegistry::global().release("twilight_session_cpu_usage", metricLabels);
+}
+
+bool StreamSession::start() {
+    lastStatReport = std::chrono::steady_clock::now();
+
+    const int layerCount = simulcastLayers();
+
+    std::vector<Layer> newLayers(layerCount);
+    for (int i = 0; i < layerCount; i++) {
+        Layer& layer = newLayers[i];
+        layer.config = config;
+        if (layerCount == 1) {
+            layer.traceTrack = tracer.addTrack(name);
+            continue;
+        }
+
+        double scale = std::pow(static_cast<double>(LAYER_SCALE_NUM) / LAYER_SCALE_DEN, i);
+        double bitrateScale = std::pow(static_cast<double>(LAYER_BITRATE_NUM) / LAYER_BITRATE_DEN, i);
+        int topBitrate = 0 < config.bitrate ? config.bitrate : DEFAULT_SIMULCAST_BITRATE;
+        layer.config.width = roundEven(config.width * scale);
+        layer.config.height = roundEven(config.height * scale);
+        layer.config.bitrate = static_cast<int>(topBitrate * bitrateScale);
+        layer.traceTrack = tracer.addTrack(fmt::format("{} layer {}", name, i));
+    }
+
+    /* lock */ {
+        std::lock_guard lock(connectionsLock);
+        layers = std::move(newLayers);
+    }
+
+    // Branches may output as soon as they are added, so layers must not be resized from here
+    size_t added = 0;
+    for (size_t i = 0; i < layers.size(); i++) {
+        size_t id = capture.addBranch(layers[i].config,
+                                      [this, i](DesktopFrame<ByteBuffer>&& cap) { processOutput_(i, std::move(cap)); });
+        if (id == 0)
+            break;
+
+        std::lock_guard lock(connectionsLock);
+        layers[i].branchId = id;
+        added++;
+    }
+
+    if (added == 0) {
+        std::lock_guard lock(connectionsLock);
+        layers.clear();
+        return false;
+    }
+
+    if (added < layers.size())
+        log.warn("Capture pipeline took only {} of {} simulcast layers", added, layers.size());
+
+    /* lock */ {
+        std::lock_guard lock(connectionsLock);
+        // Unused layers never output, as their branch was not added
+        layers.resize(added);
+    }
+
+    running = true;
+    if (layers.size() == 1) {
+        log.info("Started session {}", name);
+    } else {
+        for (size_t i = 0; i < layers.size(); i++)
+            log.info("Started session {} layer {}: {}", name, i, configName(layers[i].config));
+    }
+    return true;
+}
+
+void StreamSession::stop() {
+    if (!running)
+        return;
+
+    for (const Layer& layer : layers)
+        capture.removeBranch(layer.branchId);
+    running = false;
+
+    /* lock */ {
+        std::lock_guard lock(connectionsLock);
+        layers.clear();
+    }
+
+    metricClients.set(0);
+    metricFps.set(0);
+    metricCpuUsage.set(0);
+    log.info("Stopped session {}", name);
+}
+
+void StreamSession::addConnection(std::shared_ptr<Connection> conn) {
+    std::lock_guard lock(connectionsLock);
+
+    // Joining in the middle of a GOP; Can't decode anything until the next IDR frame
+    if (!clients.empty() && !layers.empty())
+        requestKeyframe_locked(0);
+
+    auto now = std::chrono::steady_clock::now();
+    clients.push_back(Client{std::move(conn), 0, 0, 0, std::chrono::steady_clock::duration(0), now, now, 0, 0});
+    metricClients.set(clients.size());
+}
+
+bool StreamSession::removeConnection(Connection* conn) {
+    std::lock_guard lock(connectionsLock);
+    auto it = findClient_locked(conn);
+    if (it == clients.end())
+        return false;
+
+    // Frames still being sent to it hold their own reference, so there is nothing to wait for
+    clients.erase(it);
+    metricClients.set(clients.size());
+    return true;
+}
+
+bool StreamSession::empty() const {
+    std::lock_guard lock(connectionsLock);
+    return clients.empty();
+}
+
+void StreamSession::requestKeyframe(Connection* conn) {
+    std::lock_guard lock(connectionsLock);
+    for (const Client& client : clients) {
+        if (client.conn.get() == conn) {
+            if (client.pendingLayer < layers.size())
+                requestKeyframe_locked(client.pendingLayer);
+            return;
+        }
+    }
+}
+
+std::vector<StreamSession::Client>::iterator StreamSession::findClient_locked(Connection* conn) {
+    return std::find_if(clients.begin(), clients.end(), [conn](const Client& c) { return c.conn.get() == conn; });
+}
+
+void StreamSession::requestKeyframe_locked(size_t layerIndex) {
+    Layer& layer = layers[layerIndex];
+    auto now = std::chrono::steady_clock::now();
+    if (layer.keyframeRequested && now - layer.keyframeRetryTime < KEYFRAME_RETRY)
+        return;
+
+    if (!layer.keyframeRequested) {
+        layer.keyframeRequested = true;
+        layer.keyframeRequestTime = now;
+        metricKeyframeRequests.add();
+    }
+    layer.keyframeRetryTime = now;
+    capture.requestKeyframe(layer.branchId);
+}
+
+void StreamSession::processOutput_(size_t layerIndex, DesktopFrame<ByteBuffer>&& cap) {
+    // Not resized while branches are running
+    Layer& layer = layers[layerIndex];
+
+    /* lock */ {
+        std::unique_lock lock(connectionsLock);
+
+        if (cap.isIDR) {
+            if (layer.keyframeRequested) {
+                layer.keyframeRequested = false;
+                auto delay = std::chrono::steady_clock::now() - layer.keyframeRequestTime;
+                metricKeyframeDelay.observe(std::chrono::duration<double>(delay).count());
+            }
+
+            layer.recipients.clear();
+            for (const Client& client : clients) {
+                if (client.pendingLayer == layerIndex && client.layer != layerIndex)
+                    layer.recipients.push_back(Recipient{client.conn, std::chrono::steady_clock::duration(0)});
+            }
+
+            // Frames of the old layer may still be on their way to them, and must not come after this one
+            for (const Recipient& moving : layer.recipients) {
+                sendCV.wait(lock, [&]() {
+                    auto it = findClient_locked(moving.conn.get());
+                    return it == clients.end() || it->sending == 0;
+                });
+
+                auto it = findClient_locked(moving.conn.get());
+                if (it == clients.end() || it->pendingLayer != layerIndex)
+                    continue;
+
+                log.info("Moving a client of session {} from layer {} to {} ({:.0f} kbps estimated)", name, it->layer,
+                         layerIndex, it->bandwidth / 1000);
+                it->layer = layerIndex;
+                it->lastSwitch = std::chrono::steady_clock::now();
+                metricLayerSwitches.add();
+            }
+        }
+
+        // Sent outside the lock, so that a slow client doesn't hold up other layers or joining and leaving
+        layer.recipients.clear();
+        for (Client& client : clients) {
+            if (client.layer == layerIndex) {
+                client.sending++;
+                layer.recipients.push_back(Recipient{client.conn, std::chrono::steady_clock::duration(0)});
+            }
+        }
+    }
+
+    if (cap.cursorPos)
+        layer.cursorPos = std::move(cap.cursorPos);
+
+    if (cap.cursorShape) {
+        msg::CursorShape* m = layer.cursorShapePacket.mutable_cursor_shape();
+        m->set_width(cap.cursorShape->width);
+        m->set_height(cap.cursorShape->height);
+        m->set_hotspot_x(cap.cursorShape->hotspotX);
+        m->set_hotspot_y(cap.cursorShape->hotspotY);
+        switch (cap.cursorShape->format) {
+        case CursorShapeFormat::RGBA:
+            m->set_format(msg::CursorShape_Format_RGBA);
+            break;
+        case CursorShapeFormat::RGBA_XOR:
+            m->set_format(msg::CursorShape_Format_RGBA_XOR);
+            break;
+        default:
+            log.error_quit("Unknown cursor shape format: {}", (int)cap.cursorShape->format);
+        }
+
+        uint64_t id = CursorShapeCache::hash(*cap.cursorShape);
+        for (const Recipient& recipient : layer.recipients)
+            recipient.conn->sendCursorShape(layer.cursorShapePacket, id, cap.cursorShape->image);
+    }
+
+    msg::DesktopFrame* m = layer.framePacket.mutable_desktop_frame();
+    m->Clear();
+    if (layer.cursorPos) {
+        m->set_cursor_visible(layer.cursorPos->visible);
+        if (layer.cursorPos->visible) {
+            m->set_cursor_x(layer.cursorPos->x);
+            m->set_cursor_y(layer.cursorPos->y);
+        }
+    } else {
+        m->set_cursor_visible(false);
+    }
+
+    cap.timeSendQueued = clock.time();
+
+    m->set_frame_id(cap.frameId);
+    m->set_time_captured(cap.timeCaptured.count());
+    if (0 <= cap.timeScaled.count())
+        m->set_time_scaled(cap.timeScaled.count());
+    m->set_time_encoded(cap.timeEncoded.count());
+    m->set_time_send_queued(cap.timeSendQueued.count());
+
+    m->set_is_idr(cap.isIDR);
+
+    layer.framePacket.set_extra_data_len(cap.desktop.size());
+    for (Recipient& recipient : layer.recipients) {
+        auto sendBegin = std::chrono::steady_clock::now();
+        recipient.conn->send(layer.framePacket, cap.desktop);
+        recipient.busy = std::chrono::steady_clock::now() - sendBegin;
+
+        tracer.addSpan(LatencyTracer::Stage::SEND, cap.frameId, cap.timeSendQueued, clock.time(), layer.traceTrack);
+    }
+
+    tracer.addFrame(cap, layer.traceTrack);
+
+    /* lock */ {
+        std::lock_guard lock(connectionsLock);
+
+        for (const Recipient& recipient : layer.recipients) {
+            // Gone if removed while sending
+            auto it = findClient_locked(recipient.conn.get());
+            if (it == clients.end())
+                continue;
+
+            it->sending--;
+            if (1 < layers.size())
+                updateBandwidth_(*it, cap.desktop.size(), recipient.busy);
+        }
+        if (!layer.recipients.empty())
+            sendCV.notify_all();
+
+        layer.framesSinceReport++;
+        metricFrames.add();
+        metricVideoBytes.add(cap.desktop.size());
+        if (cap.isIDR)
+            metricIdrFrames.add();
+        metricEncodeTime.observe((cap.timeEncoded - cap.timeCaptured).count() / 1e6);
+
+        if (std::chrono::steady_clock::now() - lastStatReport >= std::chrono::seconds(5))
+            reportStat_();
+    }
+
+    // May be the last reference to a removed connection, whose destruction shouldn't happen under the lock
+    layer.recipients.clear();
+}
+
+void StreamSession::updateBandwidth_(Client& client, size_t bytes, std::chrono::steady_clock::duration busy) {
+    client.windowBytes += bytes;
+    client.windowBusy += busy;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - client.windowBegin < BANDWIDTH_WINDOW)
+        return;
+
+    // Sends return as soon as the socket buffer takes the data, so they only block for long once the
+    // connection can't keep up. Bytes over blocked time is then close to what the connection can take,
+    // and far above it when the connection is idle most of the time.
+    double busySec = std::max(std::chrono::duration<double>(client.windowBusy).count(), 1e-3);
+    double rate = client.windowBytes * 8 / busySec;
+    client.bandwidth = client.bandwidth == 0 ? rate : client.bandwidth * 0.7 + rate * 0.3;
+
+    client.windowBytes = 0;
+    client.windowBusy = std::chrono::steady_clock::duration(0);
+    client.windowBegin = now;
+
+    const size_t current = client.pendingLayer;
+    if (current + 1 < layers.size() && client.bandwidth * DOWNGRADE_RATIO < layers[current].config.bitrate)
+        client.pendingLayer = current + 1;
+    else if (0 < current && layers[current - 1].config.bitrate < client.bandwidth * UPGRADE_RATIO &&
+             UPGRADE_HOLD <= now - client.lastSwitch)
+        client.pendingLayer = current - 1;
+
+    // Switch happens at the IDR frame
+    if (client.pendingLayer != current && client.pendingLayer != client.layer)
+        requestKeyframe_locked(client.pendingLayer);
+}
+
+void StreamSession::reportStat_() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - lastStatReport).count();
+    lastStatReport = now;
+
+    double cpuUsage = 0;
+    double topFps = 0;
+    std::string layerStat;
+    for (size_t i = 0; i < layers.size(); i++) {
+        Layer& layer = layers[i];
+
+        std::chrono::microseconds cpuTime = capture.getBranchCpuTime(layer.branchId);
+        cpuUsage += std::max<long long>(0, (cpuTime - layer.lastCpuTime).count()) / 1e6 / elapsed;
+        layer.lastCpuTime = cpuTime;
+
+        double fps = layer.framesSinceReport / elapsed;
+        layer.framesSinceReport = 0;
+
+        if (i == 0)
+            topFps = fps;
+
+        size_t count = std::count_if(clients.begin(), clients.end(), [i](const Client& c) { return c.layer == i; });
+        layerStat += fmt::format(", layer {} {:.1f} fps {} clients", i, fps, count);
+    }
+
+    metricFps.set(topFps);
+    metricCpuUsage.set(cpuUsage);
+
+    if (layers.size() == 1)
+        log.info("Session {}: {} clients, {:.1f} fps, CPU {:.0f}%", name, clients.size(), topFps, cpuUsage * 100);
+    else
+        log.info("Session {}: {} clients{}, CPU {:.0f}%", name, clients.size(), layerStat, cpuUsage * 100);
+
+    for (size_t i = 0; i < layers.size(); i++) {
+        if (1 < layers.size())
+            log.info("  Layer {}:", i);
+        tracer.logStat(log, layers[i].traceTrack);
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef TWILIGHT_SERVER_STREAMSESSION_H
+#define TWILIGHT_SERVER_STREAMSESSION_H
+
+#include "common/ByteBuffer.h"
+#include "common/DesktopFrame.h"
+#include "common/LatencyTracer.h"
+#include "common/Metrics.h"
+#include "common/log.h"
+
+#include "server/CapturePipeline.h"
+#include "server/LocalClock.h"
+
+#include <packet.pb.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Connection;
+
+// Clients that asked for the same EncoderConfig, sharing encoder branches of the capture pipeline.
+// With simulcast enabled, lower resolution layers are encoded too and each client is moved between them
+// at IDR frames, following how fast its connection takes data.
+class StreamSession {
+public:
+    StreamSession(LocalClock& clock, LatencyTracer& tracer, CapturePipeline& capture, const EncoderConfig& config);
+    StreamSession(const StreamSession& copy) = delete;
+    StreamSession(StreamSession&& move) = delete;
+    ~StreamSession();
+
+    // Returns false if the pipeline can't take another branch. Lower layers are dropped if only they don't fit.
+    bool start();
+    void stop();
+
+    const EncoderConfig& getConfig() const { return config; }
+
+    // Sessions share ownership of their connections, so that frames being sent outside the lock keep them alive
+    void addConnection(std::shared_ptr<Connection> conn);
+
+    // Returns true if the connection was in this session
+    bool removeConnection(Connection* conn);
+
+    bool empty() const;
+
+    // Asks for an IDR frame on the layer the connection receives, or is about to
+    void requestKeyframe(Connection* conn);
+
+private:
+    struct Recipient {
+        std::shared_ptr<Connection> conn;
+        std::chrono::steady_clock::duration busy;
+    };
+
+    struct Layer {
+        EncoderConfig config;
+        size_t branchId = 0;
+        int traceTrack = 0;  //< Frame ids are counted per branch, so each layer has its own track
+
+        std::shared_ptr<CursorPos> cursorPos;
+        std::chrono::microseconds lastCpuTime{0};
+        size_t framesSinceReport = 0;
+
+        bool keyframeRequested = false;  //< Until the next IDR frame is sent
+        std::chrono::steady_clock::time_point keyframeRequestTime;
+        std::chrono::steady_clock::time_point keyframeRetryTime;
+
+        // Only used by the branch thread of the layer, so they are sent without holding connectionsLock
+        msg::Packet framePacket;
+        msg::Packet cursorShapePacket;
+        std::vector<Recipient> recipients;
+    };
+
+    struct Client {
+        std::shared_ptr<Connection> conn;
+        size_t layer;         //< Index of the layer being sent
+        size_t pendingLayer;  //< Switched to at its next IDR frame. Same as layer if not switching.
+
+        // Time spent blocked in send, to estimate how fast the connection drains
+        size_t windowBytes;
+        std::chrono::steady_clock::duration windowBusy;
+        std::chrono::steady_clock::time_point windowBegin;
+        std::chrono::steady_clock::time_point lastSwitch;
+        double bandwidth;  //< Estimated in bits per second. 0 if unknown.
+
+        int sending;  //< Frames being sent to it outside the lock
+    };
+
+    static NamedLogger log;
+
+    // Called from the branch thread of the layer
+    void processOutput_(size_t layerIndex, DesktopFrame<ByteBuffer>&& cap);
+    void updateBandwidth_(Client& client, size_t bytes, std::chrono::steady_clock::duration busy);
+    void requestKeyframe_locked(size_t layerIndex);
+    std::vector<Client>::iterator findClient_locked(Connection* conn);
+    void reportStat_();
+
+    LocalClock& clock;
+    LatencyTracer& tracer;
+    CapturePipeline& capture;
+    const EncoderConfig config;
+    const std::string name;
+
+    // Highest resolution first. Only resized by start() and stop().
+    std::vector<Layer> layers;
+    bool running;
+
+    // Also guards layers, except what only their branch threads use
+    mutable std::mutex connectionsLock;
+    std::condition_variable sendCV;  //< Notified when clients finish sends
+    std::vector<Client> clients;
+
+    std::chrono::steady_clock::time_point lastStatReport;
+
+    // Labels of per session metrics below, released on destruction
+    const std::string metricLabels;
+    MetricGauge& metricClients;
+    MetricGauge& metricFps;
+    MetricGauge& metricCpuUsage;
+    MetricCounter& metricFrames;
+    MetricCounter& metricIdrFrames;
+    MetricCounter& metricVideoBytes;
+    MetricCounter& metricLayerSwitches;
+    MetricCounter& metricKeyframeRequests;
+    MetricHistogram& metricEncodeTime;
+    MetricHistogram& metricKeyframeDelay;
+};
+
+#endif
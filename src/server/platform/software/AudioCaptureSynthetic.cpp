@@ -0,0 +1,185 @@
+#include "AudioCaptureSynthetic.h"
+
+#include "common/util.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+TWILIGHT_DEFINE_LOGGER(AudioCaptureSynthetic);
+
+static constexpr double PI = 3.14159265358979323846;
+
+static uint32_t readLE(const uint8_t* p, int bytes) {
+    uint32_t ret = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        ret = (ret << 8) | p[i];
+    return ret;
+}
+
+AudioCaptureSynthetic::AudioCaptureSynthetic(Mode mode, AVSampleFormat format, int samplingRate, int channels)
+    : mode(mode),
+      format(format),
+      samplingRate(samplingRate),
+      channels(channels),
+      filePos(0),
+      phase(0),
+      flagRun(false) {
+    log.assert_quit(format == AV_SAMPLE_FMT_S16 || format == AV_SAMPLE_FMT_S32 || format == AV_SAMPLE_FMT_FLT,
+                    "Unsupported sample format {}", format);
+    log.assert_quit(mode != Mode::FILE, "Use loadWav() to use a file");
+    log.assert_quit(0 < samplingRate && 0 < channels, "Invalid audio configuration");
+    bytesPerFrame = av_get_bytes_per_sample(format) * channels;
+}
+
+AudioCaptureSynthetic::~AudioCaptureSynthetic() {
+    if (flagRun.load(std::memory_order_relaxed))
+        stop();
+}
+
+bool AudioCaptureSynthetic::loadWav(const std::string& path) {
+    auto loaded = loadEntireFile(path.c_str());
+    if (!loaded) {
+        log.error("Failed to read {}", path);
+        return false;
+    }
+
+    const ByteBuffer& file = *loaded;
+    if (file.size() < 12 || memcmp(file.data(), "RIFF", 4) != 0 || memcmp(file.data() + 8, "WAVE", 4) != 0) {
+        log.error("{} is not a wav file", path);
+        return false;
+    }
+
+    AVSampleFormat newFormat = AV_SAMPLE_FMT_NONE;
+    int newRate = 0;
+    int newChannels = 0;
+    const uint8_t* samples = nullptr;
+    size_t samplesLen = 0;
+
+    size_t pos = 12;
+    while (pos + 8 <= file.size()) {
+        const uint8_t* chunk = file.data() + pos;
+        size_t chunkLen = std::min<size_t>(readLE(chunk + 4, 4), file.size() - pos - 8);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && 16 <= chunkLen) {
+            int tag = readLE(chunk + 8, 2);
+            newChannels = readLE(chunk + 10, 2);
+            newRate = readLE(chunk + 12, 4);
+            int bits = readLE(chunk + 22, 2);
+
+            // WAVE_FORMAT_EXTENSIBLE stores actual tag in front of SubFormat GUID
+            if (tag == 0xFFFE && 26 <= chunkLen)
+                tag = readLE(chunk + 32, 2);
+
+            if (tag == 1 && bits == 16)
+                newFormat = AV_SAMPLE_FMT_S16;
+            else if (tag == 1 && bits == 32)
+                newFormat = AV_SAMPLE_FMT_S32;
+            else if (tag == 3 && bits == 32)
+                newFormat = AV_SAMPLE_FMT_FLT;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            samples = chunk + 8;
+            samplesLen = chunkLen;
+        }
+
+        // Chunks are padded to even length
+        pos += 8 + chunkLen + (chunkLen & 1);
+    }
+
+    if (newFormat == AV_SAMPLE_FMT_NONE || newRate <= 0 || newChannels <= 0 || samples == nullptr) {
+        log.error("{} is not a supported wav file (Only 16/32-bit integer and 32-bit float PCM)", path);
+        return false;
+    }
+
+    int newBytesPerFrame = av_get_bytes_per_sample(newFormat) * newChannels;
+    samplesLen -= samplesLen % newBytesPerFrame;
+    if (samplesLen == 0) {
+        log.error("{} has no audio", path);
+        return false;
+    }
+
+    fileData.resize(samplesLen);
+    memcpy(fileData.data(), samples, samplesLen);
+
+    mode = Mode::FILE;
+    format = newFormat;
+    samplingRate = newRate;
+    channels = newChannels;
+    bytesPerFrame = newBytesPerFrame;
+    filePos = 0;
+
+    log.info("Loaded {}: {} Hz, {} channels, {:.1f} seconds", path, samplingRate, channels,
+             (float)samplesLen / bytesPerFrame / samplingRate);
+    return true;
+}
+
+void AudioCaptureSynthetic::start() {
+    flagRun.store(true, std::memory_order_release);
+    worker = std::thread(&AudioCaptureSynthetic::run_, this);
+}
+
+void AudioCaptureSynthetic::stop() {
+    flagRun.store(false, std::memory_order_release);
+    worker.join();
+}
+
+void AudioCaptureSynthetic::run_() {
+    using namespace std::chrono_literals;
+
+    onConfigured(format, samplingRate, channels);
+
+    // Same packet interval as a typical WASAPI loopback capture
+    const int periodFrames = samplingRate / 100;
+    ByteBuffer buffer(periodFrames * bytesPerFrame);
+
+    auto nextPeriod = std::chrono::steady_clock::now();
+    while (flagRun.load(std::memory_order_acquire)) {
+        generate_(buffer.data(), periodFrames);
+        onAudioData(buffer.data(), buffer.size());
+
+        nextPeriod += 10ms;
+        std::this_thread::sleep_until(nextPeriod);
+    }
+}
+
+void AudioCaptureSynthetic::generate_(uint8_t* out, int frames) {
+    switch (mode) {
+    case Mode::SILENCE:
+        memset(out, 0, frames * bytesPerFrame);
+        break;
+    case Mode::TONE: {
+        const double step = 2 * PI * 440 / samplingRate;
+        for (int i = 0; i < frames; i++) {
+            float val = 0.25f * (float)sin(phase);
+            phase = fmod(phase + step, 2 * PI);
+
+            for (int ch = 0; ch < channels; ch++) {
+                if (format == AV_SAMPLE_FMT_S16) {
+                    int16_t s = (int16_t)(val * INT16_MAX);
+                    memcpy(out, &s, sizeof(s));
+                    out += sizeof(s);
+                } else if (format == AV_SAMPLE_FMT_S32) {
+                    int32_t s = (int32_t)(val * INT32_MAX);
+                    memcpy(out, &s, sizeof(s));
+                    out += sizeof(s);
+                } else {
+                    memcpy(out, &val, sizeof(val));
+                    out += sizeof(val);
+                }
+            }
+        }
+        break;
+    }
+    case Mode::FILE: {
+        size_t remaining = frames * bytesPerFrame;
+        while (remaining > 0) {
+            size_t amount = std::min(remaining, fileData.size() - filePos);
+            memcpy(out, fileData.data() + filePos, amount);
+            out += amount;
+            remaining -= amount;
+            filePos = (filePos + amount) % fileData.size();
+        }
+        break;
+    }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef TWILIGHT_SERVER_PLATFORM_SOFTWARE_AUDIOCAPTURESYNTHETIC_H
+#define TWILIGHT_SERVER_PLATFORM_SOFTWARE_AUDIOCAPTURESYNTHETIC_H
+
+#include "common/ByteBuffer.h"
+#include "common/ffmpeg-headers.h"
+#include "common/log.h"
+
+#include "server/IAudioCapture.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+// Generates audio in real time without any audio device. Useful for testing and profiling.
+class AudioCaptureSynthetic : public IAudioCapture {
+public:
+    enum class Mode {
+        SILENCE,  //< All zero
+        TONE,     //< 440 Hz sine wave
+        FILE      //< Loops audio loaded by loadWav()
+    };
+
+    // format must be one of AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S32, AV_SAMPLE_FMT_FLT
+    AudioCaptureSynthetic(Mode mode, AVSampleFormat format, int samplingRate, int channels);
+    ~AudioCaptureSynthetic() override;
+
+    // Switches to FILE mode with format of the file. Returns false if file is not a supported PCM wav.
+    bool loadWav(const std::string& path);
+
+    void start() override;
+    void stop() override;
+
+private:
+    static NamedLogger log;
+
+    void run_();
+    void generate_(uint8_t* out, int frames);
+
+    Mode mode;
+    AVSampleFormat format;
+    int samplingRate;
+    int channels;
+    int bytesPerFrame;
+
+    ByteBuffer fileData;
+    size_t filePos;
+    double phase;
+
+    std::atomic<bool> flagRun;
+    std::thread worker;
+};
+
+#endif
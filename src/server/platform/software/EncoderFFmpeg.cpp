@@ -1,16 +1,66 @@
 #include "EncoderFFmpeg.h"
 
+#include "common/util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
 
 TWILIGHT_DEFINE_LOGGER(EncoderFFmpeg);
 
-EncoderFFmpeg::EncoderFFmpeg(LocalClock& clock)
-    : clock(clock), flagRun(false), codecType(CodecType::VP8), width(-1), height(-1), codec(nullptr), avctx(nullptr) {
-    codec = avcodec_find_encoder_by_name("libvpx");
-    log.assert_quit(codec != nullptr, "Failed to find libvpx encoder");
+// libvpx splits work among threads by macroblock rows (VP8) or tile columns (VP9), so a thread needs this much
+// area to be worth it
+static constexpr int PIXELS_PER_THREAD = 1280 * 720 / 2;
+static constexpr int MAX_THREADS = 8;
+
+// VP9 tile columns can't be narrower than this
+static constexpr int MIN_TILE_WIDTH = 256;
+
+static int threadCountFor(int width, int height) {
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    return std::clamp((width * height + PIXELS_PER_THREAD - 1) / PIXELS_PER_THREAD, 1, std::min(MAX_THREADS, cores));
 }
 
+static int ceilLog2(int val) {
+    int ret = 0;
+    while ((1 << ret) < val)
+        ret++;
+    return ret;
+}
+
+// With TWILIGHT_DUMP_VIDEO=1, each started encoder also writes its output to its own dump-N.mkv.
+// Returns empty if dumping is off.
+static std::string nextDumpPath() {
+    static std::atomic<int> dumpCount = 0;
+
+    const char* value = getenv("TWILIGHT_DUMP_VIDEO");
+    if (value == nullptr || strcmp(value, "1") != 0)
+        return {};
+    return fmt::format("dump-{}.mkv", dumpCount.fetch_add(1, std::memory_order_relaxed));
+}
+
+EncoderFFmpeg::EncoderFFmpeg(LocalClock& clock)
+    : clock(clock),
+      flagRun(false),
+      flagKeyframeRequested(false),
+      codecType(CodecType::VP8),
+      width(-1),
+      height(-1),
+      bitrate(0),
+      noPeriodicKeyframes(false),
+      chroma444(false),
+      codec(nullptr),
+      avctx(nullptr),
+      statCpuTime(0),
+      metricQueueDepth(MetricsRegistry::global().gauge("twilight_encoder_queue_depth",
+                                                       "Encoded frames waiting to be read", "encoder=\"ffmpeg\"")) {}
+
 EncoderFFmpeg::~EncoderFFmpeg() {
     bool wasRunning = flagRun.exchange(false, std::memory_order_relaxed);
     log.assert_quit(!wasRunning, "Being destructed while running!");
@@ -26,7 +76,6 @@ void EncoderFFmpeg::setMode(int width_, int height_, Rational framerate_) {
 }
 
 void EncoderFFmpeg::start() {
-    int err;
     log.assert_quit(0 < width && 0 < height, "Size not set before start!");
     log.assert_quit(!flagRun.load(std::memory_order_relaxed), "Not stopped before start!");
 
@@ -36,50 +85,12 @@ void EncoderFFmpeg::start() {
     flagNextFrameAvailable = false;
     flagNextPacketAvailable = false;
 
-    avcodec_free_context(&avctx);
-
-    avctx = avcodec_alloc_context3(codec);
-    log.assert_quit(avctx != nullptr, "Failed to allocate codec context");
+    codecType = chroma444 ? CodecType::VP9 : CodecType::VP8;
+    const char* codecName = codecType == CodecType::VP9 ? "libvpx-vp9" : "libvpx";
+    codec = avcodec_find_encoder_by_name(codecName);
+    log.assert_quit(codec != nullptr, "Failed to find {} encoder", codecName);
 
-    avctx->bit_rate = 7 * 1024 * 1024;
-    avctx->rc_max_rate = 8 * 1024 * 1024;
-    avctx->rc_min_rate = 500 * 1024;
-    avctx->colorspace = AVCOL_SPC_BT709;
-    avctx->color_range = AVCOL_RANGE_MPEG;
-    avctx->thread_type = FF_THREAD_SLICE;
-    avctx->thread_count = 4;
-    avctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    avctx->width = width;
-    avctx->height = height;
-    avctx->gop_size = 120;
-
-    // Time base is reciprocal of framerate
-    avctx->time_base.num = framerate.den();
-    avctx->time_base.den = framerate.num();
-
-    AVDictionary* options = nullptr;
-    err = av_dict_set(&options, "deadline", "good", 0);
-    log.assert_quit(err == 0, "Failed to set deadline=realtime");
-    err = av_dict_set(&options, "cpu-used", "12", 0);
-    log.assert_quit(err == 0, "Failed to set cpu-used=12");
-    err = av_dict_set(&options, "slices", "8", 0);
-    log.assert_quit(err == 0, "Failed to set slices=8");
-
-    err = avcodec_open2(avctx, codec, &options);
-    log.assert_quit(err == 0, "Failed to open codec");
-
-    if (av_dict_count(options) != 0) {
-        log.error("Codec has rejected some options:");
-        AVDictionaryEntry* entry = nullptr;
-        while (true) {
-            entry = av_dict_get(options, "", entry, AV_DICT_IGNORE_SUFFIX);
-            if (entry == nullptr)
-                break;
-            log.error("    {} = {}", entry->key, entry->value);
-        }
-    }
-
-    av_dict_free(&options);
+    openCodec_(chroma444 ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_YUV420P);
 
     bool wasRunning = flagRun.exchange(true, std::memory_order_acq_rel);
     log.assert_quit(!wasRunning, "Trying to start when running!");
@@ -116,9 +127,87 @@ bool EncoderFFmpeg::readData(DesktopFrame<ByteBuffer>* output) {
         return false;
     *output = std::move(packetQueue.front());
     packetQueue.pop_front();
+    metricQueueDepth.set(packetQueue.size());
     return true;
 }
 
+void EncoderFFmpeg::openCodec_(AVPixelFormat pixfmt) {
+    int err;
+
+    avcodec_free_context(&avctx);
+
+    avctx = avcodec_alloc_context3(codec);
+    log.assert_quit(avctx != nullptr, "Failed to allocate codec context");
+
+    // Limits keep the ratios of the default 7 Mbps (8 Mbps max, 0.5 Mbps min), so lower layers aren't held up
+    avctx->bit_rate = 0 < bitrate ? bitrate : 7 * 1024 * 1024;
+    avctx->rc_max_rate = avctx->bit_rate / 7 * 8;
+    avctx->rc_min_rate = avctx->bit_rate / 14;
+    avctx->colorspace = AVCOL_SPC_BT709;
+    avctx->color_range = AVCOL_RANGE_MPEG;
+    avctx->thread_type = FF_THREAD_SLICE;
+    avctx->thread_count = threadCountFor(width, height);
+    avctx->pix_fmt = pixfmt;
+    avctx->width = width;
+    avctx->height = height;
+    avctx->gop_size = noPeriodicKeyframes ? std::numeric_limits<int>::max() : 120;
+
+    // Time base is reciprocal of framerate
+    avctx->time_base.num = framerate.den();
+    avctx->time_base.den = framerate.num();
+
+    AVDictionary* options = nullptr;
+    if (codecType == CodecType::VP9) {
+        // 4:4:4 costs about twice as much to encode; Realtime mode is needed to keep up at all
+        err = av_dict_set(&options, "deadline", "realtime", 0);
+        log.assert_quit(err == 0, "Failed to set deadline=realtime");
+        err = av_dict_set(&options, "cpu-used", "8", 0);
+        log.assert_quit(err == 0, "Failed to set cpu-used=8");
+        // libvpx-vp9 otherwise holds back frames for lookahead, which readData() doesn't expect
+        err = av_dict_set(&options, "lag-in-frames", "0", 0);
+        log.assert_quit(err == 0, "Failed to set lag-in-frames=0");
+        // In log2; One column per thread, as far as the width allows
+        int tileColumns = 0;
+        while (tileColumns < ceilLog2(avctx->thread_count) && MIN_TILE_WIDTH << (tileColumns + 1) <= width)
+            tileColumns++;
+        err = av_dict_set_int(&options, "tile-columns", tileColumns, 0);
+        log.assert_quit(err == 0, "Failed to set tile-columns={}", tileColumns);
+        err = av_dict_set(&options, "row-mt", "1", 0);
+        log.assert_quit(err == 0, "Failed to set row-mt=1");
+    } else {
+        err = av_dict_set(&options, "deadline", "good", 0);
+        log.assert_quit(err == 0, "Failed to set deadline=realtime");
+        err = av_dict_set(&options, "cpu-used", "12", 0);
+        log.assert_quit(err == 0, "Failed to set cpu-used=12");
+        // Token partitions, which let the threads write the bitstream in parallel
+        int partitions = 1 << ceilLog2(avctx->thread_count);
+        err = av_dict_set_int(&options, "slices", partitions, 0);
+        log.assert_quit(err == 0, "Failed to set slices={}", partitions);
+    }
+    if (noPeriodicKeyframes) {
+        // In percent of average frame size
+        err = av_dict_set(&options, "max-intra-rate", "300", 0);
+        log.assert_quit(err == 0, "Failed to set max-intra-rate=300");
+    }
+
+    err = avcodec_open2(avctx, codec, &options);
+    log.assert_quit(err == 0, "Failed to open codec");
+    log.info("Encoding {}x{} with {} threads", width, height, avctx->thread_count);
+
+    if (av_dict_count(options) != 0) {
+        log.error("Codec has rejected some options:");
+        AVDictionaryEntry* entry = nullptr;
+        while (true) {
+            entry = av_dict_get(options, "", entry, AV_DICT_IGNORE_SUFFIX);
+            if (entry == nullptr)
+                break;
+            log.error("    {} = {}", entry->key, entry->value);
+        }
+    }
+
+    av_dict_free(&options);
+}
+
 void EncoderFFmpeg::run_() {
     using std::swap;
     int err;
@@ -127,68 +216,72 @@ void EncoderFFmpeg::run_() {
     std::deque<DesktopFrame<long long>> extraDataList;
 
     AVFormatContext* fmt = nullptr;
+    AVStream* stream = nullptr;
     AVPacketPtr pkt;
     AVFramePtr fr;
 
-    err = avformat_alloc_output_context2(&fmt, nullptr, "matroska", nullptr);
-    log.assert_quit(0 <= err, "Failed to allocate avformat context");
-
-    AVStream* stream = avformat_new_stream(fmt, nullptr);
-    log.assert_quit(stream != nullptr, "Failed to mux new stream");
-
-    stream->id = 0;
-    stream->codecpar->codec_id = codec->id;
-    stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-    stream->codecpar->color_primaries = avctx->color_primaries;
-    stream->codecpar->color_range = avctx->color_range;
-    stream->codecpar->color_space = avctx->colorspace;
-    stream->codecpar->color_trc = avctx->color_trc;
-    stream->codecpar->field_order = AV_FIELD_PROGRESSIVE;
-    stream->codecpar->format = AV_PIX_FMT_YUV420P;
-    stream->codecpar->height = height;
-    stream->codecpar->width = width;
-    stream->codecpar->level = avctx->level;
-    stream->codecpar->profile = avctx->profile;
-    stream->codecpar->sample_aspect_ratio.den = 1;
-    stream->codecpar->sample_aspect_ratio.num = 1;
-    stream->codecpar->video_delay = avctx->delay;
-    stream->time_base.num = framerate.inv().num();
-    stream->time_base.den = framerate.inv().den();
-
-    err = avio_open(&fmt->pb, "dump.mkv", AVIO_FLAG_WRITE);
-    log.assert_quit(0 <= err, "Failed to open output");
-
-    AVDictionary* opt = nullptr;
-
-    err = avformat_write_header(fmt, &opt);
-    log.assert_quit(0 <= err, "Failed to write hedaer");
-
-    av_dict_free(&opt);
+    const std::string dumpPath = nextDumpPath();
+    if (!dumpPath.empty()) {
+        log.info("Writing encoded video to {}", dumpPath);
+
+        err = avformat_alloc_output_context2(&fmt, nullptr, "matroska", nullptr);
+        log.assert_quit(0 <= err, "Failed to allocate avformat context");
+
+        stream = avformat_new_stream(fmt, nullptr);
+        log.assert_quit(stream != nullptr, "Failed to mux new stream");
+
+        stream->id = 0;
+        stream->codecpar->codec_id = codec->id;
+        stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+        stream->codecpar->color_primaries = avctx->color_primaries;
+        stream->codecpar->color_range = avctx->color_range;
+        stream->codecpar->color_space = avctx->colorspace;
+        stream->codecpar->color_trc = avctx->color_trc;
+        stream->codecpar->field_order = AV_FIELD_PROGRESSIVE;
+        stream->codecpar->format = avctx->pix_fmt;
+        stream->codecpar->height = height;
+        stream->codecpar->width = width;
+        stream->codecpar->level = avctx->level;
+        stream->codecpar->profile = avctx->profile;
+        stream->codecpar->sample_aspect_ratio.den = 1;
+        stream->codecpar->sample_aspect_ratio.num = 1;
+        stream->codecpar->video_delay = avctx->delay;
+        stream->time_base.num = framerate.inv().num();
+        stream->time_base.den = framerate.inv().den();
+
+        err = avio_open(&fmt->pb, dumpPath.c_str(), AVIO_FLAG_WRITE);
+        log.assert_quit(0 <= err, "Failed to open output");
+
+        AVDictionary* opt = nullptr;
+
+        err = avformat_write_header(fmt, &opt);
+        log.assert_quit(0 <= err, "Failed to write hedaer");
+
+        av_dict_free(&opt);
+    }
 
-    while (flagRun.load(std::memory_order_acquire)) {
-        err = avcodec_receive_packet(avctx, pkt.get());
-        if (err == AVERROR_EOF)
-            break;
-        else if (err == 0) {
-            DesktopFrame<long long> extraData;
-            extraData.desktop = -1;
-            for (auto itr = extraDataList.begin(); itr != extraDataList.end(); ++itr) {
-                if (itr->desktop == pkt->pts) {
-                    extraData = std::move(*itr);
-                    extraDataList.erase(itr);
-                    break;
-                }
+    // Sends out a packet received from the codec
+    auto writePacket = [&]() {
+        DesktopFrame<long long> extraData;
+        extraData.desktop = -1;
+        for (auto itr = extraDataList.begin(); itr != extraDataList.end(); ++itr) {
+            if (itr->desktop == pkt->pts) {
+                extraData = std::move(*itr);
+                extraDataList.erase(itr);
+                break;
             }
-            log.assert_quit(0 <= extraData.desktop, "Failed to find matching extra data for {}", pkt->pts);
+        }
+        log.assert_quit(0 <= extraData.desktop, "Failed to find matching extra data for {}", pkt->pts);
 
-            ByteBuffer buf;
-            buf.resize(pkt->size);
-            buf.write(0, pkt->data, pkt->size);
+        ByteBuffer buf;
+        buf.resize(pkt->size);
+        buf.write(0, pkt->data, pkt->size);
 
-            DesktopFrame<ByteBuffer> output = extraData.getOtherType(std::move(buf));
-            output.isIDR = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
-            output.timeEncoded = clock.time();
+        DesktopFrame<ByteBuffer> output = extraData.getOtherType(std::move(buf));
+        output.isIDR = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+        output.timeEncoded = clock.time();
 
+        if (fmt != nullptr) {
             AVRational originalFramerate;
             originalFramerate.num = framerate.inv().num();
             originalFramerate.den = framerate.inv().den();
@@ -196,12 +289,24 @@ void EncoderFFmpeg::run_() {
             pkt->stream_index = 0;
             err = av_interleaved_write_frame(fmt, pkt.get());
             log.assert_quit(err == 0, "Failed to write frame to file");
+        }
+
+        av_packet_unref(pkt.get());
+
+        std::lock_guard lock(packetLock);
+        packetQueue.push_back(std::move(output));
+        metricQueueDepth.set(packetQueue.size());
+        packetCV.notify_one();
+    };
 
-            av_packet_unref(pkt.get());
+    while (flagRun.load(std::memory_order_acquire)) {
+        statCpuTime.store(threadCpuTime().count(), std::memory_order_relaxed);
 
-            std::lock_guard lock(packetLock);
-            packetQueue.push_back(std::move(output));
-            packetCV.notify_one();
+        err = avcodec_receive_packet(avctx, pkt.get());
+        if (err == AVERROR_EOF)
+            break;
+        else if (err == 0) {
+            writePacket();
         } else if (err == AVERROR(EAGAIN)) {
             DesktopFrame<TextureSoftware> frame;
             /* acquire lock */ {
@@ -216,7 +321,24 @@ void EncoderFFmpeg::run_() {
             }
             log.assert_quit(frame.desktop.width == width, "Frame size does not match configuration!");
             log.assert_quit(frame.desktop.height == height, "Frame size does not match configuration!");
-            log.assert_quit(frame.desktop.format == avctx->pix_fmt, "Frame pix_fmt does not match configuration!");
+
+            if (frame.desktop.format != avctx->pix_fmt) {
+                // Only happens when falling back from 4:4:4, which libvpx can't do without reopening.
+                // Frames still inside the codec are dropped, since the pipeline reads one packet per frame pushed
+                // and extra ones would pile up in packetQueue. The new codec starts with a keyframe.
+                log.info("Reopening codec for {}", av_get_pix_fmt_name(frame.desktop.format));
+                err = avcodec_send_frame(avctx, nullptr);
+                log.assert_quit(err == 0, "Failed to flush encoder");
+                while ((err = avcodec_receive_packet(avctx, pkt.get())) == 0) {
+                    const long long droppedPts = pkt->pts;
+                    extraDataList.erase(std::remove_if(extraDataList.begin(), extraDataList.end(),
+                                                       [&](const auto& now) { return now.desktop == droppedPts; }),
+                                        extraDataList.end());
+                    av_packet_unref(pkt.get());
+                }
+                log.assert_quit(err == AVERROR_EOF, "Failed to drain encoder");
+                openCodec_(frame.desktop.format);
+            }
 
             fr->format = (int)frame.desktop.format;
             fr->width = width;
@@ -224,6 +346,8 @@ void EncoderFFmpeg::run_() {
             fr->colorspace = AVCOL_SPC_BT709;
             fr->color_range = AVCOL_RANGE_MPEG;
             fr->pts = pts++;
+            fr->pict_type = flagKeyframeRequested.exchange(false, std::memory_order_relaxed) ? AV_PICTURE_TYPE_I
+                                                                                             : AV_PICTURE_TYPE_NONE;
             std::copy(frame.desktop.linesize, frame.desktop.linesize + 4, fr->linesize);
             if (codec->capabilities & AV_CODEC_CAP_DR1) {
                 int linesize_align[AV_NUM_DATA_POINTERS] = {};
@@ -259,11 +383,13 @@ void EncoderFFmpeg::run_() {
         }
     }
 
-    err = av_write_trailer(fmt);
-    log.assert_quit(0 <= err, "Failed to write trailer");
+    if (fmt != nullptr) {
+        err = av_write_trailer(fmt);
+        log.assert_quit(0 <= err, "Failed to write trailer");
 
-    err = avio_closep(&fmt->pb);
-    log.assert_quit(0 <= err, "Failed to close avio context");
+        err = avio_closep(&fmt->pb);
+        log.assert_quit(0 <= err, "Failed to close avio context");
 
-    avformat_free_context(fmt);
+        avformat_free_context(fmt);
+    }
 }
@@ -2,6 +2,7 @@
 #define TWILIGHT_SERVER_PLATFORM_SOFTWARE_ENCODERFFMPEG_H
 
 #include "common/DesktopFrame.h"
+#include "common/Metrics.h"
 #include "common/Rational.h"
 #include "common/ffmpeg-headers.h"
 #include "common/log.h"
@@ -10,6 +11,7 @@
 
 #include "server/LocalClock.h"
 
+#include <chrono>
 #include <queue>
 
 class EncoderFFmpeg {
@@ -19,6 +21,24 @@ public:
 
     void setMode(int width, int height, Rational framerate);
 
+    // In bits per second. 0 for default. Takes effect on next start().
+    void setBitrate(int bitrate_) { bitrate = bitrate_; }
+
+    // Sends keyframes only when requested, capped in size. Takes effect on next start().
+    void setNoPeriodicKeyframes(bool enabled) { noPeriodicKeyframes = enabled; }
+
+    // Encodes VP9 in 4:4:4 instead of VP8. Takes effect on next start().
+    // Frames pushed later may switch to YUV420P, which reopens the codec as VP9 profile 0.
+    void setChroma444(bool enabled) { chroma444 = enabled; }
+
+    // Next frame given to the codec is encoded as a keyframe. Safe to call from any thread.
+    void requestKeyframe() { flagKeyframeRequested.store(true, std::memory_order_relaxed); }
+
+    // CPU time spent by the encoding thread so far (excluding worker threads of the codec)
+    std::chrono::microseconds getCpuTime() const {
+        return std::chrono::microseconds(statCpuTime.load(std::memory_order_relaxed));
+    }
+
     void start();
     void stop();
 
@@ -26,6 +46,7 @@ public:
     bool readData(DesktopFrame<ByteBuffer>* output);
 
 private:
+    void openCodec_(AVPixelFormat pixfmt);
     void run_();
 
     static NamedLogger log;
@@ -33,10 +54,14 @@ private:
     LocalClock& clock;
 
     std::atomic<bool> flagRun;
+    std::atomic<bool> flagKeyframeRequested;
 
     CodecType codecType;
     int width, height;
     Rational framerate;
+    int bitrate;
+    bool noPeriodicKeyframes;
+    bool chroma444;
 
     const AVCodec* codec;
     AVCodecContext* avctx;
@@ -53,6 +78,10 @@ private:
 
     bool flagNextFrameAvailable;
     bool flagNextPacketAvailable;
+
+    std::atomic<long long> statCpuTime;
+
+    MetricGauge& metricQueueDepth;
 };
 
 #endif
@@ -10,7 +10,15 @@ using namespace std::chrono_literals;
 TWILIGHT_DEFINE_LOGGER(EncoderOpenH264);
 
 EncoderOpenH264::EncoderOpenH264(LocalClock& clock)
-    : clock(clock), width(-1), height(-1), nextFrameAvailable(false), flagRun(false) {}
+    : clock(clock),
+      width(-1),
+      height(-1),
+      nextFrameAvailable(false),
+      flagRun(false),
+      flagKeyframeRequested(false),
+      metricSkipped(MetricsRegistry::global().counter("twilight_encoder_skipped_frames_total",
+                                                      "Frames the encoder decided not to encode",
+                                                      "encoder=\"openh264\"")) {}
 
 EncoderOpenH264::~EncoderOpenH264() {
     /* acquire data lock */ {
@@ -101,6 +109,11 @@ void EncoderOpenH264::run_() {
         log.assert_quit(pic.pData[1] == pic.pData[0] + (width * height), "Requirement #1 unsatisfied");
         log.assert_quit(pic.pData[2] == pic.pData[1] + (width * height / 4), "Requirement #2 unsatisfied");
 
+        if (flagKeyframeRequested.exchange(false, std::memory_order_relaxed)) {
+            err = encoder->ForceIntraFrame(true);
+            log.assert_quit(err == 0, "Failed to force IDR frame");
+        }
+
         err = encoder->EncodeFrame(&pic, &info);
         log.assert_quit(err == 0, "Failed to encode a frame");
 
@@ -123,7 +136,9 @@ void EncoderOpenH264::run_() {
             onDataAvailable(cap.getOtherType(std::move(combined)));
         } else {
             // FIXME: What happens to sidedata when the frame is skipped?
-            log.warn("Encoder decided to skip a frame");
+            metricSkipped.add();
+            static LogRateLimit skipLimit;
+            log.warn(skipLimit, "Encoder decided to skip a frame");
         }
     }
 
@@ -3,6 +3,7 @@
 
 #include "common/ByteBuffer.h"
 #include "common/DesktopFrame.h"
+#include "common/Metrics.h"
 #include "common/StatisticMixer.h"
 #include "common/ffmpeg-headers.h"
 #include "common/log.h"
@@ -29,6 +30,9 @@ public:
 
     void setResolution(int width, int height);
 
+    // Next frame is encoded as an IDR frame. Safe to call from any thread.
+    void requestKeyframe() { flagKeyframeRequested.store(true, std::memory_order_relaxed); }
+
     void pushData(DesktopFrame<TextureSoftware>&& newData);
 
 private:
@@ -44,12 +48,15 @@ private:
 
     bool nextFrameAvailable;
     std::atomic<bool> flagRun;
+    std::atomic<bool> flagKeyframeRequested;
 
     std::thread runThread;
     std::mutex dataLock;
     std::condition_variable dataCV;
 
     DesktopFrame<TextureSoftware> nextFrame;
+
+    MetricCounter& metricSkipped;
 };
 
 #endif
@@ -7,32 +7,22 @@
 
 #include "common/platform/windows/ComWrapper.h"
 
+#include "server/IAudioCapture.h"
+
 #include <atomic>
 #include <thread>
 
-class AudioCaptureWASAPI {
+class AudioCaptureWASAPI : public IAudioCapture {
 public:
     AudioCaptureWASAPI();
-    ~AudioCaptureWASAPI();
-
-    void start();
-    void stop();
-
-    template <typename Fn>
-    void setOnConfigured(Fn fn) {
-        onConfigured = std::move(fn);
-    }
+    ~AudioCaptureWASAPI() override;
 
-    template <typename Fn>
-    void setOnAudioData(Fn fn) {
-        onAudioData = std::move(fn);
-    }
+    void start() override;
+    void stop() override;
 
 private:
     static NamedLogger log;
 
-    std::function<void(AVSampleFormat, int, int)> onConfigured;  // (format, samplingRate, channels)
-    std::function<void(const uint8_t*, size_t)> onAudioData;     // (data, len_bytes)
     std::thread recordThread;
     std::thread playbackThread;
 
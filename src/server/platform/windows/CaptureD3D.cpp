@@ -306,7 +306,8 @@ void CaptureD3D::parseCursor_(CursorShape* cursorShape, const DXGI_OUTDUPL_POINT
             }
         }
     } else {
-        log.warn("Unknown cursor type: {}", cursorInfo.Type);
+        static LogRateLimit unknownTypeLimit;
+        log.warn(unknownTypeLimit, "Unknown cursor type: {}", cursorInfo.Type);
         cursorShape->image.resize(0);
         cursorShape->height = 0;
         cursorShape->width = 0;
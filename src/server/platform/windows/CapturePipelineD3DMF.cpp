@@ -3,7 +3,11 @@
 TWILIGHT_DEFINE_LOGGER(CapturePipelineD3DMF);
 
 CapturePipelineD3DMF::CapturePipelineD3DMF(LocalClock& clock, DxgiHelper dxgiHelper)
-    : dxgiHelper(dxgiHelper), captureStagingTexHandle(INVALID_HANDLE_VALUE), capture(clock), encoder(clock) {}
+    : dxgiHelper(dxgiHelper),
+      captureStagingTexHandle(INVALID_HANDLE_VALUE),
+      branchId(0),
+      capture(clock),
+      encoder(clock) {}
 
 CapturePipelineD3DMF::~CapturePipelineD3DMF() {
     log.assert_quit(!flagRunning.load(std::memory_order_relaxed), "Destructing without stopping first!");
@@ -39,7 +43,11 @@ bool CapturePipelineD3DMF::init() {
 
     encoder.init(dxgiHelper);
     encoder.open(device, context);
-    encoder.setOnDataAvailable(writeOutput);
+    encoder.setOnDataAvailable([this](DesktopFrame<ByteBuffer>&& frame) {
+        std::lock_guard lock(outputLock);
+        if (branchOutput)
+            branchOutput(std::move(frame));
+    });
 
     return true;
 }
@@ -47,6 +55,7 @@ bool CapturePipelineD3DMF::init() {
 void CapturePipelineD3DMF::start() {
     bool wasRunning = flagRunning.exchange(true, std::memory_order_relaxed);
     log.assert_quit(!wasRunning, "Starting again without stopping first!");
+    log.assert_quit(scale != nullptr, "Branch must be added before start");
 
     if (captureThread.joinable())
         captureThread.join();
@@ -112,12 +121,48 @@ bool CapturePipelineD3DMF::setCaptureMode(int width, int height, Rational framer
     return false;
 }
 
-bool CapturePipelineD3DMF::setEncoderMode(int width, int height, Rational framerate_) {
+size_t CapturePipelineD3DMF::addBranch(const EncoderConfig& config, OutputFn output) {
     // TODO: Make it possible to change mode while running
-    log.assert_quit(!flagRunning, "Can't change mode while running yet");
-    scale = ScaleD3D::createInstance(width, height, ScaleType::NV12);
-    framerate = framerate_;
-    return true;
+    if (flagRunning.load(std::memory_order_relaxed) || branchId != 0) {
+        log.error("Media Foundation pipeline supports only one branch added before start");
+        return 0;
+    }
+
+    // StreamServer doesn't ask for it, as supportsChroma444() is false
+    if (config.chroma444)
+        log.warn("Media Foundation pipeline can't encode 4:4:4; Encoding in 4:2:0");
+
+    // FIXME: EncoderMF uses fixed bitrate
+    scale = ScaleD3D::createInstance(config.width, config.height, ScaleType::NV12);
+    framerate = config.framerate;
+
+    std::lock_guard lock(outputLock);
+    branchId = 1;
+    branchOutput = std::move(output);
+    return branchId;
+}
+
+void CapturePipelineD3DMF::removeBranch(size_t id) {
+    std::lock_guard lock(outputLock);
+    if (id != branchId) {
+        log.warn("Tried to remove unknown branch {}", id);
+        return;
+    }
+
+    // Keeps encoding until stop(), but nobody sees the output
+    branchId = 0;
+    branchOutput = nullptr;
+}
+
+std::chrono::microseconds CapturePipelineD3DMF::getBranchCpuTime(size_t id) {
+    // Encoding happens on GPU; CPU time of the pipeline is negligible
+    return std::chrono::microseconds(0);
+}
+
+void CapturePipelineD3DMF::requestKeyframe(size_t id) {
+    std::lock_guard lock(outputLock);
+    if (id == branchId)
+        encoder.requestKeyframe();
 }
 
 void CapturePipelineD3DMF::captureLoop_() {
@@ -147,6 +192,9 @@ void CapturePipelineD3DMF::captureLoop_() {
 
         bool dirty = frame.desktop.isValid() || frame.cursorPos || frame.cursorShape;
 
+        if (frame.cursorPos && writeCursor)
+            writeCursor(*frame.cursorPos);
+
         if (dirty) {
             std::lock_guard lock(frameLock);
 
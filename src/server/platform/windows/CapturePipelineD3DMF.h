@@ -12,6 +12,7 @@
 #include "server/platform/windows/EncoderMF.h"
 #include "server/platform/windows/ScaleD3D.h"
 
+#include <mutex>
 #include <thread>
 
 class CapturePipelineD3DMF : public CapturePipeline {
@@ -27,7 +28,12 @@ public:
     void getNativeMode(int* width, int* height, Rational* framerate) override;
 
     bool setCaptureMode(int width, int height, Rational framerate) override;
-    bool setEncoderMode(int width, int height, Rational framerate) override;
+
+    // Only one branch is supported, which must be added before start()
+    size_t addBranch(const EncoderConfig& config, OutputFn output) override;
+    void removeBranch(size_t id) override;
+    std::chrono::microseconds getBranchCpuTime(size_t id) override;
+    void requestKeyframe(size_t id) override;
 
 private:
     static NamedLogger log;
@@ -45,6 +51,10 @@ private:
 
     Rational framerate;
 
+    std::mutex outputLock;
+    size_t branchId;
+    OutputFn branchOutput;
+
     std::atomic<bool> flagRunning;
 
     std::mutex frameLock;
@@ -1,5 +1,11 @@
 #include "CapturePipelineD3DSoft.h"
 
+#include "common/util.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
 TWILIGHT_DEFINE_LOGGER(CapturePipelineD3DSoft);
 
 static AVPixelFormat dxgi2avpixfmt(DXGI_FORMAT fmt) {
@@ -24,10 +30,75 @@ static AVPixelFormat scale2avpixfmt(ScaleType type) {
     }
 }
 
+// Longest time the scheduler sleeps, so that new branches are noticed
+static constexpr std::chrono::microseconds MAX_SCHEDULE_SLEEP = std::chrono::milliseconds(20);
+
+// Waiting on a condition variable may oversleep by a scheduler tick, so the last stretch before a deadline
+// is slept with sleepUntil(), which is precise but can't be woken
+static constexpr std::chrono::microseconds SCHEDULE_WAIT_MARGIN = std::chrono::milliseconds(2);
+
+// A 4:4:4 branch falls back to 4:2:0 if it misses more than this ratio of frame ticks over a window
+static constexpr std::chrono::microseconds CHROMA_FALLBACK_WINDOW = std::chrono::seconds(5);
+static constexpr double CHROMA_FALLBACK_SKIP_RATIO = 0.1;
+
+// Unchanged desktop is still encoded this often, so a stream never goes silent
+static constexpr std::chrono::microseconds DEFAULT_IDLE_FRAME_INTERVAL = std::chrono::milliseconds(1000);
+
+// Encode only when the desktop changed, with a frame at least this often while idle. Zero encodes every tick.
+static std::chrono::microseconds idleIntervalFromEnv() {
+    const char* value = getenv("TWILIGHT_IDLE_FRAME_INTERVAL");
+    if (value == nullptr || value[0] == '\0')
+        return DEFAULT_IDLE_FRAME_INTERVAL;
+    return std::chrono::milliseconds(std::max(0, atoi(value)));
+}
+
+// Some applications present without changing anything, which DXGI still reports as a new frame
+static bool isSameImage(const TextureSoftware& a, const TextureSoftware& b) {
+    if (a.isEmpty() || b.isEmpty() || a.width != b.width || a.height != b.height || a.format != b.format)
+        return false;
+
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(a.format);
+    int planes = av_pix_fmt_count_planes(a.format);
+    for (int i = 0; i < planes; i++) {
+        bool isChroma = i == 1 || i == 2;
+        size_t rowBytes = av_image_get_linesize(a.format, a.width, i);
+        int rows = isChroma ? AV_CEIL_RSHIFT(a.height, desc->log2_chroma_h) : a.height;
+
+        // Rows are compared from the bottom, where clocks and taskbars tend to change
+        for (int y = rows; 0 < y--;) {
+            const uint8_t* rowA = a.data[i] + (ptrdiff_t)y * a.linesize[i];
+            const uint8_t* rowB = b.data[i] + (ptrdiff_t)y * b.linesize[i];
+            if (memcmp(rowA, rowB, rowBytes) != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
 CapturePipelineD3DSoft::CapturePipelineD3DSoft(LocalClock& clock, DxgiHelper dxgiHelper)
-    : dxgiHelper(dxgiHelper), scaleType(ScaleType::NV12), flagRun(false), capture(clock), encoder(clock) {}
+    : clock(clock),
+      dxgiHelper(dxgiHelper),
+      scaleType(ScaleType::NV12),
+      idleInterval(idleIntervalFromEnv()),
+      flagRun(false),
+      flagScheduleWake(false),
+      // Tasks mostly wait for their encoder thread, so this only bounds how many branches encode at once
+      encodePool(std::max(2u, std::thread::hardware_concurrency() / 2)),
+      nextBranchId(1),
+      lastCaptureTime(-1),
+      capture(clock),
+      metricUnchanged(MetricsRegistry::global().counter("twilight_capture_unchanged_frames_total",
+                                                        "Captured frames dropped as identical to the previous one")),
+      metricChromaFallbacks(MetricsRegistry::global().counter(
+          "twilight_chroma_fallbacks_total", "Branches moved from 4:4:4 to 4:2:0 for missing frame ticks")) {}
+
+CapturePipelineD3DSoft::~CapturePipelineD3DSoft() {
+    if (flagRun.load(std::memory_order_acquire))
+        stop();
 
-CapturePipelineD3DSoft::~CapturePipelineD3DSoft() {}
+    if (captureThread.joinable())
+        captureThread.join();
+}
 
 bool CapturePipelineD3DSoft::init() {
     auto outputs = dxgiHelper.findAllOutput();
@@ -45,24 +116,42 @@ void CapturePipelineD3DSoft::start() {
 
     if (captureThread.joinable())
         captureThread.join();
-    if (encodeThread.joinable())
-        encodeThread.join();
 
     capture.start();
-    encoder.start();
 
-    timer.setFrequency(framerate);
+    std::vector<Branch*> toStart;
+    /* lock */ {
+        std::lock_guard lock(frameLock);
+        lastCapture = TextureSoftware();
+        for (auto& branch : branches) {
+            branch->firstFrameProvided = false;
+            toStart.push_back(branch.get());
+        }
+    }
+    for (Branch* branch : toStart)
+        startBranch_(branch);
 
     captureThread = std::thread([this]() { loopCapture_(); });
-    encodeThread = std::thread([this]() { loopEncoder_(); });
+    scheduleThread = std::thread([this]() { loopSchedule_(); });
 }
 
 void CapturePipelineD3DSoft::stop() {
     bool wasRunning = flagRun.exchange(false, std::memory_order_acq_rel);
     log.assert_quit(wasRunning, "Stopping when not running!");
 
-    encoder.stop();
     capture.stop();
+    wakeSchedule_();
+    scheduleThread.join();
+
+    // Encode tasks take frameLock, so they must be waited without it
+    std::vector<Branch*> toStop;
+    /* lock */ {
+        std::lock_guard lock(frameLock);
+        for (auto& branch : branches)
+            toStop.push_back(branch.get());
+    }
+    for (Branch* branch : toStop)
+        stopBranch_(branch);
 }
 
 void CapturePipelineD3DSoft::getNativeMode(int* width, int* height, Rational* framerate) {
@@ -73,67 +162,294 @@ bool CapturePipelineD3DSoft::setCaptureMode(int width, int height, Rational fram
     return false;
 }
 
-bool CapturePipelineD3DSoft::setEncoderMode(int width, int height, Rational framerate) {
-    scale.setOutputFormat(width, height, scale2avpixfmt(scaleType));
-    encoder.setMode(width, height, framerate);
+size_t CapturePipelineD3DSoft::addBranch(const EncoderConfig& config, OutputFn output) {
+    auto branch = std::make_unique<Branch>(clock);
+    branch->config = config;
+    branch->output = std::move(output);
+    branch->chroma444 = config.chroma444;
+    branch->scale.setOutputFormat(config.width, config.height,
+                                  scale2avpixfmt(config.chroma444 ? ScaleType::AYUV : scaleType));
+    branch->encoder.setMode(config.width, config.height, config.framerate);
+    branch->encoder.setBitrate(config.bitrate);
+    branch->encoder.setNoPeriodicKeyframes(config.noPeriodicKeyframes);
+    branch->encoder.setChroma444(config.chroma444);
+    branch->pacer.setFramerate(config.framerate);
+    branch->pacer.setIdleInterval(idleInterval);
+    branch->fallbackCheckTime = clock.time();
+
+    Branch* ptr = branch.get();
+    /* lock */ {
+        std::lock_guard lock(frameLock);
+        ptr->id = nextBranchId++;
+        if (!lastCapture.isEmpty())
+            scaleInto_(ptr, lastCapture, lastCaptureTime);
+        branches.push_back(std::move(branch));
+    }
 
-    this->framerate = framerate;
+    if (flagRun.load(std::memory_order_acquire))
+        startBranch_(ptr);
 
-    return true;
+    log.info("Added branch {} ({}x{} @ {:.2f} fps)", ptr->id, config.width, config.height,
+             config.framerate.toFloat());
+    return ptr->id;
+}
+
+void CapturePipelineD3DSoft::removeBranch(size_t id) {
+    std::unique_ptr<Branch> branch;
+
+    /* lock */ {
+        std::lock_guard lock(frameLock);
+        for (auto it = branches.begin(); it != branches.end(); ++it) {
+            if ((*it)->id == id) {
+                branch = std::move(*it);
+                branches.erase(it);
+                break;
+            }
+        }
+    }
+
+    if (branch == nullptr) {
+        log.warn("Tried to remove unknown branch {}", id);
+        return;
+    }
+
+    stopBranch_(branch.get());
+    log.info("Removed branch {}", id);
+}
+
+std::chrono::microseconds CapturePipelineD3DSoft::getBranchCpuTime(size_t id) {
+    std::lock_guard lock(frameLock);
+    for (auto& branch : branches) {
+        if (branch->id == id)
+            return branch->encoder.getCpuTime() +
+                   std::chrono::microseconds(branch->statScaleCpuTime.load(std::memory_order_relaxed) +
+                                             branch->statTaskCpuTime.load(std::memory_order_relaxed));
+    }
+    return std::chrono::microseconds(0);
+}
+
+void CapturePipelineD3DSoft::requestKeyframe(size_t id) {
+    std::lock_guard lock(frameLock);
+    for (auto& branch : branches) {
+        if (branch->id == id) {
+            branch->encoder.requestKeyframe();
+            branch->pacer.markDamage();
+            return;
+        }
+    }
+}
+
+void CapturePipelineD3DSoft::startBranch_(Branch* branch) {
+    branch->encoder.start();
+    branch->flagRun.store(true, std::memory_order_release);
+}
+
+void CapturePipelineD3DSoft::stopBranch_(Branch* branch) {
+    if (!branch->flagRun.exchange(false, std::memory_order_acq_rel))
+        return;
+
+    // Wakes up a task waiting for the encoder
+    branch->encoder.stop();
+
+    std::unique_lock lock(branch->taskLock);
+    log.assert_quit(!branch->busy || std::this_thread::get_id() != branch->taskThread,
+                    "Branch can't be stopped from its own output callback");
+    while (branch->busy)
+        branch->taskCV.wait(lock);
+}
+
+void CapturePipelineD3DSoft::scaleInto_(Branch* branch, const TextureSoftware& tex,
+                                        std::chrono::microseconds timeCaptured) {
+    const auto cpuBegin = threadCpuTime();
+
+    // Scaler is flushed right away, so it never reads the reference later
+    branch->scale.pushInput(
+        TextureSoftware::reference(tex.data, tex.linesize, tex.width, tex.height, tex.format));
+    branch->scale.flush();
+
+    branch->lastFrame.desktop = true;
+    branch->lastFrame.timeCaptured = timeCaptured;
+    branch->lastFrame.timeScaled = clock.time();
+
+    branch->statScaleCpuTime.fetch_add((threadCpuTime() - cpuBegin).count(), std::memory_order_relaxed);
+}
+
+void CapturePipelineD3DSoft::scaleAll_(const TextureSoftware& tex, std::chrono::microseconds timeCaptured) {
+    std::vector<Branch*> order;
+    for (auto& branch : branches)
+        order.push_back(branch.get());
+
+    // Largest first, so each branch can be scaled down from a smaller already converted output
+    // instead of converting the whole capture again
+    std::stable_sort(order.begin(), order.end(), [](const Branch* a, const Branch* b) {
+        return (long long)a->config.width * a->config.height > (long long)b->config.width * b->config.height;
+    });
+
+    for (size_t i = 0; i < order.size(); i++) {
+        const TextureSoftware* source = &tex;
+        for (size_t j = i; 0 < j--;) {
+            const EncoderConfig& prev = order[j]->config;
+            // Chroma lost by 4:2:0 can't be brought back for a 4:4:4 branch
+            if (order[i]->config.width <= prev.width && order[i]->config.height <= prev.height &&
+                prev.width <= tex.width && prev.height <= tex.height && (order[j]->chroma444 || !order[i]->chroma444)) {
+                source = &order[j]->scale.peekOutput();
+                break;
+            }
+        }
+        scaleInto_(order[i], *source, timeCaptured);
+    }
+}
+
+void CapturePipelineD3DSoft::encode_(Branch* branch) {
+    const auto cpuBegin = threadCpuTime();
+
+    DesktopFrame<TextureSoftware> frame;
+    bool hasFrame = false;
+
+    if (branch->flagRun.load(std::memory_order_acquire)) {
+        std::lock_guard lock(frameLock);
+        if (branch->firstFrameProvided || branch->lastFrame.desktop) {
+            branch->firstFrameProvided = true;
+            frame = branch->lastFrame.getOtherType(branch->scale.popOutput());
+            frame.frameId = branch->nextFrameId++;
+            branch->lastFrame.desktop = false;
+            hasFrame = true;
+        }
+    }
+
+    if (hasFrame) {
+        branch->encoder.pushFrame(std::move(frame));
+        DesktopFrame<ByteBuffer> output;
+        if (branch->encoder.readData(&output))
+            branch->output(std::move(output));
+    }
+
+    branch->statTaskCpuTime.fetch_add((threadCpuTime() - cpuBegin).count(), std::memory_order_relaxed);
+
+    // Branch, and the pipeline once stopped, may be freed as soon as taskLock is released with busy cleared
+    std::lock_guard lock(branch->taskLock);
+    branch->busy = false;
+    branch->taskThread = std::thread::id();
+    branch->taskCV.notify_all();
+
+    // Its next tick may be due already
+    wakeSchedule_();
+}
+
+void CapturePipelineD3DSoft::wakeSchedule_() {
+    std::lock_guard lock(scheduleLock);
+    flagScheduleWake = true;
+    scheduleCV.notify_one();
+}
+
+void CapturePipelineD3DSoft::checkChromaFallback_(Branch* branch) {
+    std::chrono::microseconds now = clock.time();
+    if (now - branch->fallbackCheckTime < CHROMA_FALLBACK_WINDOW)
+        return;
+
+    FramePacer::Stat stat = branch->pacer.getStat();
+    uint64_t ticks = stat.ticks - branch->fallbackStat.ticks;
+    uint64_t skipped = stat.skipped - branch->fallbackStat.skipped;
+    branch->fallbackStat = stat;
+    branch->fallbackCheckTime = now;
+
+    if (ticks == 0 || skipped <= ticks * CHROMA_FALLBACK_SKIP_RATIO)
+        return;
+
+    log.warn("Branch {} missed {} of {} frames in 4:4:4; Falling back to 4:2:0", branch->id, skipped, ticks);
+    metricChromaFallbacks.add();
+
+    // Encoder reopens itself as VP9 profile 0 when it sees the new format, so the client keeps its decoder
+    branch->chroma444 = false;
+    branch->scale.setOutputFormat(branch->config.width, branch->config.height, scale2avpixfmt(scaleType));
+    if (!lastCapture.isEmpty())
+        scaleInto_(branch, lastCapture, lastCaptureTime);
+    branch->pacer.markDamage();
 }
 
 void CapturePipelineD3DSoft::loopCapture_() {
-    StatisticMixer mixer(120);
-    std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
-    std::chrono::steady_clock::time_point p = std::chrono::steady_clock::now();
     while (flagRun.load(std::memory_order_acquire)) {
         DesktopFrame<TextureSoftware> frame = capture.readSoftware();
 
+        // lastCapture is only written by this thread, so it can be read without frameLock
+        if (isSameImage(frame.desktop, lastCapture)) {
+            frame.desktop = TextureSoftware();
+            metricUnchanged.add();
+        }
+
         bool dirty = !frame.desktop.isEmpty() || frame.cursorPos || frame.cursorShape;
 
+        if (frame.cursorPos && writeCursor)
+            writeCursor(*frame.cursorPos);
+
         if (dirty) {
             std::lock_guard lock(frameLock);
 
             if (!frame.desktop.isEmpty()) {
-                scale.pushInput(std::move(frame.desktop));
-                scale.flush();
+                scaleAll_(frame.desktop, frame.timeCaptured);
 
-                lastFrame.desktop = true;
-                lastFrame.timeCaptured = frame.timeCaptured;
+                lastCapture = std::move(frame.desktop);
+                lastCaptureTime = frame.timeCaptured;
             }
 
-            if (frame.cursorPos)
-                lastFrame.cursorPos = std::move(frame.cursorPos);
-            if (frame.cursorShape)
-                lastFrame.cursorShape = std::move(frame.cursorShape);
+            for (auto& branch : branches) {
+                if (frame.cursorPos)
+                    branch->lastFrame.cursorPos = frame.cursorPos;
+                if (frame.cursorShape)
+                    branch->lastFrame.cursorShape = frame.cursorShape;
+
+                // Cursor position alone is also sent by writeCursor, so it doesn't need a new frame
+                if (!frame.desktop.isEmpty() || frame.cursorShape)
+                    branch->pacer.markDamage();
+            }
         }
     }
 }
 
-void CapturePipelineD3DSoft::loopEncoder_() {
-    using std::swap;
-
-    bool firstFrameProvided = false;
-
+void CapturePipelineD3DSoft::loopSchedule_() {
     while (flagRun.load(std::memory_order_acquire)) {
-        while (!timer.checkInterval() && flagRun.load(std::memory_order_relaxed))
-            Sleep(1);
+        std::chrono::microseconds wakeTime = clock.time() + MAX_SCHEDULE_SLEEP;
 
-        DesktopFrame<TextureSoftware> frame;
-
-        /* load desktop frame */ {
+        /* lock */ {
             std::lock_guard lock(frameLock);
-            if (!firstFrameProvided && !lastFrame.desktop)
-                continue;
-
-            firstFrameProvided = true;
-            frame = lastFrame.getOtherType(scale.popOutput());
-            lastFrame.desktop = false;
+            for (auto& branch : branches) {
+                if (!branch->flagRun.load(std::memory_order_acquire))
+                    continue;
+
+                if (branch->chroma444)
+                    checkChromaFallback_(branch.get());
+
+                // Encoder is still busy with the previous frame. Ticks passing meanwhile are skipped by the pacer,
+                // and the task wakes the scheduler when it is done.
+                std::lock_guard taskLock(branch->taskLock);
+                if (branch->busy)
+                    continue;
+
+                bool due = branch->pacer.poll();
+                wakeTime = std::min(wakeTime, branch->pacer.nextTick());
+                if (!due)
+                    continue;
+                branch->busy = true;
+
+                Branch* ptr = branch.get();
+                encodePool.submit([this, ptr]() {
+                    /* lock */ {
+                        std::lock_guard lock(ptr->taskLock);
+                        ptr->taskThread = std::this_thread::get_id();
+                    }
+                    encode_(ptr);
+                });
+            }
         }
 
-        encoder.pushFrame(std::move(frame));
-        DesktopFrame<ByteBuffer> output;
-        if (encoder.readData(&output))
-            writeOutput(std::move(output));
+        const auto deadline = clock.toSteady(wakeTime);
+        bool woken;
+        /* lock */ {
+            std::unique_lock lock(scheduleLock);
+            woken = scheduleCV.wait_until(lock, deadline - SCHEDULE_WAIT_MARGIN, [this]() { return flagScheduleWake; });
+            flagScheduleWake = false;
+        }
+        if (!woken)
+            sleepUntil(deadline);
     }
 }
@@ -1,13 +1,14 @@
 #ifndef TWILIGHT_SERVER_PLATFORM_WINDOWS_CAPTUREPIPELINED3DSOFT_H
 #define TWILIGHT_SERVER_PLATFORM_WINDOWS_CAPTUREPIPELINED3DSOFT_H
 
+#include "common/Metrics.h"
+#include "common/ThreadPool.h"
 #include "common/log.h"
 
 #include "common/platform/software/ScaleSoftware.h"
 
-#include "common/platform/windows/QPCTimer.h"
-
 #include "server/CapturePipeline.h"
+#include "server/FramePacer.h"
 
 #include "server/platform/software/EncoderFFmpeg.h"
 #include "server/platform/software/EncoderOpenH264.h"
@@ -15,7 +16,11 @@
 #include "server/platform/windows/CaptureD3D.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 class CapturePipelineD3DSoft : public CapturePipeline {
 public:
@@ -30,30 +35,98 @@ public:
     void getNativeMode(int* width, int* height, Rational* framerate) override;
 
     bool setCaptureMode(int width, int height, Rational framerate) override;
-    bool setEncoderMode(int width, int height, Rational framerate) override;
+    bool supportsChroma444() const override { return true; }
+
+    size_t addBranch(const EncoderConfig& config, OutputFn output) override;
+    void removeBranch(size_t id) override;
+    std::chrono::microseconds getBranchCpuTime(size_t id) override;
+    void requestKeyframe(size_t id) override;
 
 private:
+    struct Branch {
+        explicit Branch(LocalClock& clock)
+            : encoder(clock),
+              pacer(clock),
+              chroma444(false),
+              fallbackCheckTime(0),
+              fallbackStat{0, 0},
+              flagRun(false),
+              busy(false),
+              firstFrameProvided(false),
+              nextFrameId(0),
+              statScaleCpuTime(0),
+              statTaskCpuTime(0) {}
+
+        size_t id;
+        EncoderConfig config;
+        OutputFn output;
+
+        ScaleSoftware scale;  // Guarded by frameLock
+        EncoderFFmpeg encoder;
+        FramePacer pacer;  // Only used by scheduleThread, except for markDamage()
+
+        bool chroma444;  // Guarded by frameLock. Cleared when falling back to 4:2:0.
+        std::chrono::microseconds fallbackCheckTime;  // Only used by scheduleThread
+        FramePacer::Stat fallbackStat;                // Only used by scheduleThread
+
+        std::atomic<bool> flagRun;
+
+        // At most one encode task of a branch is queued or running at a time
+        std::mutex taskLock;
+        std::condition_variable taskCV;
+        bool busy;                   // Guarded by taskLock
+        std::thread::id taskThread;  // Guarded by taskLock
+
+        DesktopFrame<bool> lastFrame;  // Guarded by frameLock
+        bool firstFrameProvided;       // Guarded by frameLock
+        uint64_t nextFrameId;
+
+        std::atomic<long long> statScaleCpuTime;  // Spent by the capture thread
+        std::atomic<long long> statTaskCpuTime;   // Spent by encode tasks
+    };
+
     static NamedLogger log;
 
+    LocalClock& clock;
     ScaleType scaleType;
+    std::chrono::microseconds idleInterval;
 
     DxgiHelper dxgiHelper;
     CaptureD3D capture;
-    ScaleSoftware scale;
-    EncoderFFmpeg encoder;
-
-    Rational framerate;
-    QPCTimer timer;
 
     std::thread captureThread;
-    std::thread encodeThread;
+    std::thread scheduleThread;
     std::atomic<bool> flagRun;
 
+    ThreadPool encodePool;
+
+    // Wakes the scheduler before its deadline, when a branch finished encoding or on stop()
+    std::mutex scheduleLock;
+    std::condition_variable scheduleCV;
+    bool flagScheduleWake;  // Guarded by scheduleLock
+
+    // Guards list of branches, and parts of each branch touched by the capture thread
     std::mutex frameLock;
-    DesktopFrame<bool> lastFrame;
+    std::vector<std::unique_ptr<Branch>> branches;
+    size_t nextBranchId;
+
+    // Kept to give a new branch something to encode before the desktop changes. Guarded by frameLock.
+    TextureSoftware lastCapture;
+    std::chrono::microseconds lastCaptureTime;
+
+    MetricCounter& metricUnchanged;
+    MetricCounter& metricChromaFallbacks;
+
+    void startBranch_(Branch* branch);
+    void stopBranch_(Branch* branch);
+    void scaleInto_(Branch* branch, const TextureSoftware& tex, std::chrono::microseconds timeCaptured);
+    void scaleAll_(const TextureSoftware& tex, std::chrono::microseconds timeCaptured);
+    void encode_(Branch* branch);
+    void checkChromaFallback_(Branch* branch);
+    void wakeSchedule_();
 
     void loopCapture_();
-    void loopEncoder_();
+    void loopSchedule_();
 };
 
 #endif
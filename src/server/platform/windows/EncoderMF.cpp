@@ -106,7 +106,7 @@ static MFTransform getVideoEncoder(const MFDxgiDeviceManager& deviceManager, con
 }
 
 EncoderMF::EncoderMF(LocalClock& clock)
-    : clock(clock), width(-1), height(-1), waitingInput(false), initialized(false) {}
+    : clock(clock), width(-1), height(-1), waitingInput(false), initialized(false), flagKeyframeRequested(false) {}
 
 EncoderMF::~EncoderMF() {}
 
@@ -285,7 +285,8 @@ void EncoderMF::poll() {
             now.isIDR = isIDR;
             onDataAvailable(now.getOtherType(std::move(encoded)));
         } else {
-            log.warn("Ignoring unknown MediaEventType {}", static_cast<DWORD>(evType));
+            static LogRateLimit unknownEventLimit;
+            log.warn(unknownEventLimit, "Ignoring unknown MediaEventType {}", static_cast<DWORD>(evType));
         }
     }
 }
@@ -338,6 +339,14 @@ void EncoderMF::pushEncoderTexture_(const D3D11Texture2D& tex, long long sampleD
     sample->SetSampleDuration(sampleDur);
     sample->SetSampleTime(sampleTime);
 
+    if (flagKeyframeRequested.exchange(false, std::memory_order_relaxed)) {
+        VARIANT value;
+        InitVariantFromUInt32(1, &value);
+        hr = encoder.castTo<ICodecAPI>()->SetValue(&CODECAPI_AVEncVideoForceKeyFrame, &value);
+        if (FAILED(hr))
+            log.warn("Failed to force keyframe");
+    }
+
     hr = encoder->ProcessInput(0, sample.ptr(), 0);
     if (hr == MF_E_NOTACCEPTING)
         return;
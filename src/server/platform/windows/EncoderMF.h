@@ -36,6 +36,9 @@ public:
 
     bool pushFrame(DesktopFrame<D3D11Texture2D>* cap);
 
+    // Next frame pushed is encoded as an IDR frame. Safe to call from any thread.
+    void requestKeyframe() { flagKeyframeRequested.store(true, std::memory_order_relaxed); }
+
 private:
     static NamedLogger log;
 
@@ -46,6 +49,7 @@ private:
 
     bool waitingInput;
     bool initialized;
+    std::atomic<bool> flagKeyframeRequested;
 
     UINT resetToken;
 
@@ -0,0 +1,104 @@
+#ifndef TWILIGHT_TEST_ALLOCATIONCOUNTER_H
+#define TWILIGHT_TEST_ALLOCATIONCOUNTER_H
+
+// Counts heap allocations made by any thread.
+// With glibc, malloc and its relatives are replaced too, which also covers ByteBuffer and C libraries like opus
+// and swresample. Elsewhere only operator new is counted.
+// Replacements can't be inline, so include this from exactly one source file of a test executable.
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+inline std::atomic<size_t> allocationCount = 0;
+
+#if defined(__GLIBC__)
+
+// Real allocator of glibc, which the replacements below forward to
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+extern "C" void* malloc(size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    return memalign(alignment, size);
+}
+
+// Used by av_malloc
+extern "C" int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept {
+    void* ret = memalign(alignment, size);
+    if (ret == nullptr)
+        return ENOMEM;
+    *ptr = ret;
+    return 0;
+}
+
+extern "C" void free(void* ptr) noexcept {
+    __libc_free(ptr);
+}
+
+// Counted by malloc
+inline void* countedNew(size_t size) {
+    return malloc(size == 0 ? 1 : size);
+}
+
+#else
+
+inline void* countedNew(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size == 0 ? 1 : size);
+}
+
+#endif
+
+void* operator new(size_t size) {
+    void* ptr = countedNew(size);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+#endif
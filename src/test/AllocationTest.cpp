@@ -0,0 +1,335 @@
+// Counts heap allocations of steady state hot loops, which are meant to allocate nothing once warmed up:
+//   - AudioEncoder taking captured audio through its ring and encoding it on the worker thread
+//   - NetworkSocket receiving packets into a PacketArena over TLS, with both media header and protobuf framing
+
+#include "test/AllocationCounter.h"
+
+#include "common/ByteBuffer.h"
+#include "common/net/MediaHeader.h"
+#include "common/net/NetworkSocket.h"
+#include "common/net/PacketArena.h"
+
+#include "server/AudioEncoder.h"
+#include "server/IAudioCapture.h"
+#include "server/LocalClock.h"
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+static constexpr size_t WARMUP_ROUNDS = 50;
+static constexpr size_t MEASURED_ROUNDS = 500;
+static constexpr auto PACKET_TIMEOUT = std::chrono::seconds(5);
+
+static constexpr size_t PACKETS_PER_STREAM = 5;  //< As made by makeStream()
+static constexpr int LOOPBACK_PORT = 47310;
+static constexpr int LOOPBACK_PORT_ATTEMPTS = 50;
+
+// Pushes audio on the calling thread, as if it were the capture thread
+class FakeAudioCapture : public IAudioCapture {
+public:
+    static constexpr int SAMPLING_RATE = 48000;
+    static constexpr int CHANNELS = 2;
+
+    void start() override { onConfigured(AV_SAMPLE_FMT_S16, SAMPLING_RATE, CHANNELS); }
+    void stop() override {}
+
+    void push(const int16_t* pcm, size_t frames) {
+        onAudioData(reinterpret_cast<const uint8_t*>(pcm), frames * CHANNELS * sizeof(int16_t));
+    }
+};
+
+// Returns allocations made while encoding MEASURED_ROUNDS packets, or SIZE_MAX if the encoder stopped outputting
+static size_t measureAudioEncoder() {
+    LocalClock clock;
+    auto capture = std::make_unique<FakeAudioCapture>();
+    FakeAudioCapture* fake = capture.get();
+
+    std::atomic<size_t> packets = 0;
+    AudioEncoder encoder(clock, std::move(capture));
+    encoder.setOnAudioData([&](const uint8_t*, size_t, std::chrono::microseconds) {
+        packets.fetch_add(1, std::memory_order_release);
+    });
+
+    AudioEncoder::Config config;
+    config.frameDuration = 20'000;
+    encoder.setConfig(config);
+    encoder.start();
+
+    // 10ms of a 440Hz tone; Two of them make a packet
+    const size_t chunkFrames = FakeAudioCapture::SAMPLING_RATE / 100;
+    std::vector<int16_t> chunk(chunkFrames * FakeAudioCapture::CHANNELS);
+    for (size_t i = 0; i < chunkFrames; i++) {
+        auto val = static_cast<int16_t>(8000 * std::sin(2 * 3.14159265 * 440 * i / FakeAudioCapture::SAMPLING_RATE));
+        chunk[i * 2] = chunk[i * 2 + 1] = val;
+    }
+
+    // Waits for each packet, so that input never overflows the ring
+    auto runRounds = [&](size_t rounds) {
+        for (size_t i = 0; i < rounds; i++) {
+            size_t target = packets.load(std::memory_order_acquire) + 1;
+            fake->push(chunk.data(), chunkFrames);
+            fake->push(chunk.data(), chunkFrames);
+
+            auto deadline = std::chrono::steady_clock::now() + PACKET_TIMEOUT;
+            while (packets.load(std::memory_order_acquire) < target) {
+                if (deadline < std::chrono::steady_clock::now())
+                    return false;
+                std::this_thread::yield();
+            }
+        }
+        return true;
+    };
+
+    size_t ret = SIZE_MAX;
+    if (runRounds(WARMUP_ROUNDS)) {
+        size_t before = allocationCount.load(std::memory_order_relaxed);
+        if (runRounds(MEASURED_ROUNDS))
+            ret = allocationCount.load(std::memory_order_relaxed) - before;
+    }
+
+    encoder.stop();
+    return ret;
+}
+
+// Same framing as NetworkSocket::send
+static void appendPacket(std::string* stream, const msg::Packet& pkt, size_t extraDataLen) {
+    uint8_t header[MediaHeader::MAX_SIZE];
+    size_t headerLen = MediaHeader::encode(pkt, header);
+    if (headerLen != 0) {
+        stream->append(reinterpret_cast<const char*>(header), headerLen);
+    } else {
+        google::protobuf::io::StringOutputStream output(stream);
+        google::protobuf::io::CodedOutputStream coded(&output);
+        coded.WriteVarint64(pkt.ByteSizeLong());
+        pkt.SerializeToCodedStream(&coded);
+    }
+    stream->append(extraDataLen, '\x5a');
+}
+
+static std::string makeStream() {
+    std::string stream;
+    msg::Packet pkt;
+
+    pkt.set_extra_data_len(30'000);
+    auto* desktopFrame = pkt.mutable_desktop_frame();
+    desktopFrame->set_cursor_visible(true);
+    desktopFrame->set_cursor_x(100);
+    desktopFrame->set_cursor_y(200);
+    desktopFrame->set_frame_id(1234);
+    desktopFrame->set_time_captured(1'000'000);
+    desktopFrame->set_time_encoded(1'005'000);
+    appendPacket(&stream, pkt, pkt.extra_data_len());
+
+    pkt.set_extra_data_len(160);
+    auto* audioFrame = pkt.mutable_audio_frame();
+    audioFrame->set_channels(2);
+    audioFrame->set_sequence(99);
+    audioFrame->set_time_captured(1'002'000);
+    appendPacket(&stream, pkt, pkt.extra_data_len());
+
+    pkt.set_extra_data_len(0);
+    auto* cursorPosition = pkt.mutable_cursor_position();
+    cursorPosition->set_visible(true);
+    cursorPosition->set_x(10);
+    cursorPosition->set_y(20);
+    appendPacket(&stream, pkt, pkt.extra_data_len());
+
+    pkt.set_extra_data_len(32 * 32 * 4);
+    auto* cursorShape = pkt.mutable_cursor_shape();
+    cursorShape->set_width(32);
+    cursorShape->set_height(32);
+    cursorShape->set_id(0x1234'5678'9abc'def0);
+    appendPacket(&stream, pkt, pkt.extra_data_len());
+
+    pkt.set_extra_data_len(0);
+    auto* pingRequest = pkt.mutable_ping_request();
+    pingRequest->set_id(7);
+    pingRequest->set_latency(1500);
+    appendPacket(&stream, pkt, pkt.extra_data_len());
+
+    return stream;
+}
+
+// Either end of a loopback TLS connection. Uses a pre-shared key, so that no certificate has to be generated.
+struct LoopbackTlsConfig {
+    mbedtls_ssl_config conf;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+
+    LoopbackTlsConfig() {
+        mbedtls_ssl_config_init(&conf);
+        mbedtls_entropy_init(&entropy);
+        mbedtls_ctr_drbg_init(&ctr_drbg);
+    }
+
+    ~LoopbackTlsConfig() {
+        mbedtls_ssl_config_free(&conf);
+        mbedtls_ctr_drbg_free(&ctr_drbg);
+        mbedtls_entropy_free(&entropy);
+    }
+
+    bool setup(int endpoint) {
+        static constexpr char psk[] = "twilight-allocation-test";
+        static constexpr char pskIdentity[] = "test";
+
+        if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, nullptr, 0) != 0)
+            return false;
+        if (mbedtls_ssl_config_defaults(&conf, endpoint, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+            return false;
+        mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+        mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
+        return mbedtls_ssl_conf_psk(&conf, reinterpret_cast<const uint8_t*>(psk), sizeof(psk) - 1,
+                                    reinterpret_cast<const uint8_t*>(pskIdentity), sizeof(pskIdentity) - 1) == 0;
+    }
+};
+
+// Connects two TCP sockets over loopback, on the first free port from LOOPBACK_PORT
+static bool connectLoopback(mbedtls_net_context* client, mbedtls_net_context* server) {
+    mbedtls_net_context listener;
+    mbedtls_net_init(&listener);
+
+    char portString[8] = {};
+    bool bound = false;
+    for (int i = 0; i < LOOPBACK_PORT_ATTEMPTS && !bound; i++) {
+        sprintf(portString, "%d", LOOPBACK_PORT + i);
+        bound = mbedtls_net_bind(&listener, "127.0.0.1", portString, MBEDTLS_NET_PROTO_TCP) == 0;
+    }
+
+    // Kernel completes the connection before it is accepted
+    bool ret = bound && mbedtls_net_connect(client, "127.0.0.1", portString, MBEDTLS_NET_PROTO_TCP) == 0 &&
+               mbedtls_net_accept(&listener, server, nullptr, 0, nullptr) == 0;
+    mbedtls_net_free(&listener);
+    return ret;
+}
+
+// Writes `stream` over TLS `rounds` times, as the sending side of a connection would
+static void sendRounds(mbedtls_net_context* net, const mbedtls_ssl_config* conf, const std::string& stream,
+                       size_t rounds) {
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_init(&ssl);
+
+    if (mbedtls_ssl_setup(&ssl, conf) == 0) {
+        mbedtls_ssl_set_bio(&ssl, net, mbedtls_net_send, mbedtls_net_recv, nullptr);
+
+        if (mbedtls_ssl_handshake(&ssl) == 0) {
+            const auto* data = reinterpret_cast<const uint8_t*>(stream.data());
+            for (size_t i = 0; i < rounds; i++) {
+                size_t offset = 0;
+                while (offset < stream.size()) {
+                    int stat = mbedtls_ssl_write(&ssl, data + offset, stream.size() - offset);
+                    if (stat < 0)
+                        break;
+                    offset += stat;
+                }
+                if (offset < stream.size())
+                    break;
+            }
+            mbedtls_ssl_close_notify(&ssl);
+        }
+    }
+
+    mbedtls_ssl_free(&ssl);
+}
+
+// Returns allocations made while NetworkSocket receives the stream MEASURED_ROUNDS times over a loopback TLS
+// connection, the same way Connection does. SIZE_MAX if the connection failed.
+static size_t measureNetworkSocket() {
+    const std::string stream = makeStream();
+
+    LoopbackTlsConfig clientConfig;
+    LoopbackTlsConfig serverConfig;
+    if (!clientConfig.setup(MBEDTLS_SSL_IS_CLIENT) || !serverConfig.setup(MBEDTLS_SSL_IS_SERVER))
+        return SIZE_MAX;
+
+    mbedtls_net_context clientNet;
+    mbedtls_net_context serverNet;
+    mbedtls_net_init(&clientNet);
+    mbedtls_net_init(&serverNet);
+    if (!connectLoopback(&clientNet, &serverNet)) {
+        mbedtls_net_free(&clientNet);
+        mbedtls_net_free(&serverNet);
+        return SIZE_MAX;
+    }
+
+    std::thread sender(sendRounds, &clientNet, &clientConfig.conf, std::cref(stream), WARMUP_ROUNDS + MEASURED_ROUNDS);
+
+    size_t ret = SIZE_MAX;
+    /* receive */ {
+        // Takes ownership of serverNet, and handshakes with sender
+        NetworkSocket sock(serverNet, &serverConfig.conf);
+        PacketArena arena;
+        ByteBuffer extraData;
+
+        auto receiveRound = [&]() {
+            for (size_t i = 0; i < PACKETS_PER_STREAM; i++) {
+                msg::Packet& pkt = arena.next();
+                if (!sock.recv(&pkt, &extraData))
+                    return false;
+            }
+            return true;
+        };
+
+        bool ok = true;
+        for (size_t i = 0; ok && i < WARMUP_ROUNDS; i++)
+            ok = receiveRound();
+
+        size_t before = allocationCount.load(std::memory_order_relaxed);
+        for (size_t i = 0; ok && i < MEASURED_ROUNDS; i++)
+            ok = receiveRound();
+        if (ok)
+            ret = allocationCount.load(std::memory_order_relaxed) - before;
+
+        // Sender is done once everything has been read; Otherwise disconnecting makes its writes fail
+        if (ok)
+            sender.join();
+        sock.disconnect();
+    }
+
+    if (sender.joinable())
+        sender.join();
+    mbedtls_net_free(&clientNet);
+    return ret;
+}
+
+int main() {
+    int errors = 0;
+
+    size_t audioAllocs = measureAudioEncoder();
+    if (audioAllocs == SIZE_MAX) {
+        printf("AudioEncoder: timed out waiting for a packet\n");
+        errors++;
+    } else {
+        printf("AudioEncoder: %zu allocations in %zu packets\n", audioAllocs, MEASURED_ROUNDS);
+        if (audioAllocs != 0)
+            errors++;
+    }
+
+    size_t socketAllocs = measureNetworkSocket();
+    if (socketAllocs == SIZE_MAX) {
+        printf("NetworkSocket: failed to connect or to receive the stream\n");
+        errors++;
+    } else {
+        printf("NetworkSocket: %zu allocations in %zu rounds of %zu packets\n", socketAllocs, MEASURED_ROUNDS,
+               PACKETS_PER_STREAM);
+        if (socketAllocs != 0)
+            errors++;
+    }
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+// Feeds AudioJitterBuffer with opus packets from a server whose audio clock runs off by a couple hundred ppm, over a
+// network that randomly loses packets. The consumer reads like an audio device running on the local clock.
+// Buffered depth must settle near the target without ever changing speed beyond MAX_SPEED_ADJUST, and every lost
+// packet must be concealed.
+
+#include "client/AudioJitterBuffer.h"
+#include "client/NetworkClock.h"
+
+#include <opus.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+static constexpr long long SIMULATED_TIME = 120'000'000;  // 2 minutes
+static constexpr long long SETTLE_TIME = 60'000'000;
+
+static constexpr int PACKET_FRAMES = AudioJitterBuffer::SAMPLE_RATE / 50;  // 20ms, as AudioEncoder defaults
+static constexpr int READ_FRAMES = AudioJitterBuffer::SAMPLE_RATE / 100;   // 10ms, as a typical device period
+static constexpr double LOSS_RATE = 0.05;
+static constexpr int MAX_CONSECUTIVE_LOSS = 3;  //< Below what AudioJitterBuffer conceals
+
+// Mean depth after SETTLE_TIME. Depth is sampled after reads, so it sits half a packet above what write sees.
+// Without drift compensation, the skew alone would move it by far more than this within SIMULATED_TIME.
+static constexpr float MAX_DEPTH_ERROR = 8.0f;  // ms
+
+struct Result {
+    float meanDepth;
+    float targetDepth;
+    float maxSpeedAdjust;
+    uint64_t lost;
+    uint64_t concealed;
+};
+
+static Result simulate(double skew, unsigned seed) {
+    std::mt19937 random(seed);
+    std::bernoulli_distribution isLost(LOSS_RATE);
+
+    int stat;
+    OpusEncoder* enc = opus_encoder_create(AudioJitterBuffer::SAMPLE_RATE, AudioJitterBuffer::CHANNELS,
+                                           OPUS_APPLICATION_AUDIO, &stat);
+    if (stat != OPUS_OK) {
+        printf("Failed to create opus encoder: %s\n", opus_strerror(stat));
+        return Result{0, 0, 0, 0, 1};
+    }
+    opus_encoder_ctl(enc, OPUS_SET_BITRATE(64000));
+    opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(1));
+    opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(static_cast<int>(LOSS_RATE * 100)));
+
+    AudioJitterBuffer buffer(std::make_shared<NetworkClock>());
+    const float targetDepth = buffer.getStat().targetDepth;
+
+    std::vector<float> pcm(PACKET_FRAMES * AudioJitterBuffer::CHANNELS);
+    std::vector<uint8_t> packet(1500);
+    std::vector<float> output(READ_FRAMES * AudioJitterBuffer::CHANNELS);
+    long long generatedFrames = 0;
+
+    Result result = {0, targetDepth, 0, 0, 0};
+    uint32_t seq = 0;
+    int consecutiveLoss = 0;
+    double depthSum = 0;
+    long long depthCount = 0;
+
+    for (long long now = 0; now < SIMULATED_TIME; now += READ_FRAMES * 1'000'000LL / AudioJitterBuffer::SAMPLE_RATE) {
+        // Server sends each packet as soon as it is captured, on its own clock
+        while (seq * PACKET_FRAMES * 1'000'000.0 / AudioJitterBuffer::SAMPLE_RATE <= now * (1 + skew)) {
+            for (int i = 0; i < PACKET_FRAMES; i++, generatedFrames++) {
+                float val = 0.3f * std::sin(2 * 3.14159265f * 440 * generatedFrames / AudioJitterBuffer::SAMPLE_RATE);
+                pcm[i * 2] = pcm[i * 2 + 1] = val;
+            }
+
+            int len = opus_encode_float(enc, pcm.data(), PACKET_FRAMES, packet.data(), packet.size());
+            if (len <= 0) {
+                printf("Failed to encode opus packet: %s\n", opus_strerror(len));
+                opus_encoder_destroy(enc);
+                return Result{0, 0, 0, 0, 1};
+            }
+
+            if (consecutiveLoss < MAX_CONSECUTIVE_LOSS && isLost(random)) {
+                consecutiveLoss++;
+            } else {
+                // Losses only show up once a later packet arrives
+                result.lost += consecutiveLoss;
+                consecutiveLoss = 0;
+                buffer.pushPacket(seq, std::chrono::microseconds(0), packet.data(), len);
+            }
+            seq++;
+        }
+
+        buffer.read(output.data(), READ_FRAMES);
+
+        AudioJitterBuffer::Stat bufferStat = buffer.getStat();
+        result.maxSpeedAdjust = std::max(result.maxSpeedAdjust, std::abs(bufferStat.speed - 1.0f));
+        if (SETTLE_TIME <= now) {
+            depthSum += bufferStat.depth;
+            depthCount++;
+        }
+    }
+
+    result.meanDepth = static_cast<float>(depthSum / depthCount);
+    result.concealed = buffer.getStat().concealed;
+
+    opus_encoder_destroy(enc);
+    return result;
+}
+
+int main() {
+    int errors = 0;
+
+    for (double skew : {200e-6, -200e-6}) {
+        for (unsigned seed = 1; seed <= 3; seed++) {
+            Result result = simulate(skew, seed);
+            bool ok = std::abs(result.meanDepth - result.targetDepth) <= MAX_DEPTH_ERROR &&
+                      result.maxSpeedAdjust <= AudioJitterBuffer::MAX_SPEED_ADJUST &&
+                      result.concealed == result.lost;
+            printf("skew %+4.0f ppm seed %u: depth %5.1f ms (target %4.1f), speed off by up to %6.4f, "
+                   "%3llu lost, %3llu concealed%s\n",
+                   skew * 1e6, seed, result.meanDepth, result.targetDepth, result.maxSpeedAdjust,
+                   (unsigned long long)result.lost, (unsigned long long)result.concealed, ok ? "" : "  FAIL");
+            if (!ok)
+                errors++;
+        }
+    }
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+// Drives ClockEstimator with a simulated remote clock that runs off by a few tens of ppm, over a network with
+// queueing delay on both directions and occasional spikes. Pings are scheduled the way NetworkClock does.
+// Once warmed up, drift and offset estimates must stay close to the truth, and closer once drift has settled.
+
+#include "client/ClockEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+static constexpr long long SIMULATED_TIME = 600'000'000;  // 10 minutes
+static constexpr long long WARMUP_TIME = 30'000'000;
+static constexpr long long SETTLE_TIME = 120'000'000;
+
+static constexpr double MAX_WARM_DRIFT_ERROR = 25e-6;    //< After WARMUP_TIME
+static constexpr double MAX_SETTLED_DRIFT_ERROR = 8e-6;  //< After SETTLE_TIME
+static constexpr long long MAX_OFFSET_ERROR = 1000;      //< After WARMUP_TIME
+
+// Same as NetworkClock
+static constexpr long long TARGET_ERROR = 500;
+static constexpr long long WARMUP_PING_INTERVAL = 20'000;
+static constexpr long long MIN_PING_INTERVAL = 100'000;
+static constexpr long long MAX_PING_INTERVAL = 10'000'000;
+static constexpr long long POLL_INTERVAL = 15'000;
+static constexpr long long DRIFT_PING_INTERVAL = 500'000;
+static constexpr double TARGET_DRIFT_UNCERTAINTY = 10e-6;
+
+struct Result {
+    double maxWarmDriftError;
+    double maxSettledDriftError;
+    long long maxOffsetError;
+    int pings;
+};
+
+static Result simulate(double skew, unsigned seed) {
+    std::mt19937_64 random(seed);
+    std::exponential_distribution<double> queueing(1.0 / 1500);
+    std::uniform_real_distribution<double> spike(0, 20'000);
+    std::bernoulli_distribution hasSpike(0.05);
+
+    auto oneWayDelay = [&]() {
+        double ret = 3000 + queueing(random);
+        if (hasSpike(random))
+            ret += spike(random);
+        return static_cast<long long>(ret);
+    };
+
+    const long long initialOffset = 123'456'789;
+    auto remoteAt = [&](long long local) { return initialOffset + static_cast<long long>(local * (1 + skew)); };
+
+    ClockEstimator estimator;
+    Result result = {0, 0, 0, 0};
+    long long lastPing = 0;
+
+    for (long long now = 0; now < SIMULATED_TIME; now += POLL_INTERVAL) {
+        long long elapsed = now - lastPing;
+        bool due;
+        if (!estimator.converged())
+            due = WARMUP_PING_INTERVAL <= elapsed;
+        else if (MAX_PING_INTERVAL <= elapsed)
+            due = true;
+        else
+            due = (MIN_PING_INTERVAL <= elapsed && TARGET_ERROR < estimator.errorAt(now)) ||
+                  (DRIFT_PING_INTERVAL <= elapsed && TARGET_DRIFT_UNCERTAINTY < estimator.getDriftUncertainty());
+        if (!due)
+            continue;
+
+        lastPing = now;
+        result.pings++;
+
+        long long answered = now + oneWayDelay();
+        long long received = answered + oneWayDelay();
+        estimator.addSample(now, remoteAt(answered), received);
+
+        if (received < WARMUP_TIME)
+            continue;
+
+        double driftError = std::abs(estimator.getDrift() - skew);
+        result.maxWarmDriftError = std::max(result.maxWarmDriftError, driftError);
+        if (SETTLE_TIME <= received)
+            result.maxSettledDriftError = std::max(result.maxSettledDriftError, driftError);
+
+        long long trueOffset = remoteAt(received) - received;
+        result.maxOffsetError = std::max(result.maxOffsetError, std::abs(estimator.offsetAt(received) - trueOffset));
+    }
+
+    return result;
+}
+
+int main() {
+    int errors = 0;
+
+    for (double skew : {40e-6, -40e-6, 0.0}) {
+        for (unsigned seed = 1; seed <= 20; seed++) {
+            Result result = simulate(skew, seed);
+            bool ok = result.maxWarmDriftError <= MAX_WARM_DRIFT_ERROR &&
+                      result.maxSettledDriftError <= MAX_SETTLED_DRIFT_ERROR &&
+                      result.maxOffsetError <= MAX_OFFSET_ERROR;
+            printf("skew %+5.1f ppm seed %2u: %4d pings, drift error up to %4.1f ppm (%3.1f ppm settled), "
+                   "offset error up to %4lld us%s\n",
+                   skew * 1e6, seed, result.pings, result.maxWarmDriftError * 1e6, result.maxSettledDriftError * 1e6,
+                   result.maxOffsetError, ok ? "" : "  FAIL");
+            if (!ok)
+                errors++;
+        }
+    }
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// Plays cursor shape changes through a server and a client CursorShapeCache the way Connection and StreamViewerD3D
+// use them. The server must evict exactly what a brute force LRU would, every shape it sends by id must be found
+// on the client with the same content, and shapes that fit the cache must only ever be sent once.
+
+#include "common/CursorShapeCache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+static constexpr int SWITCH_COUNT = 20'000;
+
+struct Result {
+    int sentFull;
+    int sentCached;
+    int lruMismatches;  //< Server cache disagreed with the reference LRU
+    int clientMisses;   //< Client didn't have a shape the server referred to by id
+    int wrongShapes;    //< Client had a shape under the id, but not the same one
+};
+
+static std::vector<std::shared_ptr<CursorShape>> makeShapes(int count, std::mt19937& random) {
+    std::vector<std::shared_ptr<CursorShape>> ret;
+    for (int i = 0; i < count; i++) {
+        auto shape = std::make_shared<CursorShape>();
+        shape->width = 32;
+        shape->height = 32;
+        shape->hotspotX = 0;
+        shape->hotspotY = 0;
+        shape->format = i % 3 == 0 ? CursorShapeFormat::RGBA_XOR : CursorShapeFormat::RGBA;
+        shape->image.resize(32 * 32 * 4);
+        for (size_t j = 0; j < shape->image.size(); j++)
+            shape->image[j] = static_cast<uint8_t>(random());
+        ret.push_back(std::move(shape));
+    }
+    return ret;
+}
+
+// Most switches go between a few hot shapes, the rest pick any
+static Result simulate(int shapeCount, int hotCount, unsigned seed) {
+    std::mt19937 random(seed);
+    std::vector<std::shared_ptr<CursorShape>> shapes = makeShapes(shapeCount, random);
+    std::uniform_int_distribution<int> pickHot(0, hotCount - 1);
+    std::uniform_int_distribution<int> pickAny(0, shapeCount - 1);
+    std::bernoulli_distribution isHot(0.9);
+
+    CursorShapeCache server, client;
+    std::map<uint64_t, int> lastUsed;  //< Reference LRU, keyed by id
+
+    Result result = {0, 0, 0, 0, 0};
+    for (int step = 0; step < SWITCH_COUNT; step++) {
+        const CursorShape& shape = *shapes[isHot(random) ? pickHot(random) : pickAny(random)];
+        uint64_t id = CursorShapeCache::hash(shape);
+
+        bool expected = lastUsed.count(id) != 0;
+        if (!expected && lastUsed.size() == CursorShapeCache::CAPACITY) {
+            auto oldest = lastUsed.begin();
+            for (auto itr = lastUsed.begin(); itr != lastUsed.end(); ++itr) {
+                if (itr->second < oldest->second)
+                    oldest = itr;
+            }
+            lastUsed.erase(oldest);
+        }
+        lastUsed[id] = step;
+
+        // As Connection::sendCursorShape
+        bool cached = server.find(id);
+        if (!cached)
+            server.insert(id, nullptr);
+        if (cached != expected)
+            result.lruMismatches++;
+
+        // As StreamViewerD3D::processCursorShape
+        if (cached) {
+            result.sentCached++;
+            std::shared_ptr<CursorShape> found;
+            if (!client.find(id, &found))
+                result.clientMisses++;
+            else if (CursorShapeCache::hash(*found) != id)
+                result.wrongShapes++;
+        } else {
+            result.sentFull++;
+            auto received = std::make_shared<CursorShape>();
+            received->width = shape.width;
+            received->height = shape.height;
+            received->hotspotX = shape.hotspotX;
+            received->hotspotY = shape.hotspotY;
+            received->format = shape.format;
+            received->image = shape.image.clone();
+            client.insert(id, std::move(received));
+        }
+    }
+
+    return result;
+}
+
+int main() {
+    int errors = 0;
+
+    struct Scenario {
+        int shapeCount;
+        int hotCount;
+    };
+    static constexpr Scenario scenarios[] = {
+        {static_cast<int>(CursorShapeCache::CAPACITY), 4},
+        {64, 4},
+        {64, static_cast<int>(CursorShapeCache::CAPACITY) + 4},
+    };
+
+    for (const Scenario& scenario : scenarios) {
+        for (unsigned seed = 1; seed <= 3; seed++) {
+            Result result = simulate(scenario.shapeCount, scenario.hotCount, seed);
+            bool ok = result.lruMismatches == 0 && result.clientMisses == 0 && result.wrongShapes == 0;
+            if (scenario.shapeCount <= static_cast<int>(CursorShapeCache::CAPACITY))
+                ok = ok && result.sentFull <= scenario.shapeCount;
+            printf("%2d shapes, %2d hot, seed %u: %5d sent, %5d by id, %d LRU mismatches, %d missing, %d wrong%s\n",
+                   scenario.shapeCount, scenario.hotCount, seed, result.sentFull, result.sentCached,
+                   result.lruMismatches, result.clientMisses, result.wrongShapes, ok ? "" : "  FAIL");
+            if (!ok)
+                errors++;
+        }
+    }
+
+    // Anything that changes how the cursor looks must change the id
+    std::mt19937 random(1);
+    std::vector<std::shared_ptr<CursorShape>> shapes = makeShapes(1, random);
+    CursorShape moved;
+    moved.width = shapes[0]->width;
+    moved.height = shapes[0]->height;
+    moved.hotspotX = shapes[0]->hotspotX + 1;
+    moved.hotspotY = shapes[0]->hotspotY;
+    moved.format = shapes[0]->format;
+    moved.image = shapes[0]->image.clone();
+    bool ok = CursorShapeCache::hash(moved) != CursorShapeCache::hash(*shapes[0]);
+    moved.hotspotX--;
+    ok = ok && CursorShapeCache::hash(moved) == CursorShapeCache::hash(*shapes[0]);
+    moved.image[0] ^= 1;
+    ok = ok && CursorShapeCache::hash(moved) != CursorShapeCache::hash(*shapes[0]);
+    printf("hash follows hotspot and image%s\n", ok ? "" : "  FAIL");
+    if (!ok)
+        errors++;
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+// Runs FramePacer in simulated time under a scheduler loop like CapturePipelineD3DSoft's, which wakes a little late
+// for each tick and is blocked while the encoder is busy. Ticks must stay on the framerate grid without drifting,
+// ticks missed while busy must be skipped instead of caught up, and in idle mode a damaged desktop must be taken
+// on the next tick while an unchanged one is still refreshed every idle interval.
+
+#include "server/FramePacer.h"
+#include "server/LocalClock.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+
+static constexpr long long SIMULATED_TIME = 100'000'000;  // 100 seconds
+static constexpr long long MAX_WAKE_LATENCY = 500;        //< Scheduler wakes up to this late
+
+static long long simulatedNow = 0;
+
+static long long simulatedClock() {
+    return simulatedNow;
+}
+
+struct Scenario {
+    const char* name;
+    Rational framerate;
+    long long encodeTime;
+    long long idleInterval;  //< Zero takes every tick
+    long long damageEvery;   //< Mean time between desktop changes, zero if it never changes
+};
+
+struct Result {
+    uint64_t taken;
+    uint64_t ticks;          //< As FramePacer counted
+    uint64_t expectedTicks;  //< On the exact grid, until the last poll
+    uint64_t skipped;
+    long long maxLateness;    //< From the latest tick on the exact grid to taking it
+    long long minGap;         //< Between taken ticks
+    long long maxGap;
+    long long maxDamageWait;  //< From a desktop change to the next taken tick
+};
+
+// Index of the latest tick at or before `time`, where tick k is due at floor(k / framerate) seconds
+static long long latestTick(Rational framerate, long long time) {
+    return ((time + 1) * framerate.num() - 1) / (framerate.den() * 1'000'000LL);
+}
+
+static long long tickTime(Rational framerate, long long index) {
+    return index * framerate.den() * 1'000'000LL / framerate.num();
+}
+
+static Result simulate(const Scenario& scenario, unsigned seed) {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<long long> wakeLatency(0, MAX_WAKE_LATENCY);
+    std::exponential_distribution<double> damageInterval(scenario.damageEvery > 0 ? 1.0 / scenario.damageEvery : 1);
+
+    simulatedNow = 0;
+    LocalClock clock(&simulatedClock);
+    FramePacer pacer(clock);
+    pacer.setFramerate(scenario.framerate);
+    pacer.setIdleInterval(std::chrono::microseconds(scenario.idleInterval));
+
+    Result result = {0, 0, 0, 0, 0, LLONG_MAX, 0, 0};
+    long long nextDamage = scenario.damageEvery > 0 ? static_cast<long long>(damageInterval(random)) : LLONG_MAX;
+    long long pendingDamage = -1;  //< Earliest change not yet taken
+    long long lastTaken = -1;
+    long long lastPoll = 0;
+
+    while (simulatedNow < SIMULATED_TIME) {
+        while (nextDamage <= simulatedNow) {
+            pacer.markDamage();
+            if (pendingDamage < 0)
+                pendingDamage = nextDamage;
+            nextDamage += std::max(1LL, static_cast<long long>(damageInterval(random)));
+        }
+
+        lastPoll = simulatedNow;
+        if (pacer.poll()) {
+            result.taken++;
+            long long tick = latestTick(scenario.framerate, simulatedNow);
+            result.maxLateness = std::max(result.maxLateness, simulatedNow - tickTime(scenario.framerate, tick));
+            if (0 <= lastTaken) {
+                result.minGap = std::min(result.minGap, simulatedNow - lastTaken);
+                result.maxGap = std::max(result.maxGap, simulatedNow - lastTaken);
+            }
+            if (0 <= pendingDamage)
+                result.maxDamageWait = std::max(result.maxDamageWait, simulatedNow - pendingDamage);
+            pendingDamage = -1;
+            lastTaken = simulatedNow;
+
+            // Scheduler skips the branch until the encoder task is done and wakes it
+            simulatedNow += scenario.encodeTime;
+            continue;
+        }
+
+        simulatedNow = std::max(simulatedNow + 1, pacer.nextTick().count() + wakeLatency(random));
+    }
+
+    FramePacer::Stat stat = pacer.getStat();
+    result.ticks = stat.ticks;
+    result.skipped = stat.skipped;
+    result.expectedTicks = latestTick(scenario.framerate, lastPoll) + 1;
+    return result;
+}
+
+int main() {
+    static const Scenario scenarios[] = {
+        {"60fps", Rational(60, 1), 5'000, 0, 0},
+        {"59.94fps", Rational(60000, 1001), 5'000, 0, 0},
+        {"60fps, slow encoder", Rational(60, 1), 25'000, 0, 0},
+        {"30fps, idle", Rational(30, 1), 5'000, 500'000, 0},
+        {"60fps, idle with damage", Rational(60, 1), 5'000, 500'000, 300'000},
+    };
+
+    int errors = 0;
+
+    for (const Scenario& scenario : scenarios) {
+        for (unsigned seed = 1; seed <= 3; seed++) {
+            Result result = simulate(scenario, seed);
+            long long interval = tickTime(scenario.framerate, 1) + 1;
+
+            // Grid never drifts, whatever happens to the caller
+            bool ok = result.ticks == result.expectedTicks;
+            if (scenario.idleInterval == 0 && scenario.encodeTime < interval) {
+                // Every tick is taken, only late by wake latency
+                ok = ok && result.taken == result.ticks && result.skipped == 0 &&
+                     result.maxLateness <= MAX_WAKE_LATENCY;
+            } else if (scenario.idleInterval == 0) {
+                // Taken as soon as the encoder is done, without catching up on missed ticks
+                ok = ok && 0 < result.skipped && result.taken + result.skipped == result.ticks &&
+                     scenario.encodeTime <= result.minGap && result.maxLateness < interval &&
+                     result.maxGap <= scenario.encodeTime + interval + MAX_WAKE_LATENCY;
+            } else {
+                // Unchanged desktop is refreshed each idle interval; Changes go out with the next tick
+                ok = ok && result.maxGap <= scenario.idleInterval + interval + MAX_WAKE_LATENCY &&
+                     result.maxDamageWait <= scenario.encodeTime + interval + MAX_WAKE_LATENCY &&
+                     result.maxLateness <= MAX_WAKE_LATENCY;
+                if (scenario.damageEvery == 0)
+                    ok = ok && result.minGap >= scenario.idleInterval;
+            }
+
+            printf("%-24s seed %u: %5llu taken of %5llu ticks (expected %5llu), %5llu skipped, late up to %5lld us, "
+                   "gap %6.2f to %6.2f ms, damage waits up to %5.2f ms%s\n",
+                   scenario.name, seed, (unsigned long long)result.taken, (unsigned long long)result.ticks,
+                   (unsigned long long)result.expectedTicks, (unsigned long long)result.skipped,
+                   result.maxLateness, result.minGap / 1000.0, result.maxGap / 1000.0,
+                   result.maxDamageWait / 1000.0, ok ? "" : "  FAIL");
+            if (!ok)
+                errors++;
+        }
+    }
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+// Drives KeyframeGate in simulated time, first through scripted sequences of frames and losses checking each
+// decision and keyframe request, then through a long lossy stream. The decoder must never see a frame whose
+// reference chain back to an IDR frame is broken, and must never miss a frame it could have decoded.
+
+#include "client/KeyframeGate.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static constexpr long long FRAME_INTERVAL = 16'667;  // 60fps
+static constexpr int GOP_LENGTH = 300;                //< Frames between periodic IDR frames
+
+static long long simulatedNow = 0;
+
+static long long simulatedClock() {
+    return simulatedNow;
+}
+
+enum class Event { FRAME, IDR, LOST };
+
+struct Step {
+    long long time;
+    Event event;
+    bool admitted;      //< Expected return of admit(); Ignored for LOST
+    uint64_t requests;  //< Expected keyframe requests so far
+};
+
+struct Script {
+    const char* name;
+    std::vector<Step> steps;
+    uint64_t losses;
+    uint64_t dropped;
+};
+
+static bool runScript(const Script& script) {
+    uint64_t requested = 0;
+    simulatedNow = 0;
+    KeyframeGate gate([&]() { requested++; }, &simulatedClock);
+
+    bool ok = true;
+    for (size_t i = 0; i < script.steps.size(); i++) {
+        const Step& step = script.steps[i];
+        simulatedNow = step.time;
+
+        if (step.event == Event::LOST) {
+            gate.markLost();
+        } else if (gate.admit(step.event == Event::IDR) != step.admitted) {
+            printf("%s: Step %zu should %sbe admitted\n", script.name, i, step.admitted ? "" : "not ");
+            ok = false;
+        }
+
+        if (requested != step.requests || gate.getStat().requests != step.requests) {
+            printf("%s: Step %zu should have made %llu requests, but made %llu (stat %llu)\n", script.name, i,
+                   (unsigned long long)step.requests, (unsigned long long)requested,
+                   (unsigned long long)gate.getStat().requests);
+            ok = false;
+        }
+    }
+
+    KeyframeGate::Stat stat = gate.getStat();
+    return ok && stat.losses == script.losses && stat.dropped == script.dropped;
+}
+
+struct Result {
+    int decoded;
+    int undecodable;  //< Admitted with a broken reference chain
+    int heldBack;     //< Not admitted although the chain was intact
+    uint64_t requests;
+    int losses;
+    int longestLoss;    //< Most frames lost in a row
+    float maxRecovery;  //< In ms
+};
+
+static Result simulate(double lossRate, unsigned seed) {
+    std::mt19937 random(seed);
+    std::bernoulli_distribution isLost(lossRate);
+
+    uint64_t requested = 0;
+    bool idrRequested = false;
+    simulatedNow = 0;
+    KeyframeGate gate(
+        [&]() {
+            requested++;
+            idrRequested = true;
+        },
+        &simulatedClock);
+
+    // Joined in the middle of a GOP, which counts as a loss
+    Result result = {0, 0, 0, 0, 1, 0, 0};
+    bool chainIntact = false;
+    bool lostSinceIDR = true;
+    int lossRun = 0;
+    for (int i = 1; i < 60 * 600; i++) {
+        simulatedNow = i * FRAME_INTERVAL;
+
+        // Server answers a request with the next frame
+        bool isIDR = i % GOP_LENGTH == 0 || idrRequested;
+        if (isLost(random)) {
+            gate.markLost();
+            chainIntact = false;
+            if (!lostSinceIDR)
+                result.losses++;
+            lostSinceIDR = true;
+            result.longestLoss = std::max(result.longestLoss, ++lossRun);
+            continue;
+        }
+        lossRun = 0;
+        if (isIDR) {
+            idrRequested = false;
+            chainIntact = true;
+            lostSinceIDR = false;
+        }
+
+        if (gate.admit(isIDR)) {
+            result.decoded++;
+            if (!chainIntact)
+                result.undecodable++;
+        } else if (chainIntact) {
+            result.heldBack++;
+        }
+    }
+
+    KeyframeGate::Stat stat = gate.getStat();
+    result.requests = requested;
+    result.maxRecovery = stat.recovery.valid() ? stat.recovery.max : 0;
+    return result;
+}
+
+int main() {
+    using E = Event;
+    static constexpr long long T = FRAME_INTERVAL;
+
+    // Losses are only counted once per wait, and every frame held back while waiting counts as dropped
+    const Script scripts[] = {
+        {"joined mid GOP", {{0, E::FRAME, false, 1}, {T, E::FRAME, false, 1}, {2 * T, E::IDR, true, 1},
+                            {3 * T, E::FRAME, true, 1}}, 1, 2},
+        {"joined at IDR", {{0, E::IDR, true, 0}, {T, E::FRAME, true, 0}, {2 * T, E::FRAME, true, 0}}, 0, 0},
+        {"loss", {{0, E::IDR, true, 0}, {T, E::FRAME, true, 0}, {2 * T, E::LOST, false, 1},
+                  {3 * T, E::FRAME, false, 1}, {4 * T, E::FRAME, false, 1}, {5 * T, E::IDR, true, 1},
+                  {6 * T, E::FRAME, true, 1}}, 1, 2},
+        {"losses while waiting", {{0, E::IDR, true, 0}, {T, E::LOST, false, 1}, {2 * T, E::LOST, false, 1},
+                                  {3 * T, E::FRAME, false, 1}, {4 * T, E::LOST, false, 1},
+                                  {5 * T, E::IDR, true, 1}}, 1, 1},
+        {"retry each second", {{0, E::IDR, true, 0}, {T, E::LOST, false, 1},
+                               {T + 999'999, E::FRAME, false, 1}, {T + 1'000'000, E::FRAME, false, 2},
+                               {T + 1'500'000, E::FRAME, false, 2}, {T + 2'000'000, E::FRAME, false, 3},
+                               {T + 2'100'000, E::IDR, true, 3}}, 1, 4},
+        {"loss after recovery", {{0, E::FRAME, false, 1}, {T, E::IDR, true, 1}, {2 * T, E::LOST, false, 2},
+                                 {3 * T, E::IDR, true, 2}, {4 * T, E::FRAME, true, 2}}, 2, 1},
+    };
+
+    int errors = 0;
+
+    for (const Script& script : scripts) {
+        bool ok = runScript(script);
+        printf("%s%s\n", script.name, ok ? "" : "  FAIL");
+        if (!ok)
+            errors++;
+    }
+
+    for (double lossRate : {0.0, 0.01, 0.1}) {
+        for (unsigned seed = 1; seed <= 3; seed++) {
+            Result result = simulate(lossRate, seed);
+
+            // Every loss is answered by the very next frame that arrives, so nothing needs a retry
+            float recoveryBound = (result.longestLoss + 1) * FRAME_INTERVAL / 1000.0f + 0.01f;
+            bool ok = result.undecodable == 0 && result.heldBack == 0 &&
+                      result.requests == static_cast<uint64_t>(result.losses) && result.maxRecovery <= recoveryBound;
+            printf("loss %4.1f%% seed %u: %5d decoded, %d undecodable, %d held back, %3d losses, %3llu requests, "
+                   "recovery up to %5.2f ms%s\n",
+                   lossRate * 100, seed, result.decoded, result.undecodable, result.heldBack, result.losses,
+                   (unsigned long long)result.requests, result.maxRecovery, ok ? "" : "  FAIL");
+            if (!ok)
+                errors++;
+        }
+    }
+
+    return errors == 0 ? 0 : 1;
+}
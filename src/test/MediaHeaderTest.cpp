@@ -0,0 +1,138 @@
+// Round trips media packets through MediaHeader, checking that every field survives and that decoding into a
+// PacketArena, like receivers do, doesn't allocate. Also prints time per round trip next to protobuf framing.
+
+#include "test/AllocationCounter.h"
+
+#include "common/net/MediaHeader.h"
+#include "common/net/PacketArena.h"
+
+#include <packet.pb.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static constexpr size_t BENCH_ROUNDS = 1'000'000;
+
+static std::vector<msg::Packet> makePackets() {
+    std::mt19937_64 random(1);
+    std::vector<msg::Packet> ret;
+
+    for (int i = 0; i < 16; i++) {
+        msg::Packet& pkt = ret.emplace_back();
+        pkt.set_extra_data_len(static_cast<uint32_t>(random()));
+        auto* m = pkt.mutable_desktop_frame();
+        m->set_cursor_visible(i & 1);
+        m->set_is_idr(i & 2);
+        m->set_cursor_x(static_cast<int32_t>(random()));
+        m->set_cursor_y(-static_cast<int32_t>(random() % 1000));
+        m->set_frame_id(random());
+        m->set_time_captured(random());
+        m->set_time_scaled(i & 4 ? random() : 0);
+        m->set_time_encoded(random());
+        m->set_time_send_queued(random());
+    }
+
+    for (int i = 0; i < 16; i++) {
+        msg::Packet& pkt = ret.emplace_back();
+        pkt.set_extra_data_len(static_cast<uint32_t>(random() % 2000));
+        auto* m = pkt.mutable_audio_frame();
+        m->set_channels(i & 1 ? 2 : 1);
+        m->set_is_first_packet(i == 0);
+        m->set_sequence(static_cast<uint32_t>(random()));
+        m->set_time_captured(random());
+    }
+
+    for (int i = 0; i < 16; i++) {
+        msg::Packet& pkt = ret.emplace_back();
+        pkt.set_extra_data_len(0);
+        auto* m = pkt.mutable_cursor_position();
+        m->set_visible(i & 1);
+        m->set_x(static_cast<int32_t>(random()));
+        m->set_y(static_cast<int32_t>(random()));
+    }
+
+    return ret;
+}
+
+// Returns number of packets that didn't survive the round trip
+static int checkRoundTrip(const std::vector<msg::Packet>& packets) {
+    int errors = 0;
+    uint8_t buffer[MediaHeader::MAX_SIZE];
+    msg::Packet decoded;
+
+    for (const msg::Packet& pkt : packets) {
+        size_t len = MediaHeader::encode(pkt, buffer);
+        if (len < 2 || buffer[0] != MediaHeader::MARKER || len != 2 + MediaHeader::bodySize(buffer[1])) {
+            printf("Bad header for packet case %d: %zu bytes\n", static_cast<int>(pkt.msg_case()), len);
+            errors++;
+            continue;
+        }
+
+        MediaHeader::decode(buffer[1], buffer + 2, &decoded);
+        if (decoded.SerializeAsString() != pkt.SerializeAsString()) {
+            printf("Packet case %d changed after round trip\n", static_cast<int>(pkt.msg_case()));
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+// Returns allocations after warm up
+static size_t benchMediaHeader(const std::vector<msg::Packet>& packets) {
+    uint8_t buffer[MediaHeader::MAX_SIZE];
+    PacketArena arena;
+
+    auto roundTrip = [&](size_t i) {
+        const msg::Packet& pkt = packets[i % packets.size()];
+        MediaHeader::encode(pkt, buffer);
+        MediaHeader::decode(buffer[1], buffer + 2, &arena.next());
+    };
+
+    for (size_t i = 0; i < packets.size(); i++)
+        roundTrip(i);
+
+    size_t allocsBefore = allocationCount.load(std::memory_order_relaxed);
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < BENCH_ROUNDS; i++)
+        roundTrip(i);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    size_t allocs = allocationCount.load(std::memory_order_relaxed) - allocsBefore;
+
+    printf("MediaHeader: %.1f ns, %.3f allocations per round trip\n", elapsed / BENCH_ROUNDS * 1e9,
+           static_cast<double>(allocs) / BENCH_ROUNDS);
+    return allocs;
+}
+
+// For comparison only
+static void benchProtobuf(const std::vector<msg::Packet>& packets) {
+    std::string buffer;
+    PacketArena arena;
+
+    size_t allocsBefore = allocationCount.load(std::memory_order_relaxed);
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < BENCH_ROUNDS; i++) {
+        packets[i % packets.size()].SerializeToString(&buffer);
+        arena.next().ParseFromString(buffer);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    size_t allocs = allocationCount.load(std::memory_order_relaxed) - allocsBefore;
+
+    printf("Protobuf:    %.1f ns, %.3f allocations per round trip\n", elapsed / BENCH_ROUNDS * 1e9,
+           static_cast<double>(allocs) / BENCH_ROUNDS);
+}
+
+int main() {
+    const std::vector<msg::Packet> packets = makePackets();
+
+    int errors = checkRoundTrip(packets);
+    if (benchMediaHeader(packets) != 0)
+        errors++;
+    benchProtobuf(packets);
+
+    return errors == 0 ? 0 : 1;
+}
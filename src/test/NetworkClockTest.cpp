@@ -0,0 +1,112 @@
+// Drives NetworkClock in simulated time against a server clock that runs off by a hundred ppm, answering pings
+// over a network with queueing delay and occasional spikes. Pings are sent whenever NetworkClock asks for them.
+// Between pings, time() must keep following the server clock, and must never go backwards.
+
+#include "client/NetworkClock.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static constexpr long long SIMULATED_TIME = 600'000'000;  // 10 minutes
+static constexpr long long SETTLE_TIME = 120'000'000;
+static constexpr long long STEP = 5'000;
+
+// Once drift has settled; Pings are up to seconds apart by then, and a hundred ppm adds up to a millisecond
+// over ten seconds if drift is not applied between them
+static constexpr long long MAX_SETTLED_ERROR = 700;
+
+static long long simulatedNow = 0;
+
+static long long simulatedClock() {
+    return simulatedNow;
+}
+
+struct Result {
+    long long maxSettledError;
+    long long backwards;  //< Largest step back of time()
+    int pings;
+};
+
+struct PendingPing {
+    uint32_t id;
+    long long answered;
+    long long received;
+};
+
+static Result simulate(double skew, unsigned seed) {
+    std::mt19937_64 random(seed);
+    std::exponential_distribution<double> queueing(1.0 / 1500);
+    std::uniform_real_distribution<double> spike(0, 20'000);
+    std::bernoulli_distribution hasSpike(0.05);
+
+    auto oneWayDelay = [&]() {
+        double ret = 3000 + queueing(random);
+        if (hasSpike(random))
+            ret += spike(random);
+        return static_cast<long long>(ret);
+    };
+
+    const long long initialOffset = 123'456'789;
+    auto remoteAt = [&](long long local) { return initialOffset + static_cast<long long>(local * (1 + skew)); };
+
+    simulatedNow = 0;
+    NetworkClock clock(&simulatedClock);
+
+    Result result = {0, 0, 0};
+    std::vector<PendingPing> pending;
+    long long nextPoll = 0;
+    long long lastTime = clock.time().count();
+
+    for (long long now = 0; now < SIMULATED_TIME; now += STEP) {
+        // Answers arrive in between steps; Taking them late would look like asymmetric delay
+        std::sort(pending.begin(), pending.end(),
+                  [](const PendingPing& a, const PendingPing& b) { return a.received < b.received; });
+        while (!pending.empty() && pending.front().received <= now) {
+            simulatedNow = pending.front().received;
+            clock.adjust(pending.front().id, remoteAt(pending.front().answered));
+            pending.erase(pending.begin());
+        }
+        simulatedNow = now;
+
+        if (nextPoll <= simulatedNow) {
+            uint32_t id;
+            std::chrono::milliseconds sleepAmount;
+            if (clock.generatePing(&id, &sleepAmount)) {
+                long long answered = simulatedNow + oneWayDelay();
+                pending.push_back(PendingPing{id, answered, answered + oneWayDelay()});
+                result.pings++;
+            }
+            nextPoll = simulatedNow + std::chrono::microseconds(sleepAmount).count();
+        }
+
+        long long time = clock.time().count();
+        result.backwards = std::max(result.backwards, lastTime - time);
+        lastTime = time;
+
+        if (SETTLE_TIME <= simulatedNow)
+            result.maxSettledError = std::max(result.maxSettledError, std::abs(time - remoteAt(simulatedNow)));
+    }
+
+    return result;
+}
+
+int main() {
+    int errors = 0;
+
+    for (double skew : {100e-6, -100e-6, 0.0}) {
+        for (unsigned seed = 1; seed <= 5; seed++) {
+            Result result = simulate(skew, seed);
+            bool ok = result.maxSettledError <= MAX_SETTLED_ERROR && result.backwards <= 0;
+            printf("skew %+6.1f ppm seed %u: %4d pings, error up to %4lld us once settled, %lld us backwards%s\n",
+                   skew * 1e6, seed, result.pings, result.maxSettledError, result.backwards, ok ? "" : "  FAIL");
+            if (!ok)
+                errors++;
+        }
+    }
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+// Streams 60fps frames with jittery decode times through PlayoutScheduler in simulated time, with a renderer that
+// acts on every decision. SMOOTH mode must present every frame exactly at its target delay, which audio may raise
+// up to the cap, and must skip frames instead of falling further behind. LOWEST_LATENCY must never add delay.
+
+#include "client/NetworkClock.h"
+#include "client/PlayoutScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+static constexpr int FRAME_COUNT = 600;                // 10 seconds
+static constexpr long long FRAME_INTERVAL = 16'667;    // 60fps
+static constexpr long long MIN_DECODE_DELAY = 10'000;  //< Capture to decoded
+static constexpr long long MAX_DECODE_DELAY = 40'000;
+
+static long long simulatedNow = 0;
+
+static long long simulatedClock() {
+    return simulatedNow;
+}
+
+struct Scenario {
+    const char* name;
+    PlayoutScheduler::Mode mode;
+    long long targetDelay;
+    long long audioDelay;  //< Negative if there is no audio
+    long long renderTime;  //< How long the renderer is busy after presenting
+    long long minDelay;    //< Accepted range of capture-to-present delay
+    long long maxDelay;
+    bool expectDrops;
+};
+
+struct Result {
+    long long minDelay;
+    long long maxDelay;
+    int presented;
+    int dropped;
+    int droppedIdle;  //< Dropped with no newer frame to take its place
+};
+
+static Result simulate(const Scenario& scenario, unsigned seed) {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<long long> decodeDelay(MIN_DECODE_DELAY, MAX_DECODE_DELAY);
+
+    std::vector<DesktopFrame<int>> frames(FRAME_COUNT);
+    long long lastDecoded = -1;
+    for (int i = 0; i < FRAME_COUNT; i++) {
+        // Decoder outputs frames in order
+        long long captured = 100'000 + i * FRAME_INTERVAL;
+        lastDecoded = std::max(lastDecoded + 1, captured + decodeDelay(random));
+        frames[i].timeCaptured = std::chrono::microseconds(captured);
+        frames[i].timeDecoded = std::chrono::microseconds(lastDecoded);
+    }
+
+    // Client clock is in sync with server without any ping
+    simulatedNow = 0;
+    PlayoutScheduler scheduler(std::make_shared<NetworkClock>(&simulatedClock));
+    scheduler.setMode(scenario.mode);
+    scheduler.setTargetDelay(std::chrono::microseconds(scenario.targetDelay));
+    scheduler.setAudioDelay(std::chrono::microseconds(scenario.audioDelay));
+
+    Result result = {LLONG_MAX, 0, 0, 0, 0};
+    long long rendererFree = 0;
+    for (int i = 0; i < FRAME_COUNT; i++) {
+        simulatedNow = std::max<long long>(rendererFree, frames[i].timeDecoded.count());
+
+        size_t queued = 0;
+        for (int j = i + 1; j < FRAME_COUNT && frames[j].timeDecoded.count() <= simulatedNow; j++)
+            queued++;
+
+        std::chrono::microseconds waitAmount(0);
+        PlayoutScheduler::Decision decision = scheduler.schedule(frames[i], queued, &waitAmount);
+        if (decision == PlayoutScheduler::Decision::DROP) {
+            result.dropped++;
+            if (queued == 0)
+                result.droppedIdle++;
+            continue;
+        }
+
+        if (decision == PlayoutScheduler::Decision::WAIT)
+            simulatedNow += waitAmount.count();
+
+        long long delay = simulatedNow - frames[i].timeCaptured.count();
+        result.minDelay = std::min(result.minDelay, delay);
+        result.maxDelay = std::max(result.maxDelay, delay);
+        result.presented++;
+        rendererFree = simulatedNow + scenario.renderTime;
+    }
+
+    PlayoutScheduler::Stat stat = scheduler.getStat();
+    if (stat.presentedFrames != static_cast<uint64_t>(result.presented) ||
+        stat.droppedFrames != static_cast<uint64_t>(result.dropped)) {
+        printf("%s: Stat disagrees with decisions\n", scenario.name);
+        result.droppedIdle++;
+    }
+
+    return result;
+}
+
+int main() {
+    using Mode = PlayoutScheduler::Mode;
+
+    // Slow renders take longer than a frame interval, and make decoded frames pile up
+    static constexpr Scenario scenarios[] = {
+        {"lowest latency", Mode::LOWEST_LATENCY, 50'000, -1, 0, MIN_DECODE_DELAY, MAX_DECODE_DELAY, false},
+        {"lowest latency, slow render", Mode::LOWEST_LATENCY, 50'000, -1, 25'000, MIN_DECODE_DELAY,
+         MAX_DECODE_DELAY + FRAME_INTERVAL, true},
+        {"smooth", Mode::SMOOTH, 50'000, -1, 0, 50'000, 50'000, false},
+        {"smooth, target below jitter", Mode::SMOOTH, 20'000, -1, 0, 20'000, MAX_DECODE_DELAY, false},
+        {"smooth, late audio", Mode::SMOOTH, 50'000, 120'000, 0, 120'000, 120'000, false},
+        {"smooth, audio beyond cap", Mode::SMOOTH, 50'000, 400'000, 0, 250'000, 250'000, false},
+        {"smooth, slow render", Mode::SMOOTH, 50'000, -1, 25'000, 50'000, 50'000 + 2 * FRAME_INTERVAL, true},
+    };
+
+    int errors = 0;
+
+    for (const Scenario& scenario : scenarios) {
+        for (unsigned seed = 1; seed <= 3; seed++) {
+            Result result = simulate(scenario, seed);
+            bool ok = scenario.minDelay <= result.minDelay && result.maxDelay <= scenario.maxDelay &&
+                      (0 < result.dropped) == scenario.expectDrops && result.droppedIdle == 0;
+            printf("%-28s seed %u: %3d presented, %3d dropped, delay %6.2f to %6.2f ms%s\n", scenario.name, seed,
+                   result.presented, result.dropped, result.minDelay / 1000.0, result.maxDelay / 1000.0,
+                   ok ? "" : "  FAIL");
+            if (!ok)
+                errors++;
+        }
+    }
+
+    // Frames without timestamp can't be scheduled, and go out as they come
+    simulatedNow = 0;
+    PlayoutScheduler scheduler(std::make_shared<NetworkClock>(&simulatedClock));
+    scheduler.setMode(Mode::SMOOTH);
+    scheduler.setTargetDelay(std::chrono::microseconds(50'000));
+    DesktopFrame<int> frame;
+    std::chrono::microseconds waitAmount(0);
+    bool ok = scheduler.schedule(frame, 1, &waitAmount) == PlayoutScheduler::Decision::PRESENT;
+    printf("no timestamp: presented%s\n", ok ? "" : "  FAIL");
+    if (!ok)
+        errors++;
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+// Streams audio sized chunks between two threads through SpscRingBuffer, and through the mutex protected queues
+// that audio playback used before it. Reports throughput, and how long the consumer (an audio callback in real
+// use) spends in each read call. Not a test; Build without sanitizers for meaningful numbers.
+
+#include "common/RingBuffer.h"
+#include "common/SpscRingBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static constexpr size_t ITEM_COUNT = 500'000'000;
+static constexpr size_t WRITE_CHUNK = 960 * 2;  //< A decoded 20ms opus packet
+static constexpr size_t READ_CHUNK = 480 * 2;   //< A 10ms audio callback
+static constexpr size_t CAPACITY = 5760 * 4;    //< As StreamWindow uses
+
+class SpscQueue {
+public:
+    size_t write(const float* arr, size_t amount) { return ring.write(arr, amount); }
+    size_t read(float* arr, size_t amount) { return ring.read(arr, amount); }
+
+private:
+    SpscRingBuffer<float, CAPACITY> ring;
+};
+
+class MutexRingQueue {
+public:
+    size_t write(const float* arr, size_t amount) {
+        std::lock_guard lock(mutex);
+        amount = std::min(amount, ring.available());
+        ring.write(arr, amount);
+        return amount;
+    }
+
+    size_t read(float* arr, size_t amount) {
+        std::lock_guard lock(mutex);
+        amount = std::min(amount, ring.size());
+        ring.read(arr, amount);
+        return amount;
+    }
+
+private:
+    std::mutex mutex;
+    RingBuffer<float, CAPACITY> ring;
+};
+
+class MutexDequeQueue {
+public:
+    size_t write(const float* arr, size_t amount) {
+        std::lock_guard lock(mutex);
+        amount = std::min(amount, CAPACITY - deque.size());
+        deque.insert(deque.end(), arr, arr + amount);
+        return amount;
+    }
+
+    size_t read(float* arr, size_t amount) {
+        std::lock_guard lock(mutex);
+        amount = std::min(amount, deque.size());
+        std::copy_n(deque.begin(), amount, arr);
+        deque.erase(deque.begin(), deque.begin() + amount);
+        return amount;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<float> deque;
+};
+
+struct Result {
+    double itemsPerSecond;
+    double meanReadTime;  //< In ns
+    double p99ReadTime;
+    double maxReadTime;
+};
+
+template <class Queue>
+static Result run() {
+    auto queue = std::make_unique<Queue>();
+
+    std::thread producer([&]() {
+        std::vector<float> chunk(WRITE_CHUNK, 0.5f);
+        size_t written = 0;
+        while (written < ITEM_COUNT) {
+            size_t amount = queue->write(chunk.data(), std::min(WRITE_CHUNK, ITEM_COUNT - written));
+            if (amount == 0)
+                std::this_thread::yield();
+            written += amount;
+        }
+    });
+
+    std::vector<float> chunk(READ_CHUNK);
+    std::vector<double> readTimes;
+    readTimes.reserve(ITEM_COUNT / READ_CHUNK * 2);
+
+    auto begin = std::chrono::steady_clock::now();
+    size_t received = 0;
+    while (received < ITEM_COUNT) {
+        auto readBegin = std::chrono::steady_clock::now();
+        size_t amount = queue->read(chunk.data(), READ_CHUNK);
+        auto readEnd = std::chrono::steady_clock::now();
+
+        // Empty reads are cheap for all of them, and would only dilute the numbers
+        if (amount != 0)
+            readTimes.push_back(std::chrono::duration<double, std::nano>(readEnd - readBegin).count());
+        else
+            std::this_thread::yield();
+        received += amount;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    producer.join();
+
+    std::sort(readTimes.begin(), readTimes.end());
+    double sum = 0;
+    for (double val : readTimes)
+        sum += val;
+
+    Result ret;
+    ret.itemsPerSecond = ITEM_COUNT / elapsed;
+    ret.meanReadTime = sum / readTimes.size();
+    ret.p99ReadTime = readTimes[readTimes.size() * 99 / 100];
+    ret.maxReadTime = readTimes.back();
+    return ret;
+}
+
+static void report(const char* name, const Result& result) {
+    printf("%-18s %7.1f M floats/s, read %7.1f ns mean, %8.1f ns p99, %10.1f ns max\n", name,
+           result.itemsPerSecond / 1e6, result.meanReadTime, result.p99ReadTime, result.maxReadTime);
+}
+
+int main() {
+    report("SpscRingBuffer", run<SpscQueue>());
+    report("mutex + RingBuffer", run<MutexRingQueue>());
+    report("mutex + deque", run<MutexDequeQueue>());
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Producer and consumer hammer one ring with every mix of calls, and the consumer checks that items arrive
+// in order with nothing lost or duplicated. Meant to run under ThreadSanitizer.
+
+#include "common/SpscRingBuffer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+static constexpr uint32_t ITEM_COUNT = 1'000'000;
+
+// Small and not a multiple of the chunk sizes below, so that wrap around is hit often
+using Ring = SpscRingBuffer<uint32_t, 1000>;
+
+static void produce(Ring* ring) {
+    std::minstd_rand random(1);
+    uint32_t next = 0;
+    uint32_t chunk[64];
+
+    while (next < ITEM_COUNT) {
+        switch (random() % 3) {
+        case 0:
+            if (ring->write(next))
+                next++;
+            break;
+        case 1: {
+            size_t amount = std::min<size_t>(random() % 64 + 1, ITEM_COUNT - next);
+            for (size_t i = 0; i < amount; i++)
+                chunk[i] = next + static_cast<uint32_t>(i);
+            next += static_cast<uint32_t>(ring->write(chunk, amount));
+            break;
+        }
+        default: {
+            size_t amount;
+            uint32_t* area = ring->beginWrite(&amount);
+            amount = std::min<size_t>({amount, random() % 64 + 1, ITEM_COUNT - next});
+            for (size_t i = 0; i < amount; i++)
+                area[i] = next++;
+            ring->endWrite(amount);
+            break;
+        }
+        }
+    }
+}
+
+// Returns number of errors found
+static int consume(Ring* ring) {
+    std::minstd_rand random(2);
+    uint32_t expected = 0;
+    uint32_t chunk[64];
+    int errors = 0;
+
+    auto check = [&](uint32_t val) {
+        if (val != expected && errors++ < 10)
+            fprintf(stderr, "Expected %u but read %u\n", expected, val);
+        expected = val + 1;
+    };
+
+    while (expected < ITEM_COUNT) {
+        switch (random() % 4) {
+        case 0: {
+            uint32_t val;
+            if (ring->read(&val))
+                check(val);
+            break;
+        }
+        case 1: {
+            size_t amount = ring->read(chunk, random() % 64 + 1);
+            for (size_t i = 0; i < amount; i++)
+                check(chunk[i]);
+            break;
+        }
+        case 2: {
+            size_t amount;
+            const uint32_t* area = ring->beginRead(&amount);
+            amount = std::min<size_t>(amount, random() % 64 + 1);
+            for (size_t i = 0; i < amount; i++)
+                check(area[i]);
+            ring->endRead(amount);
+            break;
+        }
+        default:
+            // Items are consecutive, so the next one read tells how many were dropped
+            if (ring->size() != 0 && random() % 16 == 0) {
+                size_t dropped = ring->drop(random() % 8 + 1);
+                expected += static_cast<uint32_t>(dropped);
+            }
+            break;
+        }
+    }
+
+    if (ring->size() != 0 && errors++ < 10)
+        fprintf(stderr, "%zu items left after the last one\n", ring->size());
+    return errors;
+}
+
+int main() {
+    auto ring = std::make_unique<Ring>();
+
+    auto begin = std::chrono::steady_clock::now();
+    std::thread producer(produce, ring.get());
+    int errors = consume(ring.get());
+    producer.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("%u items in %.3f s (%.1f M items/s), %d errors\n", ITEM_COUNT, elapsed, ITEM_COUNT / elapsed / 1e6, errors);
+    return errors == 0 ? 0 : 1;
+}
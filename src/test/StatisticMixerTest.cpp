@@ -0,0 +1,163 @@
+// Pushes several kinds of sample streams through windowed StatisticMixers, and compares every stat against brute
+// force over the same window after each push. Also merges snapshots of mixers that each saw part of a stream,
+// which must agree with brute force over the whole stream. Quantiles only need to be right to a bucket.
+
+#include "common/StatisticMixer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <random>
+#include <vector>
+
+static constexpr int SAMPLE_COUNT = 20'000;
+
+// Mean and stddev are recovered by removing samples, so some rounding error piles up over a long stream
+static constexpr double MAX_RELATIVE_ERROR = 1e-4;
+static constexpr double MAX_QUANTILE_ERROR = 1.0 / 16;  //< A bucket, relative to magnitude
+
+struct Result {
+    int checks;
+    int minMaxErrors;  //< Must be exact
+    int avgErrors;
+    int stddevErrors;
+    int quantileErrors;
+};
+
+static StatisticMixer::Stat bruteForce(const std::vector<float>& samples) {
+    StatisticMixer::Stat ret;
+    ret.samples = samples.size();
+
+    double sum = 0;
+    for (float val : samples)
+        sum += val;
+    double mean = sum / samples.size();
+
+    double m2 = 0;
+    for (float val : samples)
+        m2 += (val - mean) * (val - mean);
+
+    std::vector<float> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    ret.min = sorted.front();
+    ret.max = sorted.back();
+    ret.avg = static_cast<float>(mean);
+    ret.stddev = samples.size() < 2 ? 0.0f : static_cast<float>(std::sqrt(m2 / (samples.size() - 1)));
+    ret.p50 = sorted[static_cast<size_t>(0.5f * (sorted.size() - 1))];
+    ret.p99 = sorted[static_cast<size_t>(0.99f * (sorted.size() - 1))];
+    return ret;
+}
+
+static bool closeTo(double actual, double expected, double scale) {
+    return std::abs(actual - expected) <= MAX_RELATIVE_ERROR * scale;
+}
+
+static bool quantileCloseTo(float actual, float expected) {
+    float zero = std::ldexp(1.0f, LogHistogram::MIN_EXP);
+    return std::abs(actual - expected) <= MAX_QUANTILE_ERROR * std::abs(expected) + zero;
+}
+
+static void compare(const StatisticMixer::Stat& actual, const std::vector<float>& samples, Result* result) {
+    StatisticMixer::Stat expected = bruteForce(samples);
+    double scale = std::max<double>(std::abs(expected.max), std::abs(expected.min));
+
+    result->checks++;
+    if (actual.samples != expected.samples || actual.min != expected.min || actual.max != expected.max)
+        result->minMaxErrors++;
+    if (!closeTo(actual.avg, expected.avg, scale))
+        result->avgErrors++;
+    if (!closeTo(actual.stddev, expected.stddev, scale))
+        result->stddevErrors++;
+    if (!quantileCloseTo(actual.p50, expected.p50) || !quantileCloseTo(actual.p99, expected.p99))
+        result->quantileErrors++;
+}
+
+static Result simulateWindow(const std::function<float(int)>& source, size_t poolSize) {
+    StatisticMixer mixer(poolSize);
+    std::vector<float> window;
+
+    Result result = {0, 0, 0, 0, 0};
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        float val = source(i);
+        mixer.pushValue(val);
+        if (std::isnan(val))
+            continue;
+
+        window.push_back(val);
+        if (poolSize < window.size())
+            window.erase(window.begin());
+        compare(mixer.calcStat(), window, &result);
+    }
+
+    return result;
+}
+
+// Each sample goes to one of `parts` mixers, as if pushed from different threads
+static Result simulateMerge(const std::function<float(int)>& source, int parts, unsigned seed) {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> pickPart(0, parts - 1);
+
+    std::vector<StatisticMixer> mixers(parts);
+    std::vector<float> all;
+
+    Result result = {0, 0, 0, 0, 0};
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        float val = source(i);
+        mixers[pickPart(random)].pushValue(val);
+        if (!std::isnan(val))
+            all.push_back(val);
+
+        if (i % 1000 == 999) {
+            StatisticMixer::Snapshot merged;
+            for (const StatisticMixer& mixer : mixers)
+                merged.merge(mixer.snapshot());
+            compare(merged.calcStat(), all, &result);
+        }
+    }
+
+    return result;
+}
+
+int main() {
+    std::mt19937 random(1);
+    std::normal_distribution<float> normal(5.0f, 1.5f);
+    std::uniform_real_distribution<float> uniform(-100.0f, 100.0f);
+    std::exponential_distribution<float> spike(1.0f / 40);
+    std::bernoulli_distribution hasSpike(0.02);
+    std::bernoulli_distribution isNaN(0.05);
+
+    struct Source {
+        const char* name;
+        std::function<float(int)> next;
+    };
+    const Source sources[] = {
+        {"latency with spikes", [&](int) { return normal(random) + (hasSpike(random) ? spike(random) : 0.0f); }},
+        {"uniform with sign", [&](int) { return uniform(random); }},
+        {"increasing", [&](int i) { return i * 0.01f; }},
+        {"decreasing", [&](int i) { return 1000 - i * 0.01f; }},
+        {"repeating", [&](int i) { return static_cast<float>(i % 7 == 0 ? 3 : 1); }},
+        {"with NaN", [&](int) { return isNaN(random) ? std::numeric_limits<float>::quiet_NaN() : normal(random); }},
+    };
+
+    int errors = 0;
+    auto report = [&](const char* name, const char* kind, const Result& result) {
+        bool ok = result.minMaxErrors == 0 && result.avgErrors == 0 && result.stddevErrors == 0 &&
+                  result.quantileErrors == 0;
+        printf("%-20s %-12s: %5d checks, wrong %d min/max, %d avg, %d stddev, %d quantile%s\n", name, kind,
+               result.checks, result.minMaxErrors, result.avgErrors, result.stddevErrors, result.quantileErrors,
+               ok ? "" : "  FAIL");
+        if (!ok)
+            errors++;
+    };
+
+    for (const Source& source : sources) {
+        report(source.name, "window 1", simulateWindow(source.next, 1));
+        report(source.name, "window 300", simulateWindow(source.next, 300));
+        report(source.name, "merge of 4", simulateMerge(source.next, 4, 1));
+    }
+
+    return errors == 0 ? 0 : 1;
+}